@@ -0,0 +1,108 @@
+/**
+ *  Master access server wire protocol. Local clients share the device link
+ *  through flexsoc-cm3 (see --server).
+ *
+ *  Clients stream requests without waiting for replies. Each request gets
+ *  exactly one response, in request order, carrying the request tag. All
+ *  fields are in host byte order - the socket is local only.
+ *
+ *  Request:  msrv_req_t [payload]
+ *    MSRV_READ   len bytes at addr       -> len bytes
+ *    MSRV_WRITE  len bytes of write data -> nothing
+ *    MSRV_VEC    len x msrv_vec_t        -> len x uint32_t (read data or
+ *                                           echoed write data)
+ *    MSRV_SHM    attach shared rings     -> nothing
+ *  Response: msrv_resp_t [payload]
+ *
+ *  Shared memory: MSRV_SHM passes a memfd of len bytes (SCM_RIGHTS) laid
+ *  out as msrv_shm_t, submission/completion rings and a data arena. Once
+ *  attached, requests are msrv_sqe_t ring entries referencing the arena and
+ *  completions are msrv_resp_t ring entries. Read data and vec results land
+ *  in the arena at the request offset, so nothing is copied through the
+ *  socket. The socket only carries single byte wakeups from then on:
+ *    - client -> server after submitting, unless busy is set
+ *    - server -> client after completing, if wait is set
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#ifndef MSERVER_PROTO_H
+#define MSERVER_PROTO_H
+
+#include <stdint.h>
+
+// Request ops
+#define MSRV_READ      0
+#define MSRV_WRITE     1
+#define MSRV_VEC       2
+#define MSRV_SHM       3
+
+// Access width for read/write - 0 uses widest access possible
+#define MSRV_WIDTH_ANY 0
+
+// Limits per request
+#define MSRV_LEN_MAX   (1 << 20)   // Read/write bytes
+#define MSRV_VEC_MAX   1024        // Vector ops
+
+// Response codes
+#define MSRV_OK        0
+#define MSRV_EINVAL    -1          // Malformed request
+#define MSRV_EFAIL     -2          // Transfer failed on device or link
+
+// Vector op write flag - set in bit 0 of word aligned address
+#define MSRV_VEC_WR    1
+
+typedef struct __attribute__((packed)) {
+  uint8_t  op;
+  uint8_t  width;   // 1, 2, 4 or MSRV_WIDTH_ANY (read/write only)
+  uint16_t tag;     // Echoed in response
+  uint32_t addr;    // Target address (read/write only)
+  uint32_t len;     // Bytes (read/write) or op count (vec)
+} msrv_req_t;
+
+typedef struct __attribute__((packed)) {
+  uint32_t addr;    // Word address | MSRV_VEC_WR
+  uint32_t data;    // Write data
+} msrv_vec_t;
+
+typedef struct __attribute__((packed)) {
+  uint16_t tag;
+  int16_t  rv;      // MSRV_OK or error code
+  uint32_t len;     // Payload bytes following
+} msrv_resp_t;
+
+// Shared memory header
+#define MSRV_SHM_MAGIC 0x4d53524d
+#define MSRV_SHM_MAX   (64 << 20)  // Mapping size limit
+#define MSRV_ENT_MAX   4096        // Ring entries limit
+
+typedef struct {
+  uint32_t magic;
+  uint32_t entries;     // Ring entries, power of 2
+  uint32_t sq_off;      // msrv_sqe_t[entries]
+  uint32_t cq_off;      // msrv_resp_t[entries]
+  uint32_t arena_off;
+  uint32_t arena_sz;
+
+  // Ring indices on their own cache lines - free running
+  uint32_t sq_head __attribute__((aligned (64)));
+  uint32_t sq_tail __attribute__((aligned (64)));
+  uint32_t cq_head __attribute__((aligned (64)));
+  uint32_t cq_tail __attribute__((aligned (64)));
+
+  // Wakeup flags
+  uint32_t busy __attribute__((aligned (64)));  // Server will poll sq
+  uint32_t wait __attribute__((aligned (64)));  // Client sleeping
+} msrv_shm_t;
+
+typedef struct {
+  uint8_t  op;
+  uint8_t  width;
+  uint16_t tag;
+  uint32_t addr;
+  uint32_t len;
+  uint32_t off;     // Arena offset of write data, read buffer or vec ops
+} msrv_sqe_t;
+
+#endif /* MSERVER_PROTO_H */
@@ -0,0 +1,41 @@
+/**
+ *  Scope capture file layout (see flexsoc-cm3 --scope).
+ *
+ *  Columnar so each variable can be read without touching the others:
+ *    scope_hdr_t, scope_var_t[vars], padded to SCOPE_HDR_SZ
+ *    block 0, block 1, ...
+ *  Each block holds block samples as consecutive columns:
+ *    uint64_t ns[block]          - sample time since start
+ *    value[block] per variable   - width bytes each, target byte order
+ *  Only the first samples entries are valid - the last block may be partial.
+ *  samples is updated at every flush, so a live file can be followed.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#ifndef SCOPE_FILE_H
+#define SCOPE_FILE_H
+
+#include <stdint.h>
+
+#define SCOPE_MAGIC    0x50435346  // "FSCP"
+#define SCOPE_VERSION  1
+#define SCOPE_HDR_SZ   4096
+#define SCOPE_VAR_MAX  ((SCOPE_HDR_SZ - sizeof (scope_hdr_t)) / sizeof (scope_var_t))
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t vars;        // Variables (columns after time)
+  uint32_t block;       // Samples per block
+  uint64_t samples;     // Valid samples
+  uint64_t start;       // CLOCK_REALTIME ns of first sample
+} scope_hdr_t;
+
+typedef struct {
+  uint32_t addr;
+  uint32_t width;       // 1, 2 or 4 bytes
+} scope_var_t;
+
+#endif /* SCOPE_FILE_H */
@@ -55,11 +55,15 @@ module flexsoc_cm3
 
    // Dropped host comm bytes
    logic [9:0]          dropped;
+
+   // Host FIFO depth (bytes = 1 << HOST_FIFO_AW)
+   localparam HOST_FIFO_AW = 8;
    
    // Initialize SoC registers
    assign cpu_reset_i = ~PORESETn ? 1'b1 : cpu_reset_o;
    assign slave_en_i = slave_en_o;
-   assign flexsoc_id = 32'hf1ec50c1;
+   assign flexsoc_id = 32'hf1ec50c2;
+   assign host_fifo_depth = 1 << HOST_FIFO_AW;
    assign memory_id = (ROM_SZ >> 10) | ((RAM_SZ >> 10) << 16);
    assign core_freq = CORE_FREQ;
    assign brg_base = REMOTE_BASE;
@@ -326,7 +330,7 @@ module flexsoc_cm3
    
    // Arb => Transport
    dual_clock_fifo #(
-                     .ADDR_WIDTH   (8),
+                     .ADDR_WIDTH   (HOST_FIFO_AW),
                      .DATA_WIDTH   (8))
    u_tx_fifo (
               .wr_clk_i   (CLK),
@@ -343,7 +347,7 @@ module flexsoc_cm3
 
    // Transport => Arb
    dual_clock_fifo #(
-                     .ADDR_WIDTH   (8),
+                     .ADDR_WIDTH   (HOST_FIFO_AW),
                      .DATA_WIDTH   (8))
    u_rx_fifo (
               .rd_clk_i   (CLK),
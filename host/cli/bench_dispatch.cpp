@@ -0,0 +1,289 @@
+/**
+ *  Measure host side slave handling without a device. A sysmap is loaded as
+ *  flexsoc-cm3 would and slave packets are fed straight through the plugin
+ *  decode, dispatch and response encoding stages. Reports ns/transaction per
+ *  stage and end to end.
+ *
+ *  Packets are replayed from a recording (flexsoc-cm3 --record FILE) or
+ *  generated over an address range. Plugins which access the device from
+ *  their handlers (Redirect, etc) can't be used without one.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <argp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+
+#include "plugini.h"
+#include "err.h"
+#include "log.h"
+
+#define SLAVE_WRITE  (1 << 3)
+#define PKT_MAX      9
+
+static struct {
+  char     *map;
+  char    **path;
+  int       path_cnt;
+  char     *replay;
+  uint32_t  addr;
+  uint32_t  span;
+  bool      rd, wr;
+  int       width;     // 0 = mixed
+  int       cnt;
+  int       trials;
+  int       verbose;
+} args;
+
+// Packet stream
+static uint8_t *pkts;
+static int *offs, *lens, npkt;
+
+static int pkt_len (uint8_t hdr)
+{
+  return (hdr & SLAVE_WRITE) ? 5 + (1 << (hdr & 3)) : 5;
+}
+
+static void replay_load (const char *file)
+{
+  FILE *fp;
+  long size, pos;
+
+  fp = fopen (file, "rb");
+  if (!fp)
+    err ("Failed to open: %s", file);
+  fseek (fp, 0, SEEK_END);
+  size = ftell (fp);
+  fseek (fp, 0, SEEK_SET);
+  pkts = (uint8_t *)malloc (size);
+  offs = (int *)malloc (sizeof (int) * size / 5);
+  lens = (int *)malloc (sizeof (int) * size / 5);
+  if (!pkts || !offs || !lens)
+    err ("Failed to malloc");
+  if (fread (pkts, 1, size, fp) != (size_t)size)
+    err ("Failed to read: %s", file);
+  fclose (fp);
+
+  // Index packets
+  for (pos = 0; pos < size; pos += lens[npkt++]) {
+    offs[npkt] = pos;
+    lens[npkt] = pkt_len (pkts[pos]);
+    if (((pkts[pos] & 3) == 3) || (pos + lens[npkt] > size))
+      err ("Corrupt recording at offset %ld", pos);
+  }
+}
+
+static void generate (void)
+{
+  int i, pos = 0;
+  uint8_t size;
+  uint32_t addr, data, rnd = 0x2545f491;
+  bool write;
+
+  pkts = (uint8_t *)malloc (args.cnt * PKT_MAX);
+  offs = (int *)malloc (sizeof (int) * args.cnt);
+  lens = (int *)malloc (sizeof (int) * args.cnt);
+  if (!pkts || !offs || !lens)
+    err ("Failed to malloc");
+
+  for (i = 0; i < args.cnt; i++) {
+
+    // xorshift32
+    rnd ^= rnd << 13;
+    rnd ^= rnd >> 17;
+    rnd ^= rnd << 5;
+
+    // Pick op, width and aligned address
+    write = args.rd && args.wr ? (rnd >> 31) : args.wr;
+    size = args.width ? __builtin_ctz (args.width) : (rnd >> 29) % 3;
+    addr = args.addr + ((rnd % args.span) & ~((1 << size) - 1));
+    data = rnd;
+
+    // Encode as device would
+    offs[i] = pos;
+    pkts[pos] = (write ? SLAVE_WRITE : 0) | size;
+    *((uint32_t *)&pkts[pos + 1]) = htonl (addr);
+    lens[i] = pkt_len (pkts[pos]);
+    if (write) {
+      switch (size) {
+        case 0: pkts[pos + 5] = data; break;
+        case 1: *((uint16_t *)&pkts[pos + 5]) = htons (data); break;
+        default: *((uint32_t *)&pkts[pos + 5]) = htonl (data); break;
+      }
+    }
+    pos += lens[i];
+  }
+  npkt = args.cnt;
+}
+
+static uint64_t now_ns (void)
+{
+  timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void report (const char *stage, uint64_t ns)
+{
+  printf ("  %-8s %8.1f ns/txn %8.2f Mtxn/s\n", stage,
+          (double)ns / npkt, ns ? npkt * 1000.0 / ns : 0);
+}
+
+static void bench (void)
+{
+  int i, t, rlen = 0;
+  uint8_t *resp;
+  uint64_t start, best[4];
+  slave_trans_t *trans;
+
+  trans = (slave_trans_t *)malloc (sizeof (slave_trans_t) * npkt);
+  resp = (uint8_t *)malloc (npkt * 5);
+  if (!trans || !resp)
+    err ("Failed to malloc");
+  memset (best, 0xff, sizeof (best));
+
+  for (t = 0; t < args.trials; t++) {
+
+    // Each stage over the whole stream
+    start = now_ns ();
+    for (i = 0; i < npkt; i++)
+      plugin_decode (&pkts[offs[i]], lens[i], &trans[i]);
+    best[0] = std::min (best[0], now_ns () - start);
+
+    start = now_ns ();
+    for (i = 0; i < npkt; i++)
+      plugin_dispatch (&trans[i]);
+    best[1] = std::min (best[1], now_ns () - start);
+
+    rlen = 0;
+    start = now_ns ();
+    for (i = 0; i < npkt; i++)
+      rlen += plugin_encode (&trans[i], &resp[i * 5]);
+    best[2] = std::min (best[2], now_ns () - start);
+
+    // End to end per packet as the slave handler runs
+    start = now_ns ();
+    for (i = 0; i < npkt; i++) {
+      plugin_decode (&pkts[offs[i]], lens[i], &trans[0]);
+      plugin_dispatch (&trans[0]);
+      plugin_encode (&trans[0], resp);
+    }
+    best[3] = std::min (best[3], now_ns () - start);
+  }
+
+  // Best of trials
+  printf ("%d transactions x %d trials (%d response bytes)\n",
+          npkt, args.trials, rlen);
+  report ("decode", best[0]);
+  report ("dispatch", best[1]);
+  report ("encode", best[2]);
+  report ("total", best[3]);
+
+  free (resp);
+  free (trans);
+}
+
+static int parse_opts (int key, char *arg, struct argp_state *state)
+{
+  switch (key) {
+    case 'm': args.map = arg; break;
+    case 'r': args.replay = arg; break;
+    case 'a': args.addr = strtoul (arg, NULL, 0); break;
+    case 's': args.span = strtoul (arg, NULL, 0); break;
+    case 'n': args.cnt = strtoul (arg, NULL, 0); break;
+    case 't': args.trials = strtoul (arg, NULL, 0); break;
+    case 'v': args.verbose = strtoul (arg, NULL, 0); break;
+
+    case 'p':
+      args.path = (char **)realloc (args.path, sizeof (char *) * (args.path_cnt + 1));
+      args.path[args.path_cnt++] = arg;
+      break;
+
+    case 'o':
+      args.rd = strchr (arg, 'r') != NULL;
+      args.wr = strchr (arg, 'w') != NULL;
+      break;
+
+    case 'w':
+      args.width = strtoul (arg, NULL, 0);
+      if ((args.width != 0) && (args.width != 1) &&
+          (args.width != 2) && (args.width != 4))
+        argp_error (state, "width must be 0, 1, 2 or 4");
+      break;
+
+    // Check arguments
+    case ARGP_KEY_END:
+      if (!args.map || (!args.rd && !args.wr) ||
+          (args.span == 0) || (args.cnt <= 0) || (args.trials <= 0))
+        argp_usage (state);
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+  }
+  return 0;
+}
+
+static struct argp_option options[] = {
+  {"map",     'm', "FILE", 0, "System map file"},
+  {"path",    'p', "DIR",  0, "Plugin search path\nmultiple path opts supported"},
+  {"replay",  'r', "FILE", 0, "Replay recorded slave packets (flexsoc-cm3 --record)"},
+  {"addr",    'a', "ADDR", 0, "Generated base address (default=0x40000000)"},
+  {"span",    's', "BYTES", 0, "Generated address span (default=4096)"},
+  {"ops",     'o', "r|w|rw", 0, "Generated operations (default=rw)"},
+  {"width",   'w', "0|1|2|4", 0, "Generated access width, 0=mixed (default=4)"},
+  {"count",   'n', "N",    0, "Generated transactions (default=1000000)"},
+  {"trials",  't', "N",    0, "Trials, best reported (default=5)"},
+  {"verbose", 'v', "INT",  0, "Verbosity level (0-4)"},
+  {0}
+};
+
+static struct argp bench_argp = {options, &parse_opts, 0, 0};
+
+int main (int argc, char **argv)
+{
+  // Defaults
+  args.addr = 0x40000000;
+  args.span = 4096;
+  args.rd = args.wr = true;
+  args.width = 4;
+  args.cnt = 1000000;
+  args.trials = 5;
+  args.verbose = LOG_NORMAL;
+#if defined(INSTALL_PREFIX)
+  args.path = (char **)malloc (sizeof (char *));
+  args.path[args.path_cnt++] = (char *)INSTALL_PREFIX;
+#endif
+
+  // Parse args
+  argp_parse (&bench_argp, argc, argv, 0, 0, 0);
+  log_init (args.verbose);
+
+  // Load plugins without a device
+  plugin_init (NULL, args.map, args.path, args.path_cnt);
+
+  // Build packet stream
+  if (args.replay)
+    replay_load (args.replay);
+  else
+    generate ();
+  if (!npkt)
+    err ("No transactions");
+
+  bench ();
+
+  plugin_cleanup ();
+  free (pkts);
+  free (offs);
+  free (lens);
+  free (args.path);
+  return 0;
+}
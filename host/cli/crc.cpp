@@ -0,0 +1,169 @@
+/**
+ *  Target side CRC32.
+ *
+ *  The helper runs from the top of RAM (see stub.h) with its lookup table,
+ *  mailbox and result array:
+ *    0x00 REQ    Requests posted (host)
+ *    0x04 ACK    Requests served (target), 0 once running
+ *    0x08 ADDR   First block
+ *    0x0C LEN    Bytes per block
+ *    0x10 CNT    Blocks (<= CRC_MAX)
+ *    0x20 TABLE  256 entry lookup table (host)
+ *    0x420 CRC   Result per block
+ *  Table driven CRC runs at a few cycles per byte, well above link speed.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <string.h>
+
+#include "crc.h"
+#include "stub.h"
+#include "Target.h"
+#include "log.h"
+
+// Results per request
+#define CRC_MAX      256
+
+// Helper layout
+#define CRC_MBOX     0x0050
+#define CRC_AREA     (CRC_MBOX + MBOX_CRC + (CRC_MAX * 4))
+
+// Mailbox offsets
+#define MBOX_REQ     0x00
+#define MBOX_ACK     0x04
+#define MBOX_ADDR    0x08
+#define MBOX_LEN     0x0C
+#define MBOX_CNT     0x10
+#define MBOX_TABLE   0x20
+#define MBOX_CRC     0x420
+
+// Thumb-2 CRC helper - position independent, mailbox follows code
+// r0=crc r1=in r2=block end r3=blocks left r4=table r5=out r6=req r7=mailbox
+static const uint8_t stub[] = {
+  0x0f, 0xf2, 0x4c, 0x07,  // 00 start:  adr.w r7, mbox
+  0x00, 0x26,              // 04         movs r6, #0
+  0x7e, 0x60,              // 06         str r6, [r7, #4]
+  0x38, 0x68,              // 08 wait:   ldr r0, [r7]
+  0xb0, 0x42,              // 0A         cmp r0, r6
+  0xfc, 0xd0,              // 0C         beq wait
+  0x06, 0x46,              // 0E         mov r6, r0
+  0xb9, 0x68,              // 10         ldr r1, [r7, #8]
+  0x3b, 0x69,              // 12         ldr r3, [r7, #16]
+  0x07, 0xf1, 0x20, 0x04,  // 14         add.w r4, r7, #0x20
+  0x07, 0xf5, 0x84, 0x65,  // 18         add.w r5, r7, #0x420
+  0xab, 0xb1,              // 1C blk:    cbz r3, fin
+  0xfa, 0x68,              // 1E         ldr r2, [r7, #12]
+  0x0a, 0x44,              // 20         add r2, r1
+  0x4f, 0xf0, 0xff, 0x30,  // 22         mov.w r0, #-1
+  0x91, 0x42,              // 26 byte:   cmp r1, r2
+  0x0a, 0xd2,              // 28         bhs bdone
+  0x11, 0xf8, 0x01, 0xcb,  // 2A         ldrb r12, [r1], #1
+  0x8c, 0xea, 0x00, 0x0c,  // 2E         eor.w r12, r12, r0
+  0x0c, 0xf0, 0xff, 0x0c,  // 32         and r12, r12, #255
+  0x54, 0xf8, 0x2c, 0xc0,  // 36         ldr.w r12, [r4, r12, lsl #2]
+  0x8c, 0xea, 0x10, 0x20,  // 3A         eor.w r0, r12, r0, lsr #8
+  0xf2, 0xe7,              // 3E         b byte
+  0xc0, 0x43,              // 40 bdone:  mvns r0, r0
+  0x45, 0xf8, 0x04, 0x0b,  // 42         str r0, [r5], #4
+  0x01, 0x3b,              // 46         subs r3, #1
+  0xe8, 0xe7,              // 48         b blk
+  0x7e, 0x60,              // 4A fin:    str r6, [r7, #4]
+  0xdc, 0xe7,              // 4C         b wait
+  0x00, 0xbf,              // 4E         (pad)
+};
+
+static uint32_t table[256];
+static uint32_t base, req;
+
+static void table_init (void)
+{
+  uint32_t i, j, c;
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (j = 0; j < 8; j++)
+      c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+    table[i] = c;
+  }
+}
+
+uint32_t crc32 (uint32_t crc, const void *buf, size_t len)
+{
+  const uint8_t *p = (const uint8_t *)buf;
+
+  if (!table[1])
+    table_init ();
+  crc = ~crc;
+  while (len--)
+    crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+int crc_open (void)
+{
+  Target *target = Target::Ptr ();
+  uint32_t hdr[2] = {0, 0xffffffff};
+
+  base = stub_base (CRC_AREA);
+  if (!base)
+    return -1;
+  if (!table[1])
+    table_init ();
+
+  // Table and mailbox, then run
+  target->WriteW (base + CRC_MBOX + MBOX_TABLE, table, 256);
+  target->WriteW (base + CRC_MBOX, hdr, 2);
+  req = 0;
+  stub_start (base, stub, sizeof (stub));
+
+  // Vectors can go back once it is running
+  if (stub_wait (base + CRC_MBOX + MBOX_ACK, 0)) {
+    log (LOG_ERR, "crc: helper did not start");
+    crc_close ();
+    return -1;
+  }
+  stub_vectors ();
+  return 0;
+}
+
+int crc_blocks (uint32_t addr, uint32_t len, uint32_t cnt, uint32_t *crc)
+{
+  Target *target = Target::Ptr ();
+  uint32_t mbox = base + CRC_MBOX, n, cmd[3];
+
+  if (!base)
+    return -1;
+  if ((addr < base + CRC_AREA) && ((uint64_t)addr + (uint64_t)len * cnt > base))
+    return 1;
+
+  // Host writes must land before the helper reads
+  target->CacheFlush ();
+  while (cnt) {
+    n = (cnt < CRC_MAX) ? cnt : CRC_MAX;
+    cmd[0] = addr;
+    cmd[1] = len;
+    cmd[2] = n;
+    target->WriteW (mbox + MBOX_ADDR, cmd, 3);
+    req++;
+    target->WriteW (mbox + MBOX_REQ, &req, 1);
+    if (stub_wait (mbox + MBOX_ACK, req)) {
+      log (LOG_ERR, "crc: helper stalled at %08X", addr);
+      return -1;
+    }
+    target->ReadW (mbox + MBOX_CRC, crc, n);
+    addr += n * len;
+    crc += n;
+    cnt -= n;
+  }
+  return 0;
+}
+
+void crc_close (void)
+{
+  if (!base)
+    return;
+  stub_stop ();
+  base = 0;
+}
@@ -0,0 +1,29 @@
+/**
+ *  Target side CRC32. A small helper on the local CPU checksums target
+ *  memory in blocks so images can be diffed and verified without reading
+ *  them back over the link.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#ifndef CRC_H
+#define CRC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// CRC32 (zlib polynomial) of buf - pass 0 to start
+uint32_t crc32 (uint32_t crc, const void *buf, size_t len);
+
+// Start helper - the CPU runs until crc_close
+int crc_open (void);
+
+// CRC32 of cnt consecutive blocks of len bytes from addr into crc[cnt]
+// Returns 1 if the range overlaps the helper, -1 on failure
+int crc_blocks (uint32_t addr, uint32_t len, uint32_t cnt, uint32_t *crc);
+
+// Stop helper, CPU back in reset
+void crc_close (void);
+
+#endif /* CRC_H */
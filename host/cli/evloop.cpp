@@ -0,0 +1,219 @@
+/**
+ *  Main thread event loop. Blocks on signals, timers and registered file
+ *  descriptors instead of spinning.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "evloop.h"
+#include "ll.h"
+#include "log.h"
+
+#define MAX_EVENTS  16
+
+typedef struct {
+  list_t      list;
+  int         fd;
+  bool        timer;   // Loop owns fd
+  evloop_cb_t cb;
+  void       *arg;
+} handler_t;
+
+static list_t handlers;
+static sigset_t sigmask;
+static int epfd = -1, sigfd = -1, stopfd = -1;
+static volatile bool running;
+static unsigned removed;   // Bumped when a handler is freed
+
+static handler_t *handler_find (int fd)
+{
+  list_t *cur;
+  handler_t *h;
+
+  ll_for_each (cur, &handlers) {
+    h = ll_entry (cur, handler_t, list);
+    if (h->fd == fd)
+      return h;
+  }
+  return NULL;
+}
+
+static int watch (int fd, void *ptr)
+{
+  struct epoll_event ev;
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = ptr;
+  return epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int evloop_events (int fd, bool in, bool out)
+{
+  struct epoll_event ev;
+  handler_t *h = handler_find (fd);
+
+  if (!h)
+    return -1;
+  ev.events = (in ? EPOLLIN : 0) | (out ? EPOLLOUT : 0);
+  ev.data.ptr = h;
+  return epoll_ctl (epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+int evloop_init (void)
+{
+  // Route shutdown signals to signalfd - inherited by all threads
+  sigemptyset (&sigmask);
+  sigaddset (&sigmask, SIGINT);
+  sigaddset (&sigmask, SIGTERM);
+  if (pthread_sigmask (SIG_BLOCK, &sigmask, NULL))
+    return -1;
+
+  LL_INIT (&handlers);
+  epfd = epoll_create1 (EPOLL_CLOEXEC);
+  sigfd = signalfd (-1, &sigmask, SFD_CLOEXEC);
+  stopfd = eventfd (0, EFD_CLOEXEC);
+  if ((epfd < 0) || (sigfd < 0) || (stopfd < 0))
+    return -1;
+
+  // Internal sources are tagged with their fd pointers
+  if (watch (sigfd, &sigfd) || watch (stopfd, &stopfd))
+    return -1;
+  return 0;
+}
+
+int evloop_add (int fd, evloop_cb_t cb, void *arg)
+{
+  handler_t *h;
+
+  h = (handler_t *)calloc (1, sizeof (handler_t));
+  if (!h)
+    return -1;
+  h->fd = fd;
+  h->cb = cb;
+  h->arg = arg;
+  if (watch (fd, h)) {
+    free (h);
+    return -1;
+  }
+  ll_add_tail (&handlers, &h->list);
+  return 0;
+}
+
+void evloop_del (int fd)
+{
+  handler_t *h = handler_find (fd);
+
+  if (!h)
+    return;
+  epoll_ctl (epfd, EPOLL_CTL_DEL, fd, NULL);
+  ll_rm (&handlers, &h->list);
+  removed++;
+  if (h->timer)
+    close (h->fd);
+  free (h);
+}
+
+int evloop_timer (uint32_t ms, bool periodic, evloop_cb_t cb, void *arg)
+{
+  int fd;
+  struct itimerspec ts = {};
+
+  fd = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  ts.it_value.tv_sec = ms / 1000;
+  ts.it_value.tv_nsec = (ms % 1000) * 1000000;
+  if (periodic)
+    ts.it_interval = ts.it_value;
+  if (timerfd_settime (fd, 0, &ts, NULL) || evloop_add (fd, cb, arg)) {
+    close (fd);
+    return -1;
+  }
+  handler_find (fd)->timer = true;
+  return fd;
+}
+
+void evloop_run (void)
+{
+  int i, n;
+  unsigned gen;
+  uint64_t val;
+  handler_t *h;
+  struct signalfd_siginfo si;
+  struct epoll_event ev[MAX_EVENTS];
+
+  running = true;
+  while (running) {
+
+    // Sleep until something happens
+    n = epoll_wait (epfd, ev, MAX_EVENTS, -1);
+    gen = removed;
+    for (i = 0; i < n; i++) {
+
+      // Shutdown signal - ^C or unit test completed
+      if (ev[i].data.ptr == &sigfd) {
+        if (read (sigfd, &si, sizeof (si)) == sizeof (si))
+          log (LOG_NORMAL, "Shutting down...");
+        running = false;
+
+        // Second ^C kills a stuck shutdown
+        pthread_sigmask (SIG_UNBLOCK, &sigmask, NULL);
+      }
+      // Stop request
+      else if (ev[i].data.ptr == &stopfd) {
+        if (read (stopfd, &val, sizeof (val)) < 0)
+          log (LOG_DEBUG, "evloop: stop read failed");
+        running = false;
+      }
+      // Registered handler
+      else {
+        h = (handler_t *)ev[i].data.ptr;
+        if (h->timer && (read (h->fd, &val, sizeof (val)) != sizeof (val)))
+          continue;
+        h->cb (h->fd, h->arg);
+
+        // Serve every ready fd so a busy one can't starve the rest
+        // Refetch events if handlers were removed
+        if (removed != gen)
+          break;
+      }
+    }
+  }
+}
+
+void evloop_stop (void)
+{
+  uint64_t val = 1;
+
+  if (write (stopfd, &val, sizeof (val)) != sizeof (val))
+    running = false;
+}
+
+void evloop_cleanup (void)
+{
+  list_t *cur, *n;
+  handler_t *h;
+
+  if (epfd < 0)
+    return;
+  ll_for_each_safe (cur, n, &handlers) {
+    h = ll_entry (cur, handler_t, list);
+    if (h->timer)
+      close (h->fd);
+    free (h);
+  }
+  LL_INIT (&handlers);
+  close (epfd);
+  close (sigfd);
+  close (stopfd);
+  epfd = sigfd = stopfd = -1;
+}
@@ -0,0 +1,41 @@
+/**
+ *  Main thread event loop. Blocks on signals, timers and registered file
+ *  descriptors instead of spinning. Host side services (servers, periodic
+ *  dumps, etc) register here and are called back from the main thread.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include <stdint.h>
+
+// Event callback - fd is ready or timer expired
+typedef void (*evloop_cb_t) (int fd, void *arg);
+
+// Setup loop - must be called before any threads are created so SIGINT and
+// SIGTERM stay blocked everywhere and are only delivered to the loop
+int evloop_init (void);
+
+// Watch fd for input - callbacks may add/remove handlers
+int evloop_add (int fd, evloop_cb_t cb, void *arg);
+void evloop_del (int fd);
+
+// Select events to watch on fd (default input only)
+int evloop_events (int fd, bool in, bool out);
+
+// Create timer firing after ms (every ms if periodic) - returns timer fd
+int evloop_timer (uint32_t ms, bool periodic, evloop_cb_t cb, void *arg);
+
+// Run until shutdown signal or evloop_stop
+void evloop_run (void);
+
+// Stop loop - safe from any thread
+void evloop_stop (void);
+
+// Release resources
+void evloop_cleanup (void);
+
+#endif /* EVLOOP_H */
@@ -7,29 +7,25 @@
  */
 
 #include "flexsoc_cm3.h"
+#include "crc.h"
 #include "err.h"
+#include "evloop.h"
+#include "gdbserver.h"
+#include "lzload.h"
+#include "mserver.h"
 #include "plugini.h"
+#include "profile.h"
+#include "scope.h"
 
 #include "Target.h"
 #include "flexsoc.h"
 #include "remote.h"
 #include "log.h"
 
-#include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <endian.h>
 
-static int shutdown_flag = 0;
-
-// Handle shutdown - this could be caught from ^C or a system unit test completed
-static void shutdown (int sig)
-{
-  signal (SIGINT, SIG_DFL);
-  log (LOG_NORMAL, "Shutting down...");
-  shutdown_flag = 1;  
-}
-
 static uint32_t *read_bin (const char *filename, long *size)
 {
   FILE *fp;
@@ -73,13 +69,77 @@ static uint32_t *read_bin (const char *filename, long *size)
   return buf;
 }
 
+// Delta load granularity
+#define DELTA_BLK  1024
+
+// Write only blocks whose target CRC differs, then verify with one CRC
+// Returns -1 if the helper can't cover the image
+static int load_delta (Target *target, uint32_t addr, const uint8_t *data, uint32_t size, bool compress)
+{
+  uint32_t *crc, full = size / DELTA_BLK, cnt = (size + DELTA_BLK - 1) / DELTA_BLK;
+  uint32_t i, j, off, len, dirty = 0;
+  int rv = -1;
+
+  crc = (uint32_t *)malloc (cnt * sizeof (uint32_t));
+  if (!crc || crc_open ()) {
+    free (crc);
+    return -1;
+  }
+
+  // Checksum what is there
+  if (crc_blocks (addr, DELTA_BLK, full, crc) ||
+      ((full < cnt) && crc_blocks (addr + full * DELTA_BLK, size - full * DELTA_BLK, 1, &crc[full])))
+    goto cleanup;
+
+  // Mark changed blocks
+  for (i = 0; i < cnt; i++) {
+    off = i * DELTA_BLK;
+    len = (off + DELTA_BLK > size) ? size - off : DELTA_BLK;
+    crc[i] = (crc[i] != crc32 (0, data + off, len));
+    dirty += crc[i];
+  }
+
+  // Decompressor needs the CPU
+  if (dirty && compress)
+    crc_close ();
+
+  // Write runs of changed blocks
+  for (i = 0; i < cnt; i = j) {
+    for (j = i + 1; (j < cnt) && (crc[j] == crc[i]); j++)
+      ;
+    if (!crc[i])
+      continue;
+    off = i * DELTA_BLK;
+    len = ((j * DELTA_BLK > size) ? size : j * DELTA_BLK) - off;
+    if (!compress || lzload (addr + off, data + off, len))
+      target->MemcpyTo (addr + off, data + off, len);
+  }
+  if (dirty && compress && crc_open ())
+    goto cleanup;
+
+  // Verify is one checksum of the whole image
+  if (crc_blocks (addr, size, 1, &len))
+    goto cleanup;
+  log (LOG_NORMAL, "%s (%u/%u blocks written)", (len == crc32 (0, data, size)) ? "OK" : "FAIL", dirty, cnt);
+  rv = 0;
+
+ cleanup:
+  crc_close ();
+  free (crc);
+  return rv;
+}
+
 int flexsoc_cm3 (args_t *args)
 {
   Target *target;
   alias_t alias;
   uint32_t devid, memid, remote_base = 0;
   char *device;
-  int i;
+  int i, rv;
+
+  // Shutdown signals must be blocked before link threads start
+  if (evloop_init ())
+    err ("Failed to init event loop");
 
   // Copy device as it's modified inplace if simulator
   device = (char *)malloc (strlen (args->device + 1));
@@ -88,6 +148,10 @@ int flexsoc_cm3 (args_t *args)
   // Find hardware
   target = Target::Ptr (device);
 
+  // Override device FIFO depth
+  if (args->fifo)
+    target->LinkFifoDepth (args->fifo);
+
   // Read device_id
   devid = target->FlexsocID ();
   if ((devid >> 4) == 0xF1ec50c)
@@ -101,11 +165,18 @@ int flexsoc_cm3 (args_t *args)
   free (device);
 
   // Setup remote if enabled
-  if (args->remote)
+  if (args->remote) {
     if (remote_open (args->remote_div, args->remote_halt))
       goto cleanup;
+
+    // Remote bridge defaults to low speed profile - sysmap may override
+    remote_base = target->RemoteBase ();
+    target->LinkRegion (remote_base, 0x20000000, flexsoc_profile_builtin (false));
+  }
   
   // Setup plugins
+  if (args->record)
+    plugin_record (args->record);
   if (args->map)
     plugin_init (target, args->map, args->path, args->path_cnt);
 
@@ -127,9 +198,6 @@ int flexsoc_cm3 (args_t *args)
   // Print out remote mapping
   if (args->remote) {
 
-    // Get remote base
-    remote_base = target->RemoteBase ();
-    
     // Print out bridge info
     log (LOG_NORMAL, "Enabling remote AHB3 bridge: 0x%08X-0x%08X",
          remote_base, remote_base + 0x20000000 - 1);
@@ -146,7 +214,13 @@ int flexsoc_cm3 (args_t *args)
 
     // Enable bridge
     target->RemoteAHBEn (true);
+
+    // Serve remote CPU to debugger
+    if (args->gdb_port && gdb_open (args->gdb_port))
+      err ("Failed to open GDB server on port %d", args->gdb_port);
   }
+  else if (args->gdb_port)
+    log (LOG_ERR, "GDB server requires --remote");
   
   // Load binaries into memory
   for (i = 0; i < args->load_cnt; i++) {
@@ -157,22 +231,23 @@ int flexsoc_cm3 (args_t *args)
     log_nonl (LOG_NORMAL, "Loading %s @ 0x%08X... ", args->load[i].name, args->load[i].addr);
     data = read_bin (args->load[i].name, &size);
 
-    // If target within remote address space set low speed
-    if (target->RemoteEn () &&
-        (args->load[i].addr >= remote_base) &&
-        (args->load[i].addr < remote_base + 0x20000000))
-      flexsoc_hispeed (false);
-    else
-      flexsoc_hispeed (true);
-        
-    // Write to target
-    target->WriteW (args->load[i].addr, data, size/4);
+    // Only write what changed, verify on target
+    if (args->delta && !load_delta (target, args->load[i].addr, (uint8_t *)data, size, args->compress)) {
+      free (data);
+      continue;
+    }
+
+    // Write to target - link profile follows address
+    // Compressible images are expanded on target, anything else is sent raw
+    if (!args->compress || lzload (args->load[i].addr, data, size))
+      target->MemcpyTo (args->load[i].addr, data, size);
 
     // Malloc buffer to verify
     verify = (uint32_t *)malloc (size);
 
-    // Readback and compare
-    target->ReadW (args->load[i].addr, verify, size/4);
+    // Readback and compare - from the device, not cached writes
+    target->CacheInvalidate (args->load[i].addr, size);
+    target->MemcpyFrom (verify, args->load[i].addr, size);
     if (memcmp (data, verify, size))
       log (LOG_NORMAL, "FAIL");
     log (LOG_NORMAL, "OK");
@@ -180,14 +255,8 @@ int flexsoc_cm3 (args_t *args)
     // Free buffers
     free (verify);
     free (data);
-
-    // Change back to high speed
-    flexsoc_hispeed (true);
   }
 
-  // Register handler for shutdown
-  signal (SIGINT, &shutdown);
-  
   // Release processor from reset
   if (!args->gdb) {
     log (LOG_NORMAL, "Deasserting CPURESETn...");
@@ -196,11 +265,33 @@ int flexsoc_cm3 (args_t *args)
   else
     log (LOG_NORMAL, "Waiting for debugger...");
 
-  // Launch TCP server for master access
-  while (!shutdown_flag)
-    ;
+  // Launch server for master access
+  if (args->server && mserver_open (args->server))
+    err ("Failed to open master access server: %s", args->server);
+
+  // Sample running CPU
+  if (args->profile) {
+    if (!args->pcsr && !args->remote)
+      log (LOG_ERR, "Profiling local CPU requires --pcsr");
+    else if (profile_open (args->profile, args->profile_out, args->profile_rate, args->pcsr))
+      err ("Failed to start profiler");
+  }
+
+  // Capture variables
+  if (args->scope &&
+      scope_open (target->Ctx (), args->scope, args->scope_var, args->scope_cnt, args->scope_rate))
+    err ("Failed to start scope");
+
+  // Service events until ^C or a system unit test completes
+  evloop_run ();
 
  cleanup:
+  // Drop debugger and clients, write out profile and capture
+  gdb_close ();
+  mserver_close ();
+  profile_close ();
+  scope_close ();
+
   // Put the CPU back into reset
   target->CPUReset (true);
 
@@ -210,9 +301,13 @@ int flexsoc_cm3 (args_t *args)
   // Clean up plugins
   plugin_cleanup ();
   
+  // Save return code before link is closed
+  rv = flexsoc_ctx_read_returnval (target->Ctx ());
+
   // Close device
   delete target;
+  evloop_cleanup ();
 
   // Success
-  return flexsoc_read_returnval();
+  return rv;
 }
@@ -10,6 +10,8 @@
 
 #include <stdint.h>
 
+#include "scope_file.h"
+
 typedef struct {
   char    *name;
   uint32_t addr;
@@ -19,6 +21,8 @@ typedef struct {
   char    *device;     // Device to connect to
   load_t  *load;       // List of files to load
   int     load_cnt;    // Number of files to load
+  bool    compress;    // Load through on-target decompressor
+  bool    delta;       // Write changed blocks only, verify by target CRC
   char    **path;      // Plugin path dirs
   int     path_cnt;    // Number of plugin path
   char    *map;        // System map file
@@ -27,6 +31,18 @@ typedef struct {
   bool    remote;      // Enable remote interface
   uint8_t remote_div;  // Clock div for remote
   bool    remote_halt; // Halt remote processor
+  int     fifo;        // Device FIFO depth override (0=auto)
+  char    *record;     // Slave packet recording
+  int     gdb_port;    // GDB server port for remote CPU (0=off)
+  char    *server;     // Master access server socket path
+  char    *profile;    // ELF to symbolize PC samples against
+  char    *profile_out; // Profile report prefix
+  uint32_t profile_rate; // Samples/sec (0=max)
+  uint32_t pcsr;       // Local core DWT_PCSR on master bus (0=remote core)
+  char    *scope;      // Scope capture file
+  scope_var_t *scope_var; // Variables to capture
+  int     scope_cnt;   // Number of variables
+  uint32_t scope_rate; // Samples/sec (0=max)
 } args_t;
 
 int flexsoc_cm3 (args_t *args);
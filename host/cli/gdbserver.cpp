@@ -0,0 +1,863 @@
+/**
+ *  GDB remote serial protocol server for the remote target.
+ *
+ *  Every access crosses a slow host link and SWD, so packets are mapped
+ *  onto batched bridge transfers:
+ *    - g/p come from one core register snapshot taken at each stop
+ *    - m/M/X use block remote accesses through a line cache
+ *    - stack lines at SP are prefetched with the snapshot
+ *    - step is a single transfer (clear DFSR, step, wait for halt)
+ *  The cache and snapshot are only valid while halted and are dropped on
+ *  every resume. Only normal memory regions are cached.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "gdbserver.h"
+#include "evloop.h"
+#include "Target.h"
+#include "log.h"
+
+// Packet buffer size (advertised as PacketSize)
+#define PKT_SZ        0x4000
+
+// Memory cache
+#define LINE_SZ       64
+#define CACHE_LINES   256
+
+// Stack prefetched at each stop
+#define STACK_PREFETCH 256
+
+// Poll interval while running
+#define POLL_MS       50
+
+// AP registers
+#define AP_CSW        0x0
+#define AP_TAR        0x4
+#define AP_DRW        0xc
+#define CSW_WORD      0xA2000002
+
+// Debug registers
+#define SCB_DFSR      0xE000ED30
+#define SCB_DHCSR     0xE000EDF0
+#define DBGKEY        0xA05F0000
+#define C_DEBUGEN     (1 << 0)
+#define C_HALT        (1 << 1)
+#define C_STEP        (1 << 2)
+#define C_MASKINTS    (1 << 3)
+#define S_HALT        (1 << 17)
+#define DFSR_ALL      0x1f
+
+// Flash patch breakpoint unit (v1 - code region only)
+#define FP_CTRL       0xE0002000
+#define FP_COMP(n)    (0xE0002008 + ((n) * 4))
+#define FP_KEY_EN     3
+#define FP_MAX        16
+#define FP_REGION     0x20000000
+
+// Registers in g packet - see target.xml
+#define GDB_REG_CNT   23
+#define GDB_SPECIAL   19
+
+// Signals in stop replies
+#define GDB_SIGINT    2
+#define GDB_SIGTRAP   5
+
+typedef struct {
+  bool     valid;
+  uint32_t addr;
+  uint8_t  data[LINE_SZ];
+} line_t;
+
+static struct {
+  Target  *targ;
+  int      lfd, cfd;
+  int      timer;         // Run poll timer (-1 = halted)
+  bool     noack;
+  char     in[PKT_SZ * 2];
+  int      in_len;
+  char     out[PKT_SZ * 2 + 8];
+
+  // State at current stop
+  core_regs_t regs;
+  bool     regs_valid;
+  line_t   cache[CACHE_LINES];
+
+  // Breakpoints
+  int      fp_cnt;
+  uint32_t fp_addr[FP_MAX];
+  bool     fp_used[FP_MAX];
+} gdb = {NULL, -1, -1, -1};
+
+static const char target_xml[] =
+  "<?xml version=\"1.0\"?>"
+  "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+  "<target>"
+  "<architecture>arm</architecture>"
+  "<feature name=\"org.gnu.gdb.arm.m-profile\">"
+  "<reg name=\"r0\" bitsize=\"32\"/>"
+  "<reg name=\"r1\" bitsize=\"32\"/>"
+  "<reg name=\"r2\" bitsize=\"32\"/>"
+  "<reg name=\"r3\" bitsize=\"32\"/>"
+  "<reg name=\"r4\" bitsize=\"32\"/>"
+  "<reg name=\"r5\" bitsize=\"32\"/>"
+  "<reg name=\"r6\" bitsize=\"32\"/>"
+  "<reg name=\"r7\" bitsize=\"32\"/>"
+  "<reg name=\"r8\" bitsize=\"32\"/>"
+  "<reg name=\"r9\" bitsize=\"32\"/>"
+  "<reg name=\"r10\" bitsize=\"32\"/>"
+  "<reg name=\"r11\" bitsize=\"32\"/>"
+  "<reg name=\"r12\" bitsize=\"32\"/>"
+  "<reg name=\"sp\" bitsize=\"32\" type=\"data_ptr\"/>"
+  "<reg name=\"lr\" bitsize=\"32\"/>"
+  "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>"
+  "<reg name=\"xpsr\" bitsize=\"32\"/>"
+  "</feature>"
+  "<feature name=\"org.gnu.gdb.arm.m-system\">"
+  "<reg name=\"msp\" bitsize=\"32\" type=\"data_ptr\"/>"
+  "<reg name=\"psp\" bitsize=\"32\" type=\"data_ptr\"/>"
+  "</feature>"
+  "<feature name=\"org.flexsoc.cm3.special\">"
+  "<reg name=\"primask\" bitsize=\"32\"/>"
+  "<reg name=\"basepri\" bitsize=\"32\"/>"
+  "<reg name=\"faultmask\" bitsize=\"32\"/>"
+  "<reg name=\"control\" bitsize=\"32\"/>"
+  "</feature>"
+  "</target>";
+
+static const char hexchars[] = "0123456789abcdef";
+
+static int hex (char c)
+{
+  if ((c >= '0') && (c <= '9'))
+    return c - '0';
+  if ((c >= 'a') && (c <= 'f'))
+    return c - 'a' + 10;
+  if ((c >= 'A') && (c <= 'F'))
+    return c - 'A' + 10;
+  return -1;
+}
+
+static char *bin2hex (char *dst, const uint8_t *src, int len)
+{
+  int i;
+
+  for (i = 0; i < len; i++) {
+    *dst++ = hexchars[src[i] >> 4];
+    *dst++ = hexchars[src[i] & 0xf];
+  }
+  *dst = '\0';
+  return dst;
+}
+
+static int hex2bin (uint8_t *dst, const char *src, int len)
+{
+  int i, hi, lo;
+
+  for (i = 0; i < len; i++) {
+    hi = hex (src[i * 2]);
+    lo = hex (src[i * 2 + 1]);
+    if ((hi < 0) || (lo < 0))
+      return -1;
+    dst[i] = (hi << 4) | lo;
+  }
+  return 0;
+}
+
+// Register values are target (little) endian
+static char *reg2hex (char *dst, uint32_t val)
+{
+  uint8_t b[4] = {(uint8_t)val, (uint8_t)(val >> 8),
+                  (uint8_t)(val >> 16), (uint8_t)(val >> 24)};
+  return bin2hex (dst, b, 4);
+}
+
+static int hex2reg (const char *src, uint32_t *val)
+{
+  uint8_t b[4];
+
+  if (hex2bin (b, src, 4))
+    return -1;
+  *val = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+  return 0;
+}
+
+static void send_raw (const char *buf, int len)
+{
+  int rv;
+
+  while (len > 0) {
+    rv = write (gdb.cfd, buf, len);
+    if (rv <= 0)
+      return;
+    buf += rv;
+    len -= rv;
+  }
+}
+
+static void send_pkt (const char *data)
+{
+  int i, len = strlen (data);
+  uint8_t sum = 0;
+  char tail[4];
+
+  for (i = 0; i < len; i++)
+    sum += data[i];
+  send_raw ("$", 1);
+  send_raw (data, len);
+  snprintf (tail, sizeof (tail), "#%02x", sum);
+  send_raw (tail, 3);
+  log (LOG_DEBUG, "gdb <= %.*s", len > 64 ? 64 : len, data);
+}
+
+//
+// Memory access with per-stop cache
+//
+
+// Normal memory only - code, SRAM and external RAM
+static bool cacheable (uint32_t addr)
+{
+  return (addr < 0x40000000) || ((addr >= 0x60000000) && (addr < 0xA0000000));
+}
+
+static line_t *line_get (uint32_t addr)
+{
+  return &gdb.cache[(addr / LINE_SZ) % CACHE_LINES];
+}
+
+static void cache_invalidate (void)
+{
+  int i;
+
+  for (i = 0; i < CACHE_LINES; i++)
+    gdb.cache[i].valid = false;
+  gdb.regs_valid = false;
+}
+
+// Read aligned words straight from target
+static int mem_fetch (uint32_t addr, uint8_t *buf, uint32_t words)
+{
+  return gdb.targ->RemoteReadW (addr, (uint32_t *)buf, words);
+}
+
+// Fetch a run of missing lines in one block
+static int cache_fetch (uint32_t addr, int lines)
+{
+  int i;
+  uint8_t *buf;
+
+  buf = (uint8_t *)malloc (lines * LINE_SZ);
+  if (!buf)
+    return -1;
+  if (mem_fetch (addr, buf, lines * LINE_SZ / 4)) {
+    free (buf);
+    return -1;
+  }
+  for (i = 0; i < lines; i++) {
+    line_t *l = line_get (addr + i * LINE_SZ);
+    l->valid = true;
+    l->addr = addr + i * LINE_SZ;
+    memcpy (l->data, &buf[i * LINE_SZ], LINE_SZ);
+  }
+  free (buf);
+  return 0;
+}
+
+// Make lines covering range valid
+static int cache_fill (uint32_t addr, uint32_t len)
+{
+  uint64_t a, end = (uint64_t)addr + len;
+  uint32_t start = 0;
+  int run = 0;
+  line_t *l;
+
+  for (a = addr & ~(LINE_SZ - 1); a < end; a += LINE_SZ) {
+    l = line_get (a);
+    if (l->valid && (l->addr == a)) {
+      if (run && cache_fetch (start, run))
+        return -1;
+      run = 0;
+      continue;
+    }
+    if (!run)
+      start = a;
+    run++;
+  }
+  return run ? cache_fetch (start, run) : 0;
+}
+
+static int mem_read (uint32_t addr, uint8_t *buf, uint32_t len)
+{
+  uint32_t n, off, start, words;
+  uint8_t *tmp;
+
+  // Uncached - read covering words every time
+  if (!cacheable (addr) || !cacheable (addr + len - 1)) {
+    start = addr & ~3;
+    words = ((uint64_t)addr + len - start + 3) / 4;
+    tmp = (uint8_t *)malloc (words * 4);
+    if (!tmp)
+      return -1;
+    if (mem_fetch (start, tmp, words)) {
+      free (tmp);
+      return -1;
+    }
+    memcpy (buf, &tmp[addr - start], len);
+    free (tmp);
+    return 0;
+  }
+
+  // Cached - fill then copy out
+  if (cache_fill (addr, len))
+    return -1;
+  while (len) {
+    off = addr & (LINE_SZ - 1);
+    n = (LINE_SZ - off < len) ? LINE_SZ - off : len;
+    memcpy (buf, &line_get (addr)->data[off], n);
+    addr += n;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+// Partial words are merged with current contents - SWD access is word wide
+static int mem_write (uint32_t addr, const uint8_t *buf, uint32_t len)
+{
+  uint32_t start = addr & ~3, a, n, off, words;
+  uint8_t *tmp;
+  line_t *l;
+  int rv;
+
+  words = ((uint64_t)addr + len - start + 3) / 4;
+  tmp = (uint8_t *)malloc (words * 4);
+  if (!tmp)
+    return -1;
+
+  // Head and tail words
+  if (((addr & 3) || (len & 3)) &&
+      (mem_read (start, tmp, 4) ||
+       mem_read (start + (words - 1) * 4, &tmp[(words - 1) * 4], 4))) {
+    free (tmp);
+    return -1;
+  }
+  memcpy (&tmp[addr - start], buf, len);
+  rv = gdb.targ->RemoteWriteW (start, (uint32_t *)tmp, words);
+  free (tmp);
+  if (rv)
+    return -1;
+
+  // Write through to cached lines
+  for (a = addr; a < addr + len; a += n) {
+    off = a & (LINE_SZ - 1);
+    n = (LINE_SZ - off < addr + len - a) ? LINE_SZ - off : addr + len - a;
+    l = line_get (a);
+    if (l->valid && (l->addr == a - off))
+      memcpy (&l->data[off], &buf[a - addr], n);
+  }
+  return 0;
+}
+
+//
+// Run control
+//
+
+// Snapshot registers and stack at stop
+static int stop_snapshot (void)
+{
+  uint32_t sp;
+
+  if (gdb.regs_valid)
+    return 0;
+  if (gdb.targ->RemoteCoreRegs (&gdb.regs))
+    return -1;
+  gdb.regs_valid = true;
+
+  // Backtraces start at SP
+  sp = gdb.regs.r[13] & ~3;
+  if (cacheable (sp) && cacheable (sp + STACK_PREFETCH - 1))
+    cache_fill (sp, STACK_PREFETCH);
+  return 0;
+}
+
+static bool halted (void)
+{
+  return (gdb.targ->RemoteReadW (SCB_DHCSR) & S_HALT) != 0;
+}
+
+static void halt (void)
+{
+  gdb.targ->RemoteWriteW (SCB_DHCSR, DBGKEY | C_HALT | C_DEBUGEN);
+}
+
+static void poll_stop (void)
+{
+  if (gdb.timer >= 0) {
+    evloop_del (gdb.timer);
+    gdb.timer = -1;
+  }
+}
+
+static void stopped (int sig)
+{
+  char reply[4];
+
+  poll_stop ();
+  stop_snapshot ();
+  snprintf (reply, sizeof (reply), "S%02x", sig);
+  send_pkt (reply);
+}
+
+static void poll_cb (int fd, void *arg)
+{
+  if (halted ())
+    stopped (GDB_SIGTRAP);
+}
+
+static void resume (bool step)
+{
+  int n = 0;
+  remote_xfer_t xfer[7];
+
+  cache_invalidate ();
+
+  // Clear stop reasons, then run with interrupts unmasked or step with them
+  // masked. C_MASKINTS may only change while halted.
+  xfer[n++] = {REMOTE_AP | REMOTE_WR | AP_CSW, CSW_WORD};
+  xfer[n++] = {REMOTE_AP | REMOTE_WR | AP_TAR, SCB_DFSR};
+  xfer[n++] = {REMOTE_AP | REMOTE_WR | AP_DRW, DFSR_ALL};
+  xfer[n++] = {REMOTE_AP | REMOTE_WR | AP_TAR, SCB_DHCSR};
+  if (step) {
+    xfer[n++] = {REMOTE_AP | REMOTE_WR | AP_DRW, DBGKEY | C_MASKINTS | C_HALT | C_DEBUGEN};
+    xfer[n++] = {REMOTE_AP | REMOTE_WR | AP_DRW, DBGKEY | C_MASKINTS | C_STEP | C_DEBUGEN};
+    xfer[n++] = {REMOTE_AP | REMOTE_RD | REMOTE_MATCH | AP_DRW, S_HALT, S_HALT};
+  }
+  else {
+    xfer[n++] = {REMOTE_AP | REMOTE_WR | AP_DRW, DBGKEY | C_HALT | C_DEBUGEN};
+    xfer[n++] = {REMOTE_AP | REMOTE_WR | AP_DRW, DBGKEY | C_DEBUGEN};
+  }
+
+  // Step completes within the transfer
+  if (gdb.targ->RemoteTransfer (xfer, n) == n) {
+    if (step)
+      stopped (GDB_SIGTRAP);
+    else
+      gdb.timer = evloop_timer (POLL_MS, true, poll_cb, NULL);
+    return;
+  }
+  send_pkt ("E01");
+}
+
+//
+// Breakpoints
+//
+static void fp_init (void)
+{
+  uint32_t ctrl = gdb.targ->RemoteReadW (FP_CTRL);
+
+  gdb.fp_cnt = ((ctrl >> 4) & 0xf) | ((ctrl >> 8) & 0x70);
+  if (gdb.fp_cnt > FP_MAX)
+    gdb.fp_cnt = FP_MAX;
+  memset (gdb.fp_used, 0, sizeof (gdb.fp_used));
+  gdb.targ->RemoteWriteW (FP_CTRL, FP_KEY_EN);
+}
+
+static int fp_set (uint32_t addr, bool set)
+{
+  int i;
+
+  for (i = 0; i < gdb.fp_cnt; i++) {
+    if (set ? !gdb.fp_used[i] : (gdb.fp_used[i] && (gdb.fp_addr[i] == addr))) {
+      gdb.targ->RemoteWriteW (FP_COMP (i), !set ? 0 :
+                              (addr & 0x1ffffffc) | ((addr & 2) ? (2u << 30) : (1u << 30)) | 1);
+      gdb.fp_used[i] = set;
+      gdb.fp_addr[i] = addr;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static void fp_clear (void)
+{
+  int i;
+
+  for (i = 0; i < gdb.fp_cnt; i++)
+    if (gdb.fp_used[i])
+      fp_set (gdb.fp_addr[i], false);
+}
+
+//
+// Packet handlers
+//
+static void handle_query (char *pkt)
+{
+  uint32_t off, len, size = sizeof (target_xml) - 1;
+
+  if (!strncmp (pkt, "qSupported", 10)) {
+    snprintf (gdb.out, sizeof (gdb.out),
+              "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+", PKT_SZ);
+    send_pkt (gdb.out);
+  }
+  else if (sscanf (pkt, "qXfer:features:read:target.xml:%x,%x", &off, &len) == 2) {
+    if (off >= size)
+      send_pkt ("l");
+    else {
+      if (len > size - off)
+        len = size - off;
+      if (len > PKT_SZ - 16)
+        len = PKT_SZ - 16;
+      gdb.out[0] = (off + len == size) ? 'l' : 'm';
+      memcpy (&gdb.out[1], &target_xml[off], len);
+      gdb.out[len + 1] = '\0';
+      send_pkt (gdb.out);
+    }
+  }
+  else if (!strcmp (pkt, "QStartNoAckMode")) {
+    send_pkt ("OK");
+    gdb.noack = true;
+  }
+  else if (!strcmp (pkt, "qAttached"))
+    send_pkt ("1");
+  else
+    send_pkt ("");
+}
+
+static void handle_regs (char *pkt)
+{
+  int i, n;
+  uint32_t val, *reg = (uint32_t *)&gdb.regs;
+  char *p = gdb.out;
+
+  if (stop_snapshot ()) {
+    send_pkt ("E01");
+    return;
+  }
+
+  // All registers
+  if (pkt[0] == 'g') {
+    for (i = 0; i < GDB_REG_CNT; i++)
+      p = reg2hex (p, (i < GDB_SPECIAL) ? reg[i] :
+                   (gdb.regs.special >> ((i - GDB_SPECIAL) * 8)) & 0xff);
+    send_pkt (gdb.out);
+    return;
+  }
+  if (pkt[0] == 'p') {
+    n = strtoul (&pkt[1], NULL, 16);
+    if (n >= GDB_REG_CNT)
+      send_pkt ("E01");
+    else {
+      reg2hex (p, (n < GDB_SPECIAL) ? reg[n] :
+               (gdb.regs.special >> ((n - GDB_SPECIAL) * 8)) & 0xff);
+      send_pkt (gdb.out);
+    }
+    return;
+  }
+
+  // Single register write - special registers share one selector
+  n = strtoul (&pkt[1], &p, 16);
+  if ((n >= GDB_REG_CNT) || (*p != '=') || hex2reg (p + 1, &val)) {
+    send_pkt ("E01");
+    return;
+  }
+  if (n >= GDB_SPECIAL) {
+    i = (n - GDB_SPECIAL) * 8;
+    val = (gdb.regs.special & ~(0xff << i)) | ((val & 0xff) << i);
+    n = GDB_SPECIAL;
+  }
+  if (gdb.targ->RemoteCoreRegWrite (n, val)) {
+    send_pkt ("E01");
+    return;
+  }
+  reg[n] = val;
+  send_pkt ("OK");
+}
+
+static void handle_regs_write (char *pkt)
+{
+  int i;
+  uint32_t val, *reg = (uint32_t *)&gdb.regs;
+
+  if (stop_snapshot ()) {
+    send_pkt ("E01");
+    return;
+  }
+
+  // Only write registers that changed
+  for (i = 0; (i < GDB_SPECIAL) && (strlen (&pkt[1 + i * 8]) >= 8); i++) {
+    if (hex2reg (&pkt[1 + i * 8], &val)) {
+      send_pkt ("E01");
+      return;
+    }
+    if ((val != reg[i]) && gdb.targ->RemoteCoreRegWrite (i, val)) {
+      send_pkt ("E01");
+      return;
+    }
+    reg[i] = val;
+  }
+  send_pkt ("OK");
+}
+
+static void handle_mem (char *pkt, int len)
+{
+  uint32_t addr, size, i, j;
+  uint8_t *buf;
+  char *p;
+
+  addr = strtoul (&pkt[1], &p, 16);
+  if (*p++ != ',') {
+    send_pkt ("E01");
+    return;
+  }
+  size = strtoul (p, &p, 16);
+
+  // Hex data takes two chars per byte, binary X data one
+  if (size > ((pkt[0] == 'X') ? PKT_SZ : PKT_SZ / 2)) {
+    send_pkt ("E01");
+    return;
+  }
+  buf = (uint8_t *)malloc (size + 1);
+  if (!buf) {
+    send_pkt ("E01");
+    return;
+  }
+
+  // Read
+  if (pkt[0] == 'm') {
+    if (!size || mem_read (addr, buf, size))
+      send_pkt (size ? "E01" : "");
+    else {
+      bin2hex (gdb.out, buf, size);
+      send_pkt (gdb.out);
+    }
+  }
+  // Hex write
+  else if (pkt[0] == 'M') {
+    if ((*p != ':') || hex2bin (buf, p + 1, size) ||
+        (size && mem_write (addr, buf, size)))
+      send_pkt ("E01");
+    else
+      send_pkt ("OK");
+  }
+  // Binary write - 0x7d escapes next byte
+  else {
+    for (i = 0, j = p + 1 - pkt; (i < size) && ((int)j < len); i++, j++) {
+      if (pkt[j] == 0x7d)
+        buf[i] = pkt[++j] ^ 0x20;
+      else
+        buf[i] = pkt[j];
+    }
+    if ((*p != ':') || (i != size) || (size && mem_write (addr, buf, size)))
+      send_pkt ("E01");
+    else
+      send_pkt ("OK");
+  }
+  free (buf);
+}
+
+static void handle_bkpt (char *pkt)
+{
+  int type;
+  uint32_t addr;
+
+  if (sscanf (pkt, "%*c%d,%x", &type, &addr) != 2) {
+    send_pkt ("E01");
+    return;
+  }
+
+  // FPB only patches code region - GDB falls back to memory breakpoints
+  if ((type > 1) || ((type == 0) && (addr >= FP_REGION)))
+    send_pkt ("");
+  else if ((addr >= FP_REGION) || fp_set (addr, pkt[0] == 'Z'))
+    send_pkt ("E01");
+  else
+    send_pkt ("OK");
+}
+
+static void client_close (void)
+{
+  poll_stop ();
+  if (gdb.cfd < 0)
+    return;
+  evloop_del (gdb.cfd);
+  close (gdb.cfd);
+  gdb.cfd = -1;
+  log (LOG_NORMAL, "GDB disconnected");
+}
+
+static void handle_pkt (char *pkt, int len)
+{
+  log (LOG_DEBUG, "gdb => %.*s", len > 64 ? 64 : len, pkt);
+
+  // Only interrupt is accepted while running
+  if (gdb.timer >= 0)
+    return;
+
+  switch (pkt[0]) {
+    case '?': send_pkt ("S05"); break;
+    case 'q': case 'Q': handle_query (pkt); break;
+    case 'g': case 'p': case 'P': handle_regs (pkt); break;
+    case 'G': handle_regs_write (pkt); break;
+    case 'm': case 'M': case 'X': handle_mem (pkt, len); break;
+    case 'Z': case 'z': handle_bkpt (pkt); break;
+    case 'c': resume (false); break;
+    case 's': resume (true); break;
+    case 'H': case 'T': send_pkt ("OK"); break;
+
+    // Detach - remove breakpoints and let it run
+    case 'D':
+      fp_clear ();
+      resume (false);
+      poll_stop ();
+      send_pkt ("OK");
+      client_close ();
+      break;
+    case 'k':
+      client_close ();
+      break;
+    default:
+      send_pkt ("");
+      break;
+  }
+}
+
+static void client_cb (int fd, void *arg)
+{
+  int i, rv, start, end;
+  uint8_t sum;
+
+  rv = read (fd, &gdb.in[gdb.in_len], sizeof (gdb.in) - gdb.in_len - 1);
+  if (rv <= 0) {
+    client_close ();
+    return;
+  }
+  gdb.in_len += rv;
+
+  // Process complete packets
+  for (start = 0; start < gdb.in_len; ) {
+
+    // Interrupt
+    if (gdb.in[start] == 0x03) {
+      start++;
+      if (gdb.timer >= 0) {
+        halt ();
+        stopped (GDB_SIGINT);
+      }
+      continue;
+    }
+    if (gdb.in[start] != '$') {
+      start++;
+      continue;
+    }
+
+    // Wait for checksum
+    for (end = start + 1; (end < gdb.in_len) && (gdb.in[end] != '#'); end++)
+      ;
+    if (end + 2 >= gdb.in_len)
+      break;
+    for (i = start + 1, sum = 0; i < end; i++)
+      sum += gdb.in[i];
+    if (((hex (gdb.in[end + 1]) << 4) | hex (gdb.in[end + 2])) != sum) {
+      if (!gdb.noack)
+        send_raw ("-", 1);
+      start = end + 3;
+      continue;
+    }
+    if (!gdb.noack)
+      send_raw ("+", 1);
+    gdb.in[end] = '\0';
+    handle_pkt (&gdb.in[start + 1], end - start - 1);
+    start = end + 3;
+
+    // Client dropped in handler
+    if (gdb.cfd < 0) {
+      gdb.in_len = 0;
+      return;
+    }
+  }
+
+  // Keep partial packet
+  if (start >= gdb.in_len)
+    gdb.in_len = 0;
+  else if ((start == 0) && (gdb.in_len >= (int)sizeof (gdb.in) - 1))
+    gdb.in_len = 0;
+  else {
+    memmove (gdb.in, &gdb.in[start], gdb.in_len - start);
+    gdb.in_len -= start;
+  }
+}
+
+static void accept_cb (int fd, void *arg)
+{
+  int cfd, one = 1;
+
+  cfd = accept (fd, NULL, NULL);
+  if (cfd < 0)
+    return;
+
+  // One debugger at a time
+  if (gdb.cfd >= 0) {
+    close (cfd);
+    return;
+  }
+  setsockopt (cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+  if (evloop_add (cfd, client_cb, NULL)) {
+    close (cfd);
+    return;
+  }
+  gdb.cfd = cfd;
+  gdb.noack = false;
+  gdb.in_len = 0;
+  log (LOG_NORMAL, "GDB connected");
+
+  // Debugger expects a halted target
+  if (!halted ())
+    halt ();
+  cache_invalidate ();
+  fp_init ();
+}
+
+int gdb_open (int port)
+{
+  int one = 1;
+  struct sockaddr_in addr = {};
+
+  gdb.targ = Target::Ptr ();
+  gdb.lfd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (gdb.lfd < 0)
+    return -1;
+  setsockopt (gdb.lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+
+  // Loopback only - protocol has no authentication
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons (port);
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (bind (gdb.lfd, (struct sockaddr *)&addr, sizeof (addr)) ||
+      listen (gdb.lfd, 1) ||
+      evloop_add (gdb.lfd, accept_cb, NULL)) {
+    close (gdb.lfd);
+    gdb.lfd = -1;
+    return -1;
+  }
+  log (LOG_NORMAL, "GDB server listening on port %d", port);
+  return 0;
+}
+
+void gdb_close (void)
+{
+  client_close ();
+  if (gdb.lfd < 0)
+    return;
+  evloop_del (gdb.lfd);
+  close (gdb.lfd);
+  gdb.lfd = -1;
+}
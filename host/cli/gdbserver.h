@@ -0,0 +1,18 @@
+/**
+ *  GDB remote serial protocol server for the remote target. Served from the
+ *  main event loop over the SWD bridge.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#ifndef GDBSERVER_H
+#define GDBSERVER_H
+
+// Listen on TCP port - remote must be connected
+int gdb_open (int port);
+
+// Drop client and stop listening
+void gdb_close (void);
+
+#endif /* GDBSERVER_H */
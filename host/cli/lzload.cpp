@@ -0,0 +1,316 @@
+/**
+ *  Compressed image loading.
+ *
+ *  The image is compressed on the host into LZ4 style sequences:
+ *    token      - literal count (high nibble), match length - 4 (low nibble)
+ *    [ext]      - nibble == 15: add bytes until one is < 255
+ *    literals
+ *    offset     - 16 bit little endian distance back into output
+ *    [ext]      - match length extension, as above
+ *  Sequences are packed whole into chunks. A chunk may end right after its
+ *  literals, so a sequence without a match always closes its chunk.
+ *
+ *  A small decompressor runs from the top of RAM (see stub.h) with a mailbox
+ *  and LZ_BUFS chunk buffers. The host streams chunks into free buffers and
+ *  posts them in the mailbox, the decompressor expands them straight into
+ *  the destination and acks. A zero length chunk ends the load.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "lzload.h"
+#include "stub.h"
+#include "Target.h"
+#include "log.h"
+
+// Chunk buffers - LZ_BUFS must be a power of 2
+#define LZ_CHUNK     1024
+#define LZ_BUFS      4
+
+// Decompressor layout
+#define LZ_MBOX      0x0090
+#define LZ_AREA      (LZ_MBOX + MBOX_BUF + (LZ_BUFS * LZ_CHUNK))
+
+// Mailbox offsets
+#define MBOX_REQ     0x00  // Chunks posted (host)
+#define MBOX_ACK     0x04  // Chunks expanded (target)
+#define MBOX_OUT     0x08  // Destination, final output pointer when done
+#define MBOX_LEN     0x10  // Chunk length per buffer
+#define MBOX_BUF     0x20  // Chunk buffers
+
+// Sequence limits - worst case sequence must fit a chunk
+#define LIT_MAX      768
+#define MATCH_MIN    4
+#define MATCH_MAX    8192
+#define OFFSET_MAX   0xffff
+#define HASH_BITS    14
+
+// Not worth it unless compressed below this fraction (of 8)
+#define RATIO_MAX    6
+
+// Thumb-2 decompressor - position independent, mailbox follows code
+// r2=out r3=in r4=in end r6=chunk r7=mailbox
+static const uint8_t stub[] = {
+  0x0f, 0xf2, 0x8c, 0x07,  // 00 start:  adr.w r7, mbox
+  0xba, 0x68,              // 04         ldr r2, [r7, #8]
+  0x00, 0x26,              // 06         movs r6, #0
+  0x38, 0x68,              // 08 wait:   ldr r0, [r7]
+  0xb0, 0x42,              // 0A         cmp r0, r6
+  0xfc, 0xd0,              // 0C         beq wait
+  0x06, 0xf0, 0x03, 0x00,  // 0E         and r0, r6, #3
+  0x07, 0xeb, 0x80, 0x03,  // 12         add.w r3, r7, r0, lsl #2
+  0x1c, 0x69,              // 16         ldr r4, [r3, #16]
+  0xa4, 0xb3,              // 18         cbz r4, done
+  0x07, 0xeb, 0x80, 0x23,  // 1A         add.w r3, r7, r0, lsl #10
+  0x20, 0x33,              // 1E         adds r3, #32
+  0x1c, 0x44,              // 20         add r4, r3
+  0xa3, 0x42,              // 22 seq:    cmp r3, r4
+  0x2b, 0xd2,              // 24         bhs next
+  0x13, 0xf8, 0x01, 0x5b,  // 26         ldrb r5, [r3], #1
+  0x28, 0x09,              // 2A         lsrs r0, r5, #4
+  0x0f, 0x28,              // 2C         cmp r0, #15
+  0x04, 0xd1,              // 2E         bne lit
+  0x13, 0xf8, 0x01, 0x1b,  // 30 lext:   ldrb r1, [r3], #1
+  0x08, 0x44,              // 34         add r0, r1
+  0xff, 0x29,              // 36         cmp r1, #255
+  0xfa, 0xd0,              // 38         beq lext
+  0x28, 0xb1,              // 3A lit:    cbz r0, lend
+  0x13, 0xf8, 0x01, 0x1b,  // 3C lcopy:  ldrb r1, [r3], #1
+  0x02, 0xf8, 0x01, 0x1b,  // 40         strb r1, [r2], #1
+  0x01, 0x38,              // 44         subs r0, #1
+  0xf9, 0xd1,              // 46         bne lcopy
+  0xa3, 0x42,              // 48 lend:   cmp r3, r4
+  0x18, 0xd2,              // 4A         bhs next
+  0x13, 0xf8, 0x01, 0x0b,  // 4C         ldrb r0, [r3], #1
+  0x13, 0xf8, 0x01, 0x1b,  // 50         ldrb r1, [r3], #1
+  0x40, 0xea, 0x01, 0x20,  // 54         orr.w r0, r0, r1, lsl #8
+  0xa2, 0xeb, 0x00, 0x01,  // 58         sub.w r1, r2, r0
+  0x05, 0xf0, 0x0f, 0x00,  // 5C         and r0, r5, #15
+  0x0f, 0x28,              // 60         cmp r0, #15
+  0x04, 0xd1,              // 62         bne mlen
+  0x13, 0xf8, 0x01, 0x5b,  // 64 mext:   ldrb r5, [r3], #1
+  0x28, 0x44,              // 68         add r0, r5
+  0xff, 0x2d,              // 6A         cmp r5, #255
+  0xfa, 0xd0,              // 6C         beq mext
+  0x04, 0x30,              // 6E mlen:   adds r0, #4
+  0x11, 0xf8, 0x01, 0x5b,  // 70 mcopy:  ldrb r5, [r1], #1
+  0x02, 0xf8, 0x01, 0x5b,  // 74         strb r5, [r2], #1
+  0x01, 0x38,              // 78         subs r0, #1
+  0xf9, 0xd1,              // 7A         bne mcopy
+  0xd1, 0xe7,              // 7C         b seq
+  0x01, 0x36,              // 7E next:   adds r6, #1
+  0x7e, 0x60,              // 80         str r6, [r7, #4]
+  0xc1, 0xe7,              // 82         b wait
+  0xba, 0x60,              // 84 done:   str r2, [r7, #8]
+  0x01, 0x36,              // 86         adds r6, #1
+  0x7e, 0x60,              // 88         str r6, [r7, #4]
+  0x30, 0xbf,              // 8A halt:   wfi
+  0xfd, 0xe7,              // 8C         b halt
+  0x00, 0x00,              // 8E         (pad)
+};
+
+// Compressed stream split into chunks
+typedef struct {
+  uint8_t  *buf;
+  uint32_t  len, cap;
+  uint32_t *end;      // Chunk end offsets
+  int       cnt, max;
+  uint32_t  start;    // Current chunk start
+} lz_t;
+
+static uint32_t hash4 (const uint8_t *p)
+{
+  uint32_t v;
+  memcpy (&v, p, 4);
+  return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static uint8_t *put_len (uint8_t *p, uint32_t len)
+{
+  while (len >= 255) {
+    *p++ = 255;
+    len -= 255;
+  }
+  *p++ = len;
+  return p;
+}
+
+static int chunk_close (lz_t *lz)
+{
+  if (lz->len == lz->start)
+    return 0;
+  if (lz->cnt == lz->max) {
+    lz->max = lz->max ? lz->max * 2 : 64;
+    lz->end = (uint32_t *)realloc (lz->end, lz->max * sizeof (uint32_t));
+    if (!lz->end)
+      return -1;
+  }
+  lz->end[lz->cnt++] = lz->len;
+  lz->start = lz->len;
+  return 0;
+}
+
+// Append one sequence - mlen = 0 for literals only
+static int lz_seq (lz_t *lz, const uint8_t *lit, uint32_t nlit, uint32_t off, uint32_t mlen)
+{
+  uint8_t seq[LZ_CHUNK], *p = seq;
+
+  *p++ = ((nlit < 15 ? nlit : 15) << 4) |
+    (mlen ? ((mlen - MATCH_MIN < 15) ? mlen - MATCH_MIN : 15) : 0);
+  if (nlit >= 15)
+    p = put_len (p, nlit - 15);
+  memcpy (p, lit, nlit);
+  p += nlit;
+  if (mlen) {
+    *p++ = off & 0xff;
+    *p++ = off >> 8;
+    if (mlen - MATCH_MIN >= 15)
+      p = put_len (p, mlen - MATCH_MIN - 15);
+  }
+
+  // Sequences never straddle chunks
+  if ((lz->len - lz->start + (p - seq) > LZ_CHUNK) && chunk_close (lz))
+    return -1;
+  if (lz->len + (p - seq) > lz->cap) {
+    lz->cap = lz->cap * 2 + LZ_CHUNK;
+    lz->buf = (uint8_t *)realloc (lz->buf, lz->cap);
+    if (!lz->buf)
+      return -1;
+  }
+  memcpy (lz->buf + lz->len, seq, p - seq);
+  lz->len += p - seq;
+
+  // Decompressor stops at chunk end after bare literals
+  if (!mlen)
+    return chunk_close (lz);
+  return 0;
+}
+
+static int lz_emit (lz_t *lz, const uint8_t *lit, uint32_t nlit, uint32_t off, uint32_t mlen)
+{
+  // Split long literal runs
+  while (nlit > LIT_MAX) {
+    if (lz_seq (lz, lit, LIT_MAX, 0, 0))
+      return -1;
+    lit += LIT_MAX;
+    nlit -= LIT_MAX;
+  }
+  if (!nlit && !mlen)
+    return 0;
+  return lz_seq (lz, lit, nlit, off, mlen);
+}
+
+// Greedy compressor - hash of every position, nearest 4 byte match
+static int lz_compress (lz_t *lz, const uint8_t *src, uint32_t size)
+{
+  uint32_t *table, ip = 0, anchor = 0, ref, len, h, k;
+  int rv = 0;
+
+  // 0 = empty, else position + 1
+  table = (uint32_t *)calloc (1 << HASH_BITS, sizeof (uint32_t));
+  if (!table)
+    return -1;
+
+  while (!rv && (ip + MATCH_MIN <= size)) {
+    h = hash4 (src + ip);
+    ref = table[h];
+    table[h] = ip + 1;
+    if (!ref || (ip - (ref - 1) > OFFSET_MAX) || memcmp (src + ref - 1, src + ip, MATCH_MIN)) {
+      ip++;
+      continue;
+    }
+
+    // Extend match - overlapping copies encode runs
+    ref--;
+    len = MATCH_MIN;
+    while ((ip + len < size) && (len < MATCH_MAX) && (src[ref + len] == src[ip + len]))
+      len++;
+    rv = lz_emit (lz, src + anchor, ip - anchor, ip - ref, len);
+    for (k = ip + 1; (k < ip + len) && (k + MATCH_MIN <= size); k++)
+      table[hash4 (src + k)] = k + 1;
+    ip += len;
+    anchor = ip;
+  }
+
+  // Trailing literals
+  if (!rv)
+    rv = lz_emit (lz, src + anchor, size - anchor, 0, 0);
+  if (!rv)
+    rv = chunk_close (lz);
+  free (table);
+  return rv;
+}
+
+int lzload (uint32_t addr, const void *data, uint32_t size)
+{
+  Target *target = Target::Ptr ();
+  lz_t lz;
+  uint32_t base, mbox, hdr[4], len, start;
+  int i, rv = -1;
+
+  // Decompressor lives at the top of RAM
+  base = stub_base (LZ_AREA);
+  if (!base)
+    return 1;
+  mbox = base + LZ_MBOX;
+  if ((addr < base + LZ_AREA) && (addr + size > base))
+    return 1;
+
+  // Compress and check it pays off
+  memset (&lz, 0, sizeof (lz));
+  if (lz_compress (&lz, (const uint8_t *)data, size))
+    goto cleanup;
+  log (LOG_DEBUG, "lzload: %u -> %u bytes in %d chunks", size, lz.len, lz.cnt);
+  if ((uint64_t)lz.len * 8 > (uint64_t)size * RATIO_MAX) {
+    rv = 1;
+    goto cleanup;
+  }
+
+  // Reset mailbox and start decompressor
+  hdr[0] = hdr[1] = 0;
+  hdr[2] = addr;
+  hdr[3] = 0;
+  target->WriteW (mbox, hdr, 4);
+  stub_start (base, stub, sizeof (stub));
+
+  // Keep every buffer busy - only wait when the next one is still in use
+  for (i = 0, start = 0; i <= lz.cnt; i++) {
+    if ((i >= LZ_BUFS) && stub_wait (mbox + MBOX_ACK, i - LZ_BUFS + 1)) {
+      log (LOG_ERR, "lzload: decompressor stalled at chunk %d", i - LZ_BUFS);
+      goto halt;
+    }
+    len = (i < lz.cnt) ? lz.end[i] - start : 0;
+    if (len)
+      target->MemcpyTo (mbox + MBOX_BUF + (i & (LZ_BUFS - 1)) * LZ_CHUNK, lz.buf + start, len);
+    target->WriteW (mbox + MBOX_LEN + (i & (LZ_BUFS - 1)) * 4, &len, 1);
+    len = i + 1;
+    target->WriteW (mbox + MBOX_REQ, &len, 1);
+    if (i < lz.cnt)
+      start = lz.end[i];
+  }
+
+  // Wait for end marker and check everything was expanded
+  if (stub_wait (mbox + MBOX_ACK, lz.cnt + 1)) {
+    log (LOG_ERR, "lzload: decompressor did not finish");
+    goto halt;
+  }
+  target->ReadW (mbox + MBOX_OUT, &len, 1);
+  if (len != addr + size)
+    log (LOG_ERR, "lzload: expanded %u of %u bytes", len - addr, size);
+  else
+    rv = 0;
+
+ halt:
+  // Keep vectors the image replaced - CPU wrote behind the cache
+  stub_stop (rv ? 0 : addr, rv ? 0 : size);
+  target->CacheInvalidate (addr, size);
+
+ cleanup:
+  free (lz.buf);
+  free (lz.end);
+  return rv;
+}
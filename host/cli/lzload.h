@@ -0,0 +1,20 @@
+/**
+ *  Compressed image loading. The image is LZ compressed on the host and
+ *  expanded in place by a small decompressor running on the local CPU.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#ifndef LZLOAD_H
+#define LZLOAD_H
+
+#include <stdint.h>
+
+// Load data[size] to addr through the on-target decompressor. The CPU is
+// released while loading and left in reset.
+// Returns 0 on success, 1 if the image should be loaded directly instead
+// (does not compress, or overlaps the decompressor) and -1 on failure.
+int lzload (uint32_t addr, const void *data, uint32_t size);
+
+#endif /* LZLOAD_H */
@@ -15,6 +15,13 @@
 // Argument storage
 static args_t args;
 
+// Long only options
+#define OPT_PROFILE_OUT   0x100
+#define OPT_PROFILE_RATE  0x101
+#define OPT_PCSR          0x102
+#define OPT_SCOPE_VAR     0x103
+#define OPT_SCOPE_RATE    0x104
+
 static int parse_opts (int key, char *arg, struct argp_state *state)
 {
   switch (key) {
@@ -42,6 +49,14 @@ static int parse_opts (int key, char *arg, struct argp_state *state)
       }
       break;
 
+    case 'z':
+      args.compress = true;
+      break;
+
+    case 'd':
+      args.delta = true;
+      break;
+
     case 'g':
       args.gdb = true;
       break;
@@ -78,6 +93,61 @@ static int parse_opts (int key, char *arg, struct argp_state *state)
     case 'h':
       args.remote_halt = false;
       break;
+
+    case 'f':
+      args.fifo = strtoul (arg, NULL, 0);
+      break;
+
+    case 'R':
+      args.record = arg;
+      break;
+
+    case 'G':
+      args.gdb_port = strtoul (arg, NULL, 0);
+      break;
+
+    case 'S':
+      args.server = arg;
+      break;
+
+    case 'P':
+      args.profile = arg;
+      break;
+
+    case OPT_PROFILE_OUT:
+      args.profile_out = arg;
+      break;
+
+    case OPT_PROFILE_RATE:
+      args.profile_rate = strtoul (arg, NULL, 0);
+      break;
+
+    case OPT_PCSR:
+      args.pcsr = strtoul (arg, NULL, 0);
+      break;
+
+    case 's':
+      args.scope = arg;
+      break;
+
+    // Append to scope variables
+    case OPT_SCOPE_VAR:
+      if (arg) {
+        char *width;
+        args.scope_var = (scope_var_t *)realloc (args.scope_var, sizeof (scope_var_t) * (args.scope_cnt + 1));
+        if (!args.scope_var)
+          err ("Malloc failed!");
+
+        // Parse into addr/width
+        args.scope_var[args.scope_cnt].addr = strtoul (arg, &width, 0);
+        args.scope_var[args.scope_cnt].width = (*width == ':') ? strtoul (width + 1, NULL, 0) : 4;
+        args.scope_cnt++;
+      }
+      break;
+
+    case OPT_SCOPE_RATE:
+      args.scope_rate = strtoul (arg, NULL, 0);
+      break;
       
     case ARGP_KEY_ARG:
       args.device = arg;
@@ -102,13 +172,27 @@ static struct argp_option options[] = {
                                        {"map",     'm', "FILE", 0, "system map file"},
                                        {"load",    'l', "FILE", 0, "filename[@address] (default=0)\nmultiple load opts supported"},
                                        {"path",    'p', "DIR", 0,  "Plugin search path\nmultiple path opts supported"},
+                                       {"compress", 'z', 0, 0, "Load compressible images through on-target decompressor"},
+                                       {"delta",   'd', 0, 0, "Only write blocks that differ on target, verify by target CRC"},
                                        
                                        {0, 0, 0, 0, "Remote:", 2},
                                        {"remote",  'r', "0-31", OPTION_ARG_OPTIONAL, "Connect remote: Opt clk divisor"},
                                        {"halt",    'h', 0, 0, "Do NOT halt remote CPU (default=halt CPU)"},
                                        {0, 0, 0, 0, "Debugging:", 3},
                                        {"gdb", 'g', 0, 0,  "Leave processor in reset until GDB attaches"},
+                                       {"gdbserver", 'G', "PORT", 0, "Serve remote CPU to GDB on localhost PORT"},
                                        {"verbose", 'v', "INT", 0,  "verbosity level (0-4)"},
+                                       {"fifo",    'f', "BYTES", 0, "Override device FIFO depth (default=auto)"},
+                                       {"record",  'R', "FILE", 0, "Record slave packets (replay with dispatch-bench)"},
+                                       {"server",  'S', "PATH", 0, "Serve master access to local clients on Unix socket PATH"},
+                                       {0, 0, 0, 0, "Profiling:", 4},
+                                       {"profile", 'P', "ELF", 0, "Sample running CPU PC, symbolize against ELF"},
+                                       {"profile-out", OPT_PROFILE_OUT, "PREFIX", 0, "Write PREFIX.flat/.folded/.perf (default=profile)"},
+                                       {"profile-rate", OPT_PROFILE_RATE, "HZ", 0, "Samples per second (default=max link allows)"},
+                                       {"pcsr", OPT_PCSR, "ADDR", 0, "Local CPU DWT_PCSR address on master bus (default=remote CPU)"},
+                                       {"scope", 's', "FILE", 0, "Capture variables to FILE while running"},
+                                       {"scope-var", OPT_SCOPE_VAR, "ADDR[:W]", 0, "Variable address and width 1/2/4 (default=4)\nmultiple scope-var opts supported"},
+                                       {"scope-rate", OPT_SCOPE_RATE, "HZ", 0, "Scope samples per second (default=max link allows)"},
                                        {0}
 };
 
@@ -122,6 +206,7 @@ int main (int argc, char **argv)
   memset (&args, 0, sizeof (args));
   args.verbose = LOG_NORMAL;
   args.remote_halt = true;
+  args.profile_out = (char *)"profile";
   
   // Add system path to plugin path
 #if defined(INSTALL_PREFIX)
@@ -156,6 +241,7 @@ int main (int argc, char **argv)
   free (args.path);
   if (args.map)
     free (args.map);
+  free (args.scope_var);
   return rv;
 }
 
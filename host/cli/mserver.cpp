@@ -0,0 +1,798 @@
+/**
+ *  Master access server. Multiplexes the device link among local client
+ *  processes (see mserver_proto.h for the wire protocol).
+ *
+ *  Requests are queued per client and served in rounds (deficit round
+ *  robin). Each round a client may move QUANTUM bytes, so a large dump is
+ *  split across rounds and cannot starve a client polling a few words.
+ *  Word sized requests from all clients in a round are coalesced into one
+ *  vectored link transfer. Between rounds the event loop runs, so new
+ *  requests, replies and other services interleave with bulk traffic.
+ *
+ *  Transfers go through Target, so clients see the host page cache and a
+ *  client writing the CPU reset CSR keeps it in step like CPUReset ().
+ *
+ *  Clients can attach shared rings (MSRV_SHM). Their requests are taken
+ *  from the submission ring into the same queues and transfers read and
+ *  write the client arena directly.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "mserver.h"
+#include "mserver_proto.h"
+#include "err.h"
+#include "evloop.h"
+#include "ll.h"
+#include "Target.h"
+#include "flexsoc.h"
+#include "log.h"
+
+// Bytes served per client per round
+#define QUANTUM       4096
+
+// Stop serving a client until it reads its replies
+#define OUT_MAX       (2 * MSRV_LEN_MAX)
+
+// Stop reading a client until its queue drains
+#define QUEUE_MAX     256
+
+// Socket read size
+#define IN_SZ         0x10000
+
+typedef struct req {
+  struct req *next;
+  msrv_req_t  hdr;
+  uint8_t    *data;       // Write data, vec ops or read result
+  uint32_t    done;       // Bytes or ops completed
+  int16_t     rv;
+  bool        shm;        // Data is in client arena
+} req_t;
+
+typedef struct {
+  list_t    list;
+  int       fd;
+  bool      paused;       // Input not watched
+  bool      closed;
+
+  // Partial request
+  uint8_t  *in;
+  uint32_t  in_len, in_sz;
+
+  // Pending requests
+  req_t    *head, *tail;
+  int       queued;
+  int       deficit;
+  bool      served;       // Scheduled this round
+
+  // Unsent replies
+  uint8_t  *out;
+  uint32_t  out_off, out_len, out_sz;
+
+  // Shared rings - geometry checked at attach and kept here
+  int          shm_fd;    // Passed with MSRV_SHM
+  msrv_shm_t  *shm;
+  uint32_t     shm_sz;
+  msrv_sqe_t  *sq;
+  msrv_resp_t *cq;
+  uint8_t     *arena;
+  uint32_t     arena_sz;
+  uint32_t     mask;
+  uint32_t     sq_head, cq_tail;
+  bool         wake;      // Completions posted since last wakeup
+} client_t;
+
+// Word ops coalesced from all clients in a round
+typedef struct {
+  client_t *c;
+  req_t    *r;
+  int       idx;
+} slot_t;
+
+static struct {
+  Target        *targ;
+  int            lfd, kfd;
+  char          *path;
+  list_t         clients;
+  bool           kicked;
+
+  // Round batch
+  flexsoc_vec_t  vec[MSRV_VEC_MAX];
+  slot_t         slot[MSRV_VEC_MAX];
+  int            cnt;
+} srv = {NULL, -1, -1};
+
+static void client_close (client_t *c);
+
+// Schedule a round from the event loop
+static void kick (void)
+{
+  uint64_t val = 1;
+
+  if (srv.kicked)
+    return;
+  if (write (srv.kfd, &val, sizeof (val)) == sizeof (val))
+    srv.kicked = true;
+}
+
+static uint32_t req_payload (const msrv_req_t *hdr)
+{
+  switch (hdr->op) {
+    case MSRV_WRITE: return hdr->len;
+    case MSRV_VEC:   return hdr->len * sizeof (msrv_vec_t);
+    default:         return 0;
+  }
+}
+
+static uint32_t req_reply (const req_t *r)
+{
+  if (r->rv != MSRV_OK)
+    return 0;
+  switch (r->hdr.op) {
+    case MSRV_READ: return r->hdr.len;
+    case MSRV_VEC:  return r->hdr.len * sizeof (uint32_t);
+    default:        return 0;
+  }
+}
+
+static int16_t req_check (const msrv_req_t *hdr)
+{
+  int w = hdr->width;
+
+  if (hdr->op == MSRV_SHM)
+    return (hdr->len >= sizeof (msrv_shm_t)) && (hdr->len <= MSRV_SHM_MAX) ?
+      MSRV_OK : MSRV_EINVAL;
+  if (hdr->op > MSRV_SHM)
+    return MSRV_EINVAL;
+  if (hdr->op == MSRV_VEC)
+    return (hdr->len && (hdr->len <= MSRV_VEC_MAX)) ? MSRV_OK : MSRV_EINVAL;
+  if ((w != MSRV_WIDTH_ANY) && (w != 1) && (w != 2) && (w != 4))
+    return MSRV_EINVAL;
+  if (!hdr->len || (hdr->len > MSRV_LEN_MAX))
+    return MSRV_EINVAL;
+  if (w && ((hdr->addr | hdr->len) & (w - 1)))
+    return MSRV_EINVAL;
+  return MSRV_OK;
+}
+
+static void out_append (client_t *c, const void *buf, uint32_t len)
+{
+  if (c->out_len + len > c->out_sz) {
+
+    // Compact before growing
+    if (c->out_off) {
+      memmove (c->out, &c->out[c->out_off], c->out_len - c->out_off);
+      c->out_len -= c->out_off;
+      c->out_off = 0;
+    }
+    if (c->out_len + len > c->out_sz) {
+      c->out_sz = c->out_len + len;
+      c->out = (uint8_t *)realloc (c->out, c->out_sz);
+      if (!c->out)
+        err ("Failed to malloc");
+    }
+  }
+  memcpy (&c->out[c->out_len], buf, len);
+  c->out_len += len;
+}
+
+static void out_flush (client_t *c)
+{
+  int rv;
+
+  // Wake client sleeping on completions
+  if (c->wake) {
+    c->wake = false;
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    if (__atomic_load_n (&c->shm->wait, __ATOMIC_RELAXED))
+      out_append (c, "", 1);
+  }
+  while (c->out_off < c->out_len) {
+    rv = send (c->fd, &c->out[c->out_off], c->out_len - c->out_off,
+               MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (rv <= 0) {
+      if ((rv < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+        break;
+      c->closed = true;
+      return;
+    }
+    c->out_off += rv;
+  }
+  if (c->out_off == c->out_len)
+    c->out_off = c->out_len = 0;
+
+  // Wait for socket space if backlogged
+  evloop_events (c->fd, !c->paused, c->out_len != 0);
+}
+
+// Reply to request and release it
+static void req_done (client_t *c, req_t *r)
+{
+  msrv_resp_t resp;
+
+  resp.tag = r->hdr.tag;
+  resp.rv = r->rv;
+  resp.len = req_reply (r);
+
+  // Ring completion - data is already in arena
+  if (r->shm) {
+    c->cq[c->cq_tail & c->mask] = resp;
+    __atomic_store_n (&c->shm->cq_tail, ++c->cq_tail, __ATOMIC_RELEASE);
+    c->wake = true;
+  }
+  else {
+    out_append (c, &resp, sizeof (resp));
+    if (resp.len)
+      out_append (c, r->data, resp.len);
+    free (r->data);
+  }
+  c->queued--;
+  free (r);
+}
+
+static req_t *req_pop (client_t *c)
+{
+  req_t *r = c->head;
+
+  c->head = r->next;
+  if (!c->head)
+    c->tail = NULL;
+  return r;
+}
+
+// Complete coalesced word ops - requests finish in queue order
+// Ops are independent so a failed op only fails the request it came from
+static void batch_flush (void)
+{
+  int i;
+  req_t *r;
+
+  if (!srv.cnt)
+    return;
+  if (srv.targ->Vec (srv.vec, srv.cnt))
+    log (LOG_DEBUG, "mserver: batch of %d ops had failures", srv.cnt);
+  for (i = 0; i < srv.cnt; i++) {
+    r = srv.slot[i].r;
+    if (!srv.vec[i].ok)
+      r->rv = MSRV_EFAIL;
+    else if (r->hdr.op == MSRV_VEC)
+      ((uint32_t *)r->data)[srv.slot[i].idx] = srv.vec[i].data;
+    else if (r->hdr.op == MSRV_READ)
+      memcpy (r->data, &srv.vec[i].data, 4);
+    if (++r->done == ((r->hdr.op == MSRV_VEC) ? r->hdr.len : 1))
+      req_done (srv.slot[i].c, r);
+  }
+  srv.cnt = 0;
+}
+
+// Add word ops of request to round batch
+static void batch_add (client_t *c, req_t *r)
+{
+  uint32_t i, n;
+  msrv_vec_t *op = (msrv_vec_t *)r->data;
+  flexsoc_vec_t *v;
+
+  n = (r->hdr.op == MSRV_VEC) ? r->hdr.len : 1;
+  if (srv.cnt + n > MSRV_VEC_MAX)
+    batch_flush ();
+  for (i = 0; i < n; i++, srv.cnt++) {
+    v = &srv.vec[srv.cnt];
+    if (r->hdr.op == MSRV_VEC) {
+      v->addr = op[i].addr & ~3;
+      v->data = op[i].data;
+      v->write = op[i].addr & MSRV_VEC_WR;
+    }
+    else {
+      v->addr = r->hdr.addr;
+      v->write = (r->hdr.op == MSRV_WRITE);
+      if (v->write)
+        memcpy (&v->data, r->data, 4);
+    }
+    srv.slot[srv.cnt].c = c;
+    srv.slot[srv.cnt].r = r;
+    srv.slot[srv.cnt].idx = i;
+  }
+}
+
+// Move part of a block transfer
+static int block_xfer (req_t *r, uint32_t n)
+{
+  return srv.targ->Xfer (r->hdr.op == MSRV_WRITE, r->hdr.addr + r->done,
+                         &r->data[r->done], n, r->hdr.width);
+}
+
+static bool in_arena (uint32_t off, uint32_t len, uint32_t sz)
+{
+  return (off <= sz) && (len <= sz - off);
+}
+
+// Map client rings passed with MSRV_SHM
+static int16_t shm_attach (client_t *c, uint32_t len)
+{
+  msrv_shm_t hdr;
+  struct stat st;
+  uint32_t ent;
+  void *p;
+
+  if ((c->shm_fd < 0) || c->shm)
+    return MSRV_EINVAL;
+
+  // Client must not be able to shrink the mapping under us
+  if (fstat (c->shm_fd, &st) || (st.st_size < len) ||
+      !(fcntl (c->shm_fd, F_GET_SEALS) & F_SEAL_SHRINK))
+    p = MAP_FAILED;
+  else
+    p = mmap (NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, c->shm_fd, 0);
+  close (c->shm_fd);
+  c->shm_fd = -1;
+  if (p == MAP_FAILED)
+    return MSRV_EINVAL;
+
+  // Check layout once
+  memcpy (&hdr, p, sizeof (hdr));
+  ent = hdr.entries;
+  if ((hdr.magic != MSRV_SHM_MAGIC) || !ent || (ent > MSRV_ENT_MAX) ||
+      (ent & (ent - 1)) ||
+      (hdr.sq_off < sizeof (hdr)) || (hdr.sq_off & 3) ||
+      (hdr.cq_off < sizeof (hdr)) || (hdr.cq_off & 3) ||
+      (hdr.arena_off < sizeof (hdr)) ||
+      !in_arena (hdr.sq_off, ent * sizeof (msrv_sqe_t), len) ||
+      !in_arena (hdr.cq_off, ent * sizeof (msrv_resp_t), len) ||
+      !in_arena (hdr.arena_off, hdr.arena_sz, len)) {
+    munmap (p, len);
+    return MSRV_EINVAL;
+  }
+  c->shm = (msrv_shm_t *)p;
+  c->shm_sz = len;
+  c->sq = (msrv_sqe_t *)((uint8_t *)p + hdr.sq_off);
+  c->cq = (msrv_resp_t *)((uint8_t *)p + hdr.cq_off);
+  c->arena = (uint8_t *)p + hdr.arena_off;
+  c->arena_sz = hdr.arena_sz;
+  c->mask = ent - 1;
+  c->sq_head = __atomic_load_n (&c->shm->sq_head, __ATOMIC_ACQUIRE);
+  c->cq_tail = __atomic_load_n (&c->shm->cq_tail, __ATOMIC_ACQUIRE);
+  __atomic_store_n (&c->shm->busy, 1, __ATOMIC_SEQ_CST);
+  log (LOG_DEBUG, "mserver: shared rings attached (%d entries, %dkB arena)",
+       ent, hdr.arena_sz >> 10);
+  return MSRV_OK;
+}
+
+// Queue requests from submission ring
+static void shm_parse (client_t *c)
+{
+  uint32_t tail, sz;
+  msrv_sqe_t sqe;
+  req_t *r;
+
+  tail = __atomic_load_n (&c->shm->sq_tail, __ATOMIC_ACQUIRE);
+  while ((c->sq_head != tail) && (c->queued < QUEUE_MAX)) {
+
+    // Copy out - client owns the memory
+    sqe = c->sq[c->sq_head++ & c->mask];
+    r = (req_t *)calloc (1, sizeof (req_t));
+    if (!r)
+      err ("Failed to malloc");
+    r->hdr.op = sqe.op;
+    r->hdr.width = sqe.width;
+    r->hdr.tag = sqe.tag;
+    r->hdr.addr = sqe.addr;
+    r->hdr.len = sqe.len;
+    r->shm = true;
+    r->rv = (sqe.op == MSRV_SHM) ? MSRV_EINVAL : req_check (&r->hdr);
+    sz = (sqe.op == MSRV_VEC) ? sqe.len * sizeof (msrv_vec_t) : sqe.len;
+    if ((r->rv == MSRV_OK) && !in_arena (sqe.off, sz, c->arena_sz))
+      r->rv = MSRV_EINVAL;
+    if (r->rv == MSRV_OK)
+      r->data = &c->arena[sqe.off];
+
+    // Append to queue
+    if (c->tail)
+      c->tail->next = r;
+    else
+      c->head = r;
+    c->tail = r;
+    c->queued++;
+  }
+  __atomic_store_n (&c->shm->sq_head, c->sq_head, __ATOMIC_RELEASE);
+}
+
+// Clear busy once idle - client rings the socket from then on
+static void shm_idle (client_t *c)
+{
+  if (!c->shm || c->head)
+    return;
+  __atomic_store_n (&c->shm->busy, 0, __ATOMIC_SEQ_CST);
+
+  // Catch submissions that saw busy still set
+  if (__atomic_load_n (&c->shm->sq_tail, __ATOMIC_SEQ_CST) != c->sq_head) {
+    __atomic_store_n (&c->shm->busy, 1, __ATOMIC_SEQ_CST);
+    shm_parse (c);
+  }
+}
+
+// Word sized request - coalesced into round batch
+static bool is_word (const req_t *r)
+{
+  return (r->rv == MSRV_OK) &&
+    ((r->hdr.op == MSRV_VEC) || ((r->hdr.width == 4) && (r->hdr.len == 4)));
+}
+
+// Serve head request within deficit - false when out of budget
+static bool serve (client_t *c)
+{
+  req_t *r = c->head;
+  uint32_t n, cost, w;
+
+  // Rejected at parse time - earlier word ops reply first
+  if (r->rv != MSRV_OK) {
+    batch_flush ();
+    req_done (c, req_pop (c));
+    return true;
+  }
+
+  // Attach shared rings
+  if (r->hdr.op == MSRV_SHM) {
+    batch_flush ();
+    r->rv = shm_attach (c, r->hdr.len);
+    req_done (c, req_pop (c));
+    return true;
+  }
+
+  // Read buffer allocated once request is reached
+  if ((r->hdr.op == MSRV_READ) && !r->data) {
+    r->data = (uint8_t *)malloc (r->hdr.len);
+    if (!r->data)
+      err ("Failed to malloc");
+  }
+
+  // Word ops are coalesced
+  if (is_word (r)) {
+    cost = (r->hdr.op == MSRV_VEC) ? r->hdr.len * 4 : 4;
+    if ((int)cost > c->deficit)
+      return false;
+    c->deficit -= cost;
+    batch_add (c, req_pop (c));
+    return true;
+  }
+
+  // Earlier word ops go first
+  batch_flush ();
+
+  // Block transfer - move what the budget allows
+  w = r->hdr.width ? r->hdr.width : 1;
+  n = r->hdr.len - r->done;
+  if ((int)n > c->deficit)
+    n = c->deficit & ~(w - 1);
+  if (!n)
+    return false;
+  if (block_xfer (r, n))
+    r->rv = MSRV_EFAIL;
+  c->deficit -= n;
+  r->done += n;
+  if ((r->done == r->hdr.len) || (r->rv != MSRV_OK))
+    req_done (c, req_pop (c));
+  return true;
+}
+
+// Client can take more work
+static bool ready (client_t *c)
+{
+  return c->head && !c->closed && (c->out_len - c->out_off < OUT_MAX);
+}
+
+// Queue complete requests from input
+static int parse (client_t *c)
+{
+  uint32_t off = 0, sz;
+  msrv_req_t *hdr;
+  req_t *r;
+
+  while (c->in_len - off >= sizeof (msrv_req_t)) {
+    hdr = (msrv_req_t *)&c->in[off];
+
+    // Unknown op - stream can't be resynced
+    if (hdr->op > MSRV_SHM)
+      return -1;
+
+    // Don't buffer oversized payloads - drop client
+    sz = req_payload (hdr);
+    if (sz > MSRV_LEN_MAX)
+      return -1;
+    if (c->in_len - off < sizeof (msrv_req_t) + sz)
+      break;
+
+    r = (req_t *)calloc (1, sizeof (req_t));
+    if (!r)
+      err ("Failed to malloc");
+    r->hdr = *hdr;
+    r->rv = req_check (hdr);
+    if (sz) {
+      r->data = (uint8_t *)malloc (sz);
+      if (!r->data)
+        err ("Failed to malloc");
+      memcpy (r->data, &hdr[1], sz);
+    }
+    off += sizeof (msrv_req_t) + sz;
+
+    // Append to queue
+    if (c->tail)
+      c->tail->next = r;
+    else
+      c->head = r;
+    c->tail = r;
+    c->queued++;
+  }
+
+  // Keep partial request
+  memmove (c->in, &c->in[off], c->in_len - off);
+  c->in_len -= off;
+  return 0;
+}
+
+// Take input and queue requests
+static void client_read (client_t *c)
+{
+  int rv;
+  uint8_t ring[64];
+  struct iovec iov;
+  struct msghdr msg = {};
+  struct cmsghdr *cm;
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE (sizeof (int))];
+  } ctl;
+
+  // Attached - socket only carries wakeups
+  if (c->shm) {
+    while ((rv = recv (c->fd, ring, sizeof (ring), MSG_DONTWAIT)) > 0)
+      ;
+    if ((rv == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK)))
+      c->closed = true;
+    __atomic_store_n (&c->shm->busy, 1, __ATOMIC_SEQ_CST);
+    shm_parse (c);
+    return;
+  }
+
+  if (c->in_sz - c->in_len < IN_SZ) {
+    c->in_sz = c->in_len + IN_SZ;
+    c->in = (uint8_t *)realloc (c->in, c->in_sz);
+    if (!c->in)
+      err ("Failed to malloc");
+  }
+  iov.iov_base = &c->in[c->in_len];
+  iov.iov_len = IN_SZ;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = &ctl;
+  msg.msg_controllen = sizeof (ctl);
+  rv = recvmsg (c->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+
+  // Keep memfd for MSRV_SHM
+  cm = (rv > 0) ? CMSG_FIRSTHDR (&msg) : NULL;
+  if (cm && (cm->cmsg_level == SOL_SOCKET) && (cm->cmsg_type == SCM_RIGHTS)) {
+    if (c->shm_fd >= 0)
+      close (c->shm_fd);
+    memcpy (&c->shm_fd, CMSG_DATA (cm), sizeof (int));
+  }
+  if (rv > 0) {
+    c->in_len += rv;
+    if (parse (c)) {
+      log (LOG_ERR, "mserver: bad request - dropping client");
+      c->closed = true;
+    }
+    else if (c->queued >= QUEUE_MAX)
+      c->paused = true;
+  }
+  else if ((rv == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK)))
+    c->closed = true;
+}
+
+// One scheduling round
+static void round_cb (int fd, void *arg)
+{
+  uint64_t val;
+  bool more = false;
+  list_t *cur, *n;
+  client_t *c;
+
+  if (read (fd, &val, sizeof (val)) != sizeof (val))
+    return;
+  srv.kicked = false;
+
+  // Pick up requests that arrived during the last round
+  ll_for_each (cur, &srv.clients) {
+    c = ll_entry (cur, client_t, list);
+    if (!c->paused && !c->closed)
+      client_read (c);
+  }
+
+  // Each client gets a quantum, unused budget is dropped once idle
+  ll_for_each (cur, &srv.clients) {
+    c = ll_entry (cur, client_t, list);
+    c->served = ready (c);
+    if (!c->served)
+      continue;
+    c->deficit += QUANTUM;
+
+    // Leading word ops of every client go out first in one batch
+    while (c->head && is_word (c->head) && serve (c))
+      ;
+  }
+
+  // Reply before moving bulk data
+  batch_flush ();
+  ll_for_each (cur, &srv.clients) {
+    c = ll_entry (cur, client_t, list);
+    if ((c->out_len || c->wake) && !c->closed)
+      out_flush (c);
+  }
+
+  // Then block transfers
+  ll_for_each (cur, &srv.clients) {
+    c = ll_entry (cur, client_t, list);
+    if (!c->served)
+      continue;
+    while (c->head && serve (c))
+      ;
+    if (!c->head)
+      c->deficit = 0;
+  }
+  batch_flush ();
+
+  // Send replies and resume paused input
+  ll_for_each_safe (cur, n, &srv.clients) {
+    c = ll_entry (cur, client_t, list);
+    if (c->paused && (c->queued < QUEUE_MAX / 2))
+      c->paused = false;
+    shm_idle (c);
+    out_flush (c);
+    if (c->closed)
+      client_close (c);
+    else if (ready (c))
+      more = true;
+  }
+  if (more)
+    kick ();
+}
+
+static void client_cb (int fd, void *arg)
+{
+  client_t *c = (client_t *)arg;
+  uint8_t peek;
+
+  // Paused - only check for hangup
+  if (c->paused) {
+    if (recv (fd, &peek, 1, MSG_PEEK | MSG_DONTWAIT) == 0)
+      c->closed = true;
+  }
+  else
+    client_read (c);
+
+  // Drain replies
+  if (!c->closed) {
+    shm_idle (c);
+    out_flush (c);
+  }
+  if (c->closed) {
+    client_close (c);
+    return;
+  }
+  if (ready (c))
+    kick ();
+}
+
+static void client_close (client_t *c)
+{
+  req_t *r;
+
+  // Word ops may reference client
+  batch_flush ();
+  while (c->head) {
+    r = req_pop (c);
+    if (!r->shm)
+      free (r->data);
+    free (r);
+  }
+  if (c->shm)
+    munmap (c->shm, c->shm_sz);
+  if (c->shm_fd >= 0)
+    close (c->shm_fd);
+  evloop_del (c->fd);
+  close (c->fd);
+  ll_rm (&srv.clients, &c->list);
+  free (c->in);
+  free (c->out);
+  free (c);
+  log (LOG_DEBUG, "mserver: client disconnected");
+}
+
+static void accept_cb (int fd, void *arg)
+{
+  int cfd;
+  client_t *c;
+
+  cfd = accept4 (fd, NULL, NULL, SOCK_CLOEXEC);
+  if (cfd < 0)
+    return;
+  c = (client_t *)calloc (1, sizeof (client_t));
+  if (!c)
+    err ("Failed to malloc");
+  c->fd = cfd;
+  c->shm_fd = -1;
+  if (evloop_add (cfd, client_cb, c)) {
+    close (cfd);
+    free (c);
+    return;
+  }
+  ll_add_tail (&srv.clients, &c->list);
+  log (LOG_DEBUG, "mserver: client connected");
+}
+
+int mserver_open (const char *path)
+{
+  struct sockaddr_un addr = {};
+
+  if (strlen (path) >= sizeof (addr.sun_path))
+    return -1;
+  srv.targ = Target::Ptr ();
+  LL_INIT (&srv.clients);
+
+  // Round trigger
+  srv.kfd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if ((srv.kfd < 0) || evloop_add (srv.kfd, round_cb, NULL))
+    goto fail;
+
+  // Replace stale socket from previous session
+  srv.lfd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (srv.lfd < 0)
+    goto fail;
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, path);
+  unlink (path);
+  if (bind (srv.lfd, (struct sockaddr *)&addr, sizeof (addr)) ||
+      listen (srv.lfd, 8) ||
+      evloop_add (srv.lfd, accept_cb, NULL))
+    goto fail;
+  srv.path = strdup (path);
+  log (LOG_NORMAL, "Master access server on %s", path);
+  return 0;
+
+ fail:
+  mserver_close ();
+  return -1;
+}
+
+void mserver_close (void)
+{
+  list_t *cur, *n;
+
+  if (srv.kfd < 0)
+    return;
+  ll_for_each_safe (cur, n, &srv.clients)
+    client_close (ll_entry (cur, client_t, list));
+  if (srv.lfd >= 0) {
+    evloop_del (srv.lfd);
+    close (srv.lfd);
+  }
+  evloop_del (srv.kfd);
+  close (srv.kfd);
+  if (srv.path) {
+    unlink (srv.path);
+    free (srv.path);
+  }
+  srv.lfd = srv.kfd = -1;
+  srv.path = NULL;
+  srv.kicked = false;
+}
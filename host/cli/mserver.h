@@ -0,0 +1,18 @@
+/**
+ *  Master access server. Shares the device link with local client processes
+ *  over a Unix socket. Served from the main event loop.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#ifndef MSERVER_H
+#define MSERVER_H
+
+// Listen on Unix socket path
+int mserver_open (const char *path);
+
+// Drop clients and stop listening
+void mserver_close (void);
+
+#endif /* MSERVER_H */
@@ -53,6 +53,9 @@ static int pcnt;
 // Pointer to target
 Target *target;
 
+// Slave packet recording
+static FILE *record;
+
 static void *plugin_open (const char *name)
 {
   int i;
@@ -160,14 +163,8 @@ void *plugin_load (const char *name, const char *args, plugin_type_t *type)
   return NULL;
 }
 
-static void plugin_handler (uint8_t *buf, int len)
+void plugin_decode (const uint8_t *buf, int len, slave_trans_t *t)
 {
-  int i, rv;
-  uint8_t size;
-  uint32_t base, addr, data, mask;
-  bool write;
-  uint8_t resp[5];
-      
   // Override any reads from 0xFFFFFFFx
   /*
   if (((trans.type & 4) == 0) &&
@@ -181,16 +178,17 @@ static void plugin_handler (uint8_t *buf, int len)
       
   // Get transaction type
   if (buf[0] & WRITE)
-    write = true;
+    t->write = true;
   else
-    write = false;
+    t->write = false;
   
   // Get size
-  size = buf[0] & 3;
+  t->size = buf[0] & 3;
+  t->status = SUCCESS;
   
   // Verify length
-  if (write) {
-    switch (size) {
+  if (t->write) {
+    switch (t->size) {
       case SZ_BYTE:
         if (len != 6)
           err ("Invalid len=%d", len);
@@ -206,21 +204,21 @@ static void plugin_handler (uint8_t *buf, int len)
     }
 
     // Parse address
-    addr = ntohl (*((uint32_t *)&buf[1]));
+    t->addr = ntohl (*((uint32_t *)&buf[1]));
 
     // Parse data
-    switch (size) {
+    switch (t->size) {
       case SZ_BYTE:
-        data = buf[5] << (8 * (addr & 3));
-        mask = 0xff << 8 * (addr & 3);
+        t->data = buf[5] << (8 * (t->addr & 3));
+        t->mask = 0xff << 8 * (t->addr & 3);
         break;
       case SZ_HWRD:
-        data = ntohs (*((uint16_t *)&buf[5])) << (8 * (addr & 3));
-        mask = 0xffff << 8 * (addr & 3);
+        t->data = ntohs (*((uint16_t *)&buf[5])) << (8 * (t->addr & 3));
+        t->mask = 0xffff << 8 * (t->addr & 3);
         break;
       case SZ_WORD:
-        data = ntohl (*((uint32_t *)&buf[5]));
-        mask = 0xffffffff;
+        t->data = ntohl (*((uint32_t *)&buf[5]));
+        t->mask = 0xffffffff;
         break;
     }
   }
@@ -229,76 +227,110 @@ static void plugin_handler (uint8_t *buf, int len)
       err ("Invalid len=%d", len);
 
     // Parse address
-    addr = ntohl (*((uint32_t *)&buf[1]));
+    t->addr = ntohl (*((uint32_t *)&buf[1]));
   }
+}
+
+void plugin_dispatch (slave_trans_t *t)
+{
+  int i;
+  uint32_t base;
 
   // Transaction trace
   log (LOG_TRACE, "[%c%c] %08X",
-       write ? 'W' : 'R',
-       size == SZ_BYTE ? 'B' :
-       (size == SZ_HWRD ? 'H' : 'W'),
-       addr);
+       t->write ? 'W' : 'R',
+       t->size == SZ_BYTE ? 'B' :
+       (t->size == SZ_HWRD ? 'H' : 'W'),
+       t->addr);
   
   // Find matching plugin
   for (i = 0; i < pcnt; i++) {
     base = plugin[i]->Base();
     
     // Check for match
-    if ((addr >= base) &&
-        (addr < base + plugin[i]->Size()))
+    if ((t->addr >= base) &&
+        (t->addr < base + plugin[i]->Size()))
       break;
   }    
 
   // Check if not found
   if (i == pcnt) {
-    log (LOG_ERR, "Err: Unmatched addr: 0x%08X", addr);
-    resp[0] = (write << 3) | FAIL;
-    target->SlaveSend (resp, 1);
+    log (LOG_ERR, "Err: Unmatched addr: 0x%08X", t->addr);
+    t->status = FAIL;
     return;
   }
 
-  // Send to slave
-  if (write) {
-
-    // Dispatch to plugin
-    plugin[i]->WriteW ((addr & ~3) - base, data, mask);
-
-    // Send success
-    resp[0] = SUCCESS;
-    target->SlaveSend (resp, 1);
-  }
+  // Dispatch to plugin
+  if (t->write)
+    plugin[i]->WriteW ((t->addr & ~3) - base, t->data, t->mask);
   else {
-    switch (size) {
+    switch (t->size) {
       case SZ_BYTE:
-        // Dispatch to plugin
-        resp[1] = plugin[i]->ReadB (addr - base);
-
-        // Send response
-        resp[0] = READ_BYTE | SUCCESS;
-        target->SlaveSend (resp, 2);
+        t->data = plugin[i]->ReadB (t->addr - base);
         break;
-        
       case SZ_HWRD:
-        // Dispatch to plugin
-        *((uint16_t *)&resp[1]) = htons (plugin[i]->ReadH (addr - base));
-
-        // Send response
-        resp[0] = READ_HWRD | SUCCESS;
-        target->SlaveSend (resp, 3);
+        t->data = plugin[i]->ReadH (t->addr - base);
         break;
-
       case SZ_WORD:
-        // Dispatch to plugin
-        *((uint32_t *)&resp[1]) = htonl (plugin[i]->ReadW (addr - base));
-
-        // Send response
-        resp[0] = READ_WORD | SUCCESS;
-        target->SlaveSend (resp, 5);
+        t->data = plugin[i]->ReadW (t->addr - base);
         break;
     }
   }
 }
 
+int plugin_encode (const slave_trans_t *t, uint8_t *resp)
+{
+  // Failed to dispatch
+  if (t->status != SUCCESS) {
+    resp[0] = (t->write << 3) | FAIL;
+    return 1;
+  }
+
+  // Write success
+  if (t->write) {
+    resp[0] = SUCCESS;
+    return 1;
+  }
+
+  // Read data
+  switch (t->size) {
+    case SZ_BYTE:
+      resp[0] = READ_BYTE | SUCCESS;
+      resp[1] = t->data;
+      return 2;
+    case SZ_HWRD:
+      resp[0] = READ_HWRD | SUCCESS;
+      *((uint16_t *)&resp[1]) = htons (t->data);
+      return 3;
+    default:
+      resp[0] = READ_WORD | SUCCESS;
+      *((uint32_t *)&resp[1]) = htonl (t->data);
+      return 5;
+  }
+}
+
+static void plugin_handler (uint8_t *buf, int len)
+{
+  slave_trans_t t;
+  uint8_t resp[5];
+
+  // Save raw packet for dispatch-bench
+  if (record)
+    fwrite (buf, 1, len, record);
+
+  // Decode, service and reply
+  plugin_decode (buf, len, &t);
+  plugin_dispatch (&t);
+  target->SlaveSend (resp, plugin_encode (&t, resp));
+}
+
+void plugin_record (const char *file)
+{
+  record = fopen (file, "wb");
+  if (!record)
+    err ("Failed to open: %s", file);
+}
+
 void plugin_init (Target *targ, char *sysmap, char **path, int cnt)
 {
   int rv;
@@ -318,6 +350,10 @@ void plugin_init (Target *targ, char *sysmap, char **path, int cnt)
   if (rv)
     err ("Failed to parse sysmap: %s", sysmap);
 
+  // Load only - no device attached
+  if (!target)
+    return;
+
   if (pcnt >= 1) {
     // Install slave callback
     target->SlaveRegister (&plugin_handler);
@@ -329,12 +365,28 @@ void plugin_init (Target *targ, char *sysmap, char **path, int cnt)
 
 void plugin_cleanup (void)
 {
+  int i;
+
   // Disable slave
-  if (pcnt) {
+  if (pcnt && target) {
     target->SlaveEn (false);
     target->SlaveUnregister ();
   }
 
+  // Release plugins while the link is still up so they can finish
+  // any background work
+  for (i = 0; i < pcnt; i++)
+    delete plugin[i];
+  free (plugin);
+  plugin = NULL;
+  pcnt = 0;
+
+  // Close recording
+  if (record) {
+    fclose (record);
+    record = NULL;
+  }
+
   // Cleanup sysmap parser
   sysmap_cleanup ();
 }
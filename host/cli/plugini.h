@@ -14,9 +14,28 @@
 #include "plugin.h"
 #include "Target.h"
 
+// Decoded slave transaction
+typedef struct {
+  uint32_t addr;
+  uint32_t data;     // Write data or read result
+  uint32_t mask;     // Write byte lanes
+  uint8_t  size;     // 0=byte 1=hword 2=word
+  bool     write;
+  uint8_t  status;   // 0=success 1=fail
+} slave_trans_t;
+
 // Init plugin interface - pass search path
+// NULL target loads the sysmap plugins without a device (benchmarking)
 void plugin_init (Target *target, char *sysmap, char **path, int cnt);
 
+// Slave packet handling stages - exposed for dispatch-bench
+void plugin_decode (const uint8_t *buf, int len, slave_trans_t *t);
+void plugin_dispatch (slave_trans_t *t);
+int plugin_encode (const slave_trans_t *t, uint8_t *resp);
+
+// Record raw slave packets to file
+void plugin_record (const char *file);
+
 // Load plugin
 void *plugin_load (const char *name, const char *args, plugin_type_t *type);
 
@@ -0,0 +1,141 @@
+/**
+ *  Collect on-target benchmark results. Firmware measures access cost with
+ *  the DWT cycle counter and posts one row per benchmark:
+ *
+ *    0x00 LABEL  W: Address of NUL terminated label in target memory
+ *    0x04 WIDTH  W: Access width in bytes
+ *    0x08 CNT    W: Samples taken
+ *    0x0C MIN    W: Min cycles per access
+ *    0x10 MAX    W: Max cycles per access
+ *    0x14 SUM    W: Total cycles over all samples
+ *    0x18 POST   W: Emit row
+ *    0x1C DIV    R/W: Remote bridge clock divisor
+ *    0x20 REMOTE R: Remote bridge base (0 if bridge disabled)
+ *
+ *  Rows are logged and optionally appended to a CSV file (csv=path).
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "BusPeripheral.h"
+#include "plugin.h"
+
+#define LABEL_MAX  32
+
+// Register offsets
+#define REG_LABEL   0x00
+#define REG_WIDTH   0x04
+#define REG_CNT     0x08
+#define REG_MIN     0x0C
+#define REG_MAX     0x10
+#define REG_SUM     0x14
+#define REG_POST    0x18
+#define REG_DIV     0x1C
+#define REG_REMOTE  0x20
+
+class BenchResults : public BusPeripheral {
+ private:
+  uint32_t label, width, cnt, min, max, sum;
+  FILE *csv = NULL;
+  void Post (void);
+
+ public:
+  BenchResults (const char *args);
+  ~BenchResults ();
+  const char *Name (void) { return "BenchResults"; }
+  uint32_t ReadW (uint32_t addr);
+  void WriteW (uint32_t addr, uint32_t data, uint32_t mask);
+};
+
+// Export plugin
+PLUGIN (BUSPERIPH, BenchResults, "v0.0.1");
+
+BenchResults::BenchResults (const char *args)
+  : BusPeripheral (args)
+{
+  const char *path;
+  char *fname;
+  int len;
+
+  // Register space
+  size = 0x24;
+
+  // Optional CSV output
+  if (!plugin_parse_str (args, "csv=", &path, &len)) {
+    fname = strndup (path, len);
+    csv = fopen (fname, "w");
+    free (fname);
+    if (csv)
+      fprintf (csv, "label,width,cnt,min,max,mean,remote_div\n");
+  }
+}
+
+BenchResults::~BenchResults ()
+{
+  if (csv)
+    fclose (csv);
+}
+
+void BenchResults::Post (void)
+{
+  int i;
+  char name[LABEL_MAX + 1];
+  uint32_t addr, val = 0;
+  double mean;
+
+  // Fetch label from target memory
+  for (i = 0; i < LABEL_MAX; i++) {
+    addr = label + i;
+    if ((i == 0) || ((addr & 3) == 0))
+      val = target->ReadW (addr & ~3);
+    name[i] = (val >> ((addr & 3) * 8)) & 0xff;
+    if (!name[i])
+      break;
+  }
+  name[i] = '\0';
+
+  // Report row
+  mean = cnt ? (double)sum / cnt : 0;
+  target->Log (LOG_NORMAL, "  %-24s w=%u n=%-4u min=%-5u max=%-5u mean=%.2f cycles",
+               name, width, cnt, min, max, mean);
+  if (csv) {
+    fprintf (csv, "%s,%u,%u,%u,%u,%.2f,%u\n", name, width, cnt, min, max, mean,
+             target->RemoteClkDiv ());
+    fflush (csv);
+  }
+}
+
+uint32_t BenchResults::ReadW (uint32_t addr)
+{
+  switch (addr) {
+    case REG_DIV:
+      return target->RemoteClkDiv ();
+    case REG_REMOTE:
+      return target->RemoteAHBEn () ? target->RemoteBase () : 0;
+    default:
+      return 0;
+  }
+}
+
+void BenchResults::WriteW (uint32_t addr, uint32_t data, uint32_t mask)
+{
+  switch (addr) {
+    case REG_LABEL: label = data; break;
+    case REG_WIDTH: width = data; break;
+    case REG_CNT:   cnt = data;   break;
+    case REG_MIN:   min = data;   break;
+    case REG_MAX:   max = data;   break;
+    case REG_SUM:   sum = data;   break;
+    case REG_POST:  Post ();      break;
+    case REG_DIV:
+      target->RemoteClkDiv (data);
+      target->Log (LOG_NORMAL, "  remote clkdiv=%u", data & 0x1f);
+      break;
+  }
+}
@@ -0,0 +1,259 @@
+/**
+ *  High throughput firmware log channel. Firmware writes bytes into a ring in
+ *  its own RAM (see test/arm/stream.h) and rings a doorbell here. A drain
+ *  thread pulls new bytes with pipelined master reads and publishes the
+ *  consumed tail back to the ring, so the CPU only pays one slave round trip
+ *  per doorbell instead of one per store.
+ *
+ *    0x00 RING   W: Address of ring in target memory (resets channel)
+ *    0x04 HEAD   W: Doorbell - bytes up to head are ready, drained in background
+ *    0x08 FLUSH  W: Doorbell and wait until drained
+ *    0x0C COUNT  R: Total bytes drained
+ *
+ *  Ring layout in target memory:
+ *    0x00 head   Free running write count (firmware)
+ *    0x04 tail   Free running read count (host)
+ *    0x08 size   Data bytes, power of two
+ *    0x0C data[size]
+ *
+ *  Output is logged line by line, or written raw to a file (file=path).
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "BusPeripheral.h"
+#include "plugin.h"
+
+// Register offsets
+#define REG_RING    0x00
+#define REG_HEAD    0x04
+#define REG_FLUSH   0x08
+#define REG_COUNT   0x0C
+
+// Ring offsets
+#define RING_TAIL   0x04
+#define RING_SIZE   0x08
+#define RING_DATA   0x0C
+
+// Largest ring accepted
+#define RING_MAX    (64 * 1024)
+
+// Longest logged line
+#define LINE_MAX    256
+
+class Stream : public BusPeripheral {
+ private:
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t ready, drained;
+  bool running;
+  uint32_t ring, rsize;
+  uint32_t head, tail, count;
+  uint8_t *buf;
+  char line[LINE_MAX + 1];
+  int lcnt;
+  FILE *out = NULL;
+  static void *Drain (void *arg);
+  void Emit (const uint8_t *data, uint32_t len);
+  void Doorbell (uint32_t data, bool wait);
+
+ public:
+  Stream (const char *args);
+  ~Stream ();
+  const char *Name (void) { return "Stream"; }
+  uint32_t ReadW (uint32_t addr);
+  void WriteW (uint32_t addr, uint32_t data, uint32_t mask);
+};
+
+// Export plugin
+PLUGIN (BUSPERIPH, Stream, "v0.0.1");
+
+Stream::Stream (const char *args)
+  : BusPeripheral (args)
+{
+  const char *path;
+  char *fname;
+  int len;
+
+  // Register space
+  size = 0x10;
+  ring = rsize = 0;
+  head = tail = count = 0;
+  lcnt = 0;
+
+  // Optional raw output
+  if (!plugin_parse_str (args, "file=", &path, &len)) {
+    fname = strndup (path, len);
+    out = fopen (fname, "wb");
+    free (fname);
+  }
+
+  // Start drain thread
+  buf = (uint8_t *)malloc (RING_MAX);
+  pthread_mutex_init (&lock, NULL);
+  pthread_cond_init (&ready, NULL);
+  pthread_cond_init (&drained, NULL);
+  running = true;
+  if (pthread_create (&thread, NULL, &Stream::Drain, this))
+    running = false;
+}
+
+Stream::~Stream ()
+{
+  // Drain what is left and stop
+  if (running) {
+    pthread_mutex_lock (&lock);
+    running = false;
+    pthread_cond_signal (&ready);
+    pthread_mutex_unlock (&lock);
+    pthread_join (thread, NULL);
+  }
+
+  // Flush partial line
+  if (lcnt)
+    Emit ((const uint8_t *)"\n", 1);
+  if (out)
+    fclose (out);
+  pthread_cond_destroy (&drained);
+  pthread_cond_destroy (&ready);
+  pthread_mutex_destroy (&lock);
+  free (buf);
+}
+
+void Stream::Emit (const uint8_t *data, uint32_t len)
+{
+  uint32_t i;
+
+  if (out) {
+    fwrite (data, 1, len, out);
+    fflush (out);
+    return;
+  }
+
+  // Log complete lines
+  for (i = 0; i < len; i++) {
+    if ((data[i] == '\n') || (lcnt == LINE_MAX)) {
+      line[lcnt] = '\0';
+      target->Log (LOG_NORMAL, "%s", line);
+      lcnt = 0;
+      if (data[i] == '\n')
+        continue;
+    }
+    if (data[i] != '\r')
+      line[lcnt++] = data[i];
+  }
+}
+
+void *Stream::Drain (void *arg)
+{
+  Stream *s = (Stream *)arg;
+  uint32_t h, t, addr, off, n, first;
+
+  pthread_mutex_lock (&s->lock);
+  while (true) {
+
+    // Wait for doorbell
+    while (s->running && (s->head == s->tail))
+      pthread_cond_wait (&s->ready, &s->lock);
+    if (s->head == s->tail)
+      break;
+    h = s->head;
+    t = s->tail;
+    addr = s->ring;
+    pthread_mutex_unlock (&s->lock);
+
+    // Pull [tail, head) - split at wrap
+    n = h - t;
+    off = t & (s->rsize - 1);
+    first = (off + n > s->rsize) ? s->rsize - off : n;
+    s->target->MemcpyFrom (s->buf, addr + RING_DATA + off, first);
+    if (first < n)
+      s->target->MemcpyFrom (s->buf + first, addr + RING_DATA, n - first);
+    s->Emit (s->buf, n);
+
+    // Release space to firmware
+    s->target->WriteW (addr + RING_TAIL, h, 0xffffffff);
+
+    pthread_mutex_lock (&s->lock);
+    s->tail = h;
+    s->count += n;
+    pthread_cond_broadcast (&s->drained);
+  }
+  pthread_mutex_unlock (&s->lock);
+  return NULL;
+}
+
+void Stream::Doorbell (uint32_t data, bool wait)
+{
+  pthread_mutex_lock (&lock);
+
+  // Ignore until ring is set up, or if firmware overran the ring
+  if (!rsize || !running || (data - tail > rsize)) {
+    if (rsize && running)
+      target->Log (LOG_ERR, "Stream: bad head %08X (tail=%08X)", data, tail);
+    pthread_mutex_unlock (&lock);
+    return;
+  }
+  head = data;
+  pthread_cond_signal (&ready);
+
+  // Hold the bus cycle until everything up to head is out
+  if (wait)
+    while (running && (tail != head))
+      pthread_cond_wait (&drained, &lock);
+  pthread_mutex_unlock (&lock);
+}
+
+uint32_t Stream::ReadW (uint32_t addr)
+{
+  uint32_t val = 0;
+
+  switch (addr) {
+    case REG_RING:
+      return ring;
+    case REG_HEAD:
+      pthread_mutex_lock (&lock);
+      val = head;
+      pthread_mutex_unlock (&lock);
+      return val;
+    case REG_COUNT:
+      pthread_mutex_lock (&lock);
+      val = count;
+      pthread_mutex_unlock (&lock);
+      return val;
+    default:
+      return 0;
+  }
+}
+
+void Stream::WriteW (uint32_t addr, uint32_t data, uint32_t mask)
+{
+  uint32_t sz;
+
+  switch (addr) {
+    case REG_RING:
+
+      // Wait for outstanding drain against old ring
+      Doorbell (head, true);
+      sz = data ? target->ReadW (data + RING_SIZE) : 0;
+      if (data && (!sz || (sz & (sz - 1)) || (sz > RING_MAX))) {
+        target->Log (LOG_ERR, "Stream: invalid ring size %u @ %08X", sz, data);
+        sz = 0;
+      }
+      pthread_mutex_lock (&lock);
+      ring = sz ? data : 0;
+      rsize = sz;
+      head = tail = count = 0;
+      pthread_mutex_unlock (&lock);
+      break;
+    case REG_HEAD:  Doorbell (data, false); break;
+    case REG_FLUSH: Doorbell (data, true);  break;
+  }
+}
@@ -0,0 +1,404 @@
+/**
+ *  Statistical PC sampling profiler.
+ *
+ *  Each tick reads DWT_PCSR back to back in one batched stream:
+ *    - remote core: queued AP reads through the SWD bridge (TAR written
+ *      once, CSW without auto-increment so every read samples PCSR)
+ *    - local core: vectored master reads of the PCSR address
+ *  PCSR reads 0xFFFFFFFF while the core is halted or held in reset.
+ *
+ *  Without a fixed rate the batch is sized so sampling takes about half of
+ *  every tick, leaving the loop to other services. Samples are counted per
+ *  address and symbolized against the ELF symbol table on close:
+ *    out.flat    - gprof style flat profile
+ *    out.folded  - function;address count (flamegraph.pl input)
+ *    out.perf    - perf report style overhead table with hot addresses
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <elf.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "profile.h"
+#include "evloop.h"
+#include "Target.h"
+#include "log.h"
+
+// Sample batching
+#define TICK_MS       1
+#define BATCH_MIN     8
+#define BATCH_MAX     1024
+
+// Report limits
+#define HOT_SYMS      10
+#define HOT_ADDRS     8
+
+// Debug registers
+#define DWT_PCSR      0xE000101C
+#define SCB_DEMCR     0xE000EDFC
+#define TRCENA        (1 << 24)
+#define PC_HALTED     0xFFFFFFFF
+
+// AP registers
+#define AP_CSW        0x0
+#define AP_TAR        0x4
+#define AP_DRW        0xc
+#define CSW_WORD      0xA2000002
+
+// Pseudo symbols
+#define SYM_UNKNOWN   -1
+#define SYM_HALTED    -2
+
+typedef struct {
+  uint32_t addr;
+  uint32_t size;
+  const char *name;   // Into ELF image
+} sym_t;
+
+typedef struct {
+  int sym;
+  uint64_t cnt;
+} hot_t;
+
+static struct {
+  Target  *targ;
+  bool     active;
+  int      timer;
+  uint32_t pcsr;      // 0 = remote core
+  int      batch;     // Samples per tick
+  bool     fixed;     // Batch set by rate
+  uint64_t start;     // us
+  uint64_t samples;
+  uint64_t errors;
+  char    *out;
+  uint8_t *elf;
+  std::vector<sym_t> syms;
+  std::unordered_map<uint32_t, uint64_t> hist;
+  std::vector<remote_xfer_t> xfer;
+  std::vector<flexsoc_vec_t> vec;
+} prof;
+
+static uint64_t now_us (void)
+{
+  timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+//
+// Symbols
+//
+static int elf_load (const char *path)
+{
+  FILE *fp;
+  long size;
+  int i, j, cnt;
+  Elf32_Ehdr *eh;
+  Elf32_Shdr *sh;
+  Elf32_Sym *st;
+  const char *str;
+
+  // Read whole image - names point into it
+  fp = fopen (path, "rb");
+  if (!fp)
+    return -1;
+  fseek (fp, 0, SEEK_END);
+  size = ftell (fp);
+  fseek (fp, 0, SEEK_SET);
+  prof.elf = (uint8_t *)malloc (size);
+  if (!prof.elf || (fread (prof.elf, 1, size, fp) != (size_t)size)) {
+    fclose (fp);
+    return -1;
+  }
+  fclose (fp);
+
+  // Validate headers
+  eh = (Elf32_Ehdr *)prof.elf;
+  if ((size < (long)sizeof (*eh)) || memcmp (eh->e_ident, ELFMAG, SELFMAG) ||
+      (eh->e_ident[EI_CLASS] != ELFCLASS32) ||
+      ((uint64_t)eh->e_shoff + (uint64_t)eh->e_shnum * sizeof (*sh) > (uint64_t)size))
+    return -1;
+  sh = (Elf32_Shdr *)(prof.elf + eh->e_shoff);
+
+  // Collect functions from symbol tables
+  for (i = 0; i < eh->e_shnum; i++) {
+    if ((sh[i].sh_type != SHT_SYMTAB) || (sh[i].sh_link >= eh->e_shnum) ||
+        ((uint64_t)sh[i].sh_offset + sh[i].sh_size > (uint64_t)size) ||
+        ((uint64_t)sh[sh[i].sh_link].sh_offset + sh[sh[i].sh_link].sh_size > (uint64_t)size))
+      continue;
+    st = (Elf32_Sym *)(prof.elf + sh[i].sh_offset);
+    str = (const char *)prof.elf + sh[sh[i].sh_link].sh_offset;
+    cnt = sh[i].sh_size / sizeof (*st);
+    for (j = 0; j < cnt; j++) {
+      if ((ELF32_ST_TYPE (st[j].st_info) != STT_FUNC) ||
+          (st[j].st_shndx == SHN_UNDEF) ||
+          (st[j].st_name >= sh[sh[i].sh_link].sh_size))
+        continue;
+
+      // Drop thumb bit
+      prof.syms.push_back ({st[j].st_value & ~1U, st[j].st_size, str + st[j].st_name});
+    }
+  }
+
+  // Sort and give sizeless symbols the gap to the next one
+  std::sort (prof.syms.begin (), prof.syms.end (),
+             [](const sym_t &a, const sym_t &b) { return a.addr < b.addr; });
+  for (i = 0; i < (int)prof.syms.size (); i++)
+    if (!prof.syms[i].size && (i + 1 < (int)prof.syms.size ()))
+      prof.syms[i].size = prof.syms[i + 1].addr - prof.syms[i].addr;
+  return 0;
+}
+
+static int sym_find (uint32_t pc)
+{
+  int lo = 0, hi = prof.syms.size (), mid;
+
+  if (pc == PC_HALTED)
+    return SYM_HALTED;
+
+  // Last symbol at or below pc
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (prof.syms[mid].addr <= pc)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo && (pc - prof.syms[lo - 1].addr < prof.syms[lo - 1].size))
+    return lo - 1;
+  return SYM_UNKNOWN;
+}
+
+static const char *sym_name (int sym)
+{
+  if (sym == SYM_HALTED)
+    return "[halted]";
+  if (sym == SYM_UNKNOWN)
+    return "[unknown]";
+  return prof.syms[sym].name;
+}
+
+//
+// Sampling
+//
+static void tick_cb (int fd, void *arg)
+{
+  uint64_t t = now_us ();
+  int i, n;
+
+  // Local core - vectored master reads
+  if (prof.pcsr) {
+    prof.vec.assign (prof.batch, {prof.pcsr, 0, false});
+    if (flexsoc_ctx_vec (prof.targ->Ctx (), prof.vec.data (), prof.batch)) {
+      prof.errors++;
+      return;
+    }
+    for (i = 0; i < prof.batch; i++)
+      prof.hist[prof.vec[i].data]++;
+    prof.samples += prof.batch;
+  }
+  // Remote core - queued AP reads
+  else {
+    prof.xfer.resize (prof.batch + 2);
+    prof.xfer[0] = {REMOTE_AP | REMOTE_WR | AP_CSW, CSW_WORD};
+    prof.xfer[1] = {REMOTE_AP | REMOTE_WR | AP_TAR, DWT_PCSR};
+    for (i = 0; i < prof.batch; i++)
+      prof.xfer[i + 2] = {REMOTE_AP | REMOTE_RD | AP_DRW};
+    n = prof.targ->RemoteTransfer (prof.xfer.data (), prof.batch + 2);
+    if (n < prof.batch + 2)
+      prof.errors++;
+    for (i = 2; i < n; i++)
+      prof.hist[prof.xfer[i].data]++;
+    if (n > 2)
+      prof.samples += n - 2;
+  }
+
+  // Size batch to about half a tick
+  if (!prof.fixed) {
+    t = now_us () - t;
+    if ((t < TICK_MS * 500) && (prof.batch < BATCH_MAX))
+      prof.batch *= 2;
+    else if ((t > TICK_MS * 1000) && (prof.batch > BATCH_MIN))
+      prof.batch /= 2;
+  }
+}
+
+int profile_open (const char *elf, const char *out, uint32_t rate, uint32_t pcsr)
+{
+  uint32_t ms = TICK_MS, demcr;
+
+  prof.targ = Target::Ptr ();
+  prof.pcsr = pcsr;
+  if (elf_load (elf)) {
+    log (LOG_ERR, "Failed to read symbols: %s", elf);
+    free (prof.elf);
+    prof.elf = NULL;
+    return -1;
+  }
+  prof.out = strdup (out);
+
+  // Fixed rate - spread samples over ticks
+  prof.fixed = (rate != 0);
+  if (!rate)
+    prof.batch = BATCH_MIN;
+  else if (rate >= 1000 / TICK_MS)
+    prof.batch = std::min (rate * TICK_MS / 1000, (uint32_t)BATCH_MAX);
+  else {
+    prof.batch = 1;
+    ms = 1000 / rate;
+  }
+
+  // DWT needs trace enabled
+  if (pcsr) {
+    demcr = prof.targ->ReadReg (pcsr - DWT_PCSR + SCB_DEMCR);
+    prof.targ->WriteReg (pcsr - DWT_PCSR + SCB_DEMCR, demcr | TRCENA);
+  }
+  else {
+    demcr = prof.targ->RemoteReadW (SCB_DEMCR);
+    prof.targ->RemoteWriteW (SCB_DEMCR, demcr | TRCENA);
+  }
+
+  prof.timer = evloop_timer (ms, true, tick_cb, NULL);
+  if (prof.timer < 0) {
+    free (prof.out);
+    return -1;
+  }
+  prof.start = now_us ();
+  prof.active = true;
+  log (LOG_NORMAL, "Profiling %s core: %d symbols from %s",
+       pcsr ? "local" : "remote", (int)prof.syms.size (), elf);
+  return 0;
+}
+
+//
+// Reports
+//
+static FILE *report_open (const char *ext)
+{
+  FILE *fp;
+  char *path = (char *)malloc (strlen (prof.out) + strlen (ext) + 1);
+
+  if (!path)
+    return NULL;
+  sprintf (path, "%s%s", prof.out, ext);
+  fp = fopen (path, "w");
+  if (!fp)
+    log (LOG_ERR, "Failed to write %s", path);
+  free (path);
+  return fp;
+}
+
+static void report_write (double secs)
+{
+  FILE *fp;
+  double pct, cum = 0;
+  std::unordered_map<int, uint64_t> per_sym;
+  std::vector<hot_t> hot;
+  std::vector<std::pair<uint32_t, uint64_t>> pcs (prof.hist.begin (), prof.hist.end ());
+  int i, j, n;
+
+  if (!prof.samples)
+    return;
+
+  // Fold addresses into symbols
+  for (auto &pc : pcs)
+    per_sym[sym_find (pc.first)] += pc.second;
+  for (auto &s : per_sym)
+    hot.push_back ({s.first, s.second});
+  std::sort (hot.begin (), hot.end (),
+             [](const hot_t &a, const hot_t &b) { return a.cnt > b.cnt; });
+
+  // Addresses in order - groups them by symbol
+  std::sort (pcs.begin (), pcs.end ());
+
+  // Flat profile
+  if ((fp = report_open (".flat"))) {
+    fprintf (fp, "Flat profile: %llu samples in %.3f s (%.0f Hz)\n\n",
+             (unsigned long long)prof.samples, secs, prof.samples / secs);
+    fprintf (fp, "  %%time  cumulative     samples  name\n");
+    for (auto &h : hot) {
+      pct = 100.0 * h.cnt / prof.samples;
+      cum += pct;
+      fprintf (fp, " %6.2f      %6.2f  %10llu  %s\n", pct, cum,
+               (unsigned long long)h.cnt, sym_name (h.sym));
+    }
+    fclose (fp);
+  }
+
+  // Folded stacks - one frame plus address
+  if ((fp = report_open (".folded"))) {
+    for (auto &pc : pcs) {
+      if (pc.first == PC_HALTED)
+        fprintf (fp, "[halted] %llu\n", (unsigned long long)pc.second);
+      else
+        fprintf (fp, "%s;0x%08x %llu\n", sym_name (sym_find (pc.first)), pc.first,
+                 (unsigned long long)pc.second);
+    }
+    fclose (fp);
+  }
+
+  // Perf style report
+  if ((fp = report_open (".perf"))) {
+    fprintf (fp, "# Samples: %llu of event 'pcsr'\n", (unsigned long long)prof.samples);
+    fprintf (fp, "# Duration: %.3f s (%.0f Hz)\n", secs, prof.samples / secs);
+    if (prof.errors)
+      fprintf (fp, "# Failed batches: %llu\n", (unsigned long long)prof.errors);
+    fprintf (fp, "#\n# Overhead  Samples  Symbol\n# ........  .......  ......\n#\n");
+    for (auto &h : hot)
+      fprintf (fp, "  %7.2f%%  %7llu  [.] %s\n", 100.0 * h.cnt / prof.samples,
+               (unsigned long long)h.cnt, sym_name (h.sym));
+
+    // Hot addresses of hottest symbols
+    for (i = 0; (i < (int)hot.size ()) && (i < HOT_SYMS); i++) {
+      std::vector<std::pair<uint64_t, uint32_t>> addrs;
+
+      if (hot[i].sym < 0)
+        continue;
+      for (auto &pc : pcs)
+        if (sym_find (pc.first) == hot[i].sym)
+          addrs.push_back ({pc.second, pc.first});
+      std::sort (addrs.rbegin (), addrs.rend ());
+      fprintf (fp, "\n# %s\n", sym_name (hot[i].sym));
+      n = std::min ((int)addrs.size (), HOT_ADDRS);
+      for (j = 0; j < n; j++)
+        fprintf (fp, "  %7.2f%%  %7llu  0x%08x  %s+0x%x\n",
+                 100.0 * addrs[j].first / hot[i].cnt, (unsigned long long)addrs[j].first,
+                 addrs[j].second, sym_name (hot[i].sym),
+                 addrs[j].second - prof.syms[hot[i].sym].addr);
+    }
+    fclose (fp);
+  }
+}
+
+void profile_close (void)
+{
+  double secs;
+
+  if (!prof.active)
+    return;
+  evloop_del (prof.timer);
+  prof.active = false;
+
+  secs = (now_us () - prof.start) / 1e6;
+  log (LOG_NORMAL, "Profile: %llu samples in %.3f s (%.0f Hz) -> %s.{flat,folded,perf}",
+       (unsigned long long)prof.samples, secs, prof.samples / secs, prof.out);
+  if (prof.errors)
+    log (LOG_ERR, "Profile: %llu sample batches failed", (unsigned long long)prof.errors);
+  report_write (secs);
+
+  // Release
+  free (prof.out);
+  free (prof.elf);
+  prof.elf = NULL;
+  prof.syms.clear ();
+  prof.hist.clear ();
+}
@@ -0,0 +1,21 @@
+/**
+ *  Statistical PC sampling profiler. Reads DWT_PCSR of the running core from
+ *  the main event loop and writes symbolized reports on close.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+// Start sampling at rate Hz (0 = as fast as the link sustains)
+// pcsr = DWT_PCSR address on master bus, 0 samples remote core through bridge
+int profile_open (const char *elf, const char *out, uint32_t rate, uint32_t pcsr);
+
+// Stop sampling and write out.flat, out.folded and out.perf
+void profile_close (void);
+
+#endif /* PROFILE_H */
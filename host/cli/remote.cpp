@@ -5,6 +5,7 @@
  *  Tiny Labs Inc
  *  2020
  */
+#include <time.h>
 #include <unistd.h>
 
 #include "Target.h"
@@ -19,9 +20,12 @@
 
 // Address to halt
 #define SCB_DHCSR    0xE000EDF0
+#define S_HALT       (1 << 17)
 
 // DP regs
+#define DP_IDCODE   0
 #define DP_CTLSTAT  4
+#define DP_SELECT   8
 
 // AP Regs
 #define AP_CSW   0
@@ -29,6 +33,18 @@
 #define AP_DRW   0xc
 #define AP_IDR   0xfc
 
+// Slowest clock divisor
+#define DIV_MAX  31
+
+// Time for bridge to read IDCODE after enable
+#define LINK_UP_MS    10
+
+// DP reads checked before a divisor is accepted
+#define STABLE_READS  8
+
+// APs probed per batch
+#define AP_BATCH  8
+
 static const char *jedec_manufacturer (uint8_t id)
 {
   switch (id) {
@@ -57,52 +73,98 @@ static const char *ap_idcode (uint8_t id)
   }
 }
 
-int remote_open (uint8_t div, bool halt)
+static uint64_t now_ms (void)
 {
-  uint32_t idcode;
-  uint8_t stat, apsel = 255;
-  int timeout = 100, i, n;
-  float freqMHz;
-  
-  // Get target pointer
-  Target *targ = Target::Ptr ();
+  timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
- retry_connect:
-  if (div > 31) {
-    log (LOG_ERR, "Remote connect failed");
-    return -1;
-  }
-  
-  // Calculate frequency
-  freqMHz = (float)(targ->CoreFreq() / ((div + 1) * 2)) / 1000000;
+// Link up at divisor and verify DP reads are stable
+static bool link_try (Target *targ, uint8_t div, uint32_t *idcode)
+{
+  int i;
+  uint64_t end;
+  remote_xfer_t xfer[STABLE_READS];
 
-  // Set clock divisor
+  // Re-enable at new clock
+  targ->RemoteEn (false);
   targ->RemoteClkDiv (div);
-  
-  // Enable remote interface
   targ->RemoteEn (true);
 
   // Poll for valid IDCODE
-  n = timeout;
+  end = now_ms () + LINK_UP_MS;
   do {
-    idcode = targ->RemoteIDCODE ();
-  } while (--n && (idcode == 0));
-  
-  // Check status
-  stat = targ->RemoteStat ();
+    *idcode = targ->RemoteIDCODE ();
+  } while ((*idcode == 0) && (now_ms () < end));
+
+  // Check status and manufacturer
+  if (targ->RemoteStat () || (((*idcode >> 1) & 0xff) != 0x3b))
+    return false;
+
+  // Back to back IDCODE reads must all succeed
+  for (i = 0; i < STABLE_READS; i++)
+    xfer[i] = {REMOTE_DP | REMOTE_RD | DP_IDCODE};
+  if (targ->RemoteTransfer (xfer, STABLE_READS) != STABLE_READS)
+    return false;
+  for (i = 0; i < STABLE_READS; i++)
+    if (xfer[i].data != *idcode)
+      return false;
+  return true;
+}
+
+// Find fastest stable divisor at or above div
+static int link_search (Target *targ, uint8_t div, uint32_t *idcode)
+{
+  int lo = div, hi = DIV_MAX, mid;
+
+  // Requested divisor usually works
+  if (link_try (targ, div, idcode))
+    return div;
+
+  // Nothing works - likely not connected
+  if ((div == DIV_MAX) || !link_try (targ, DIV_MAX, idcode))
+    return -1;
+
+  // Binary search (lo fails, hi works)
+  while (hi - lo > 1) {
+    mid = (lo + hi) / 2;
+    if (link_try (targ, mid, idcode))
+      hi = mid;
+    else
+      lo = mid;
+  }
+
+  // Leave link at found divisor
+  if ((hi != DIV_MAX) && !link_try (targ, hi, idcode))
+    return -1;
+  return hi;
+}
+
+int remote_open (uint8_t div, bool halt)
+{
+  uint32_t idcode, idr;
+  uint8_t apsel = 255;
+  int i, j, n, rv, cnt;
+  float freqMHz;
+  remote_xfer_t xfer[AP_BATCH * 2];
   
-  // Check if not connected
-  if (stat == ERR_NOCONNECT) {
-    log (LOG_NORMAL, "-- Remote DebugPort not found! Check connections.");
+  // Get target pointer
+  Target *targ = Target::Ptr ();
+
+  // Search for fastest stable clock
+  rv = link_search (targ, (div > DIV_MAX) ? DIV_MAX : div, &idcode);
+  if (rv < 0) {
+    if (targ->RemoteStat () == ERR_NOCONNECT)
+      log (LOG_NORMAL, "-- Remote DebugPort not found! Check connections.");
+    else
+      log (LOG_ERR, "Remote connect failed");
     goto cleanup;
   }
+  div = rv;
   
-  // If IDcode doesn't look correct retry at lower speed
-  if (stat || (((idcode >> 1) & 0xff) != 0x3b)) {
-    targ->RemoteEn (false);
-    div++;
-    goto retry_connect;
-  }
+  // Calculate frequency
+  freqMHz = (float)(targ->CoreFreq() / ((div + 1) * 2)) / 1000000;
 
   // Read IDcode of DP to check if valid
   log (LOG_NORMAL, "Remote connected - %s %s DPv%d [%08X] @ %.03fMHz",
@@ -111,61 +173,70 @@ int remote_open (uint8_t div, bool halt)
        (idcode >> 12) & 0xf,
        idcode, freqMHz);
 
-  // Enable debug and overrun detection
+  // Enable debug and overrun detection - wait for both powered up
   log_nonl (LOG_DEBUG, "  Enable debug... ");
-  targ->RemoteRegWrite (false, DP_CTLSTAT, 0x50000000); n = timeout;
-  while (((targ->RemoteRegRead (false, DP_CTLSTAT) >> 28) != 0xf) && n)
-    n--;
-  if (!n) {
+  xfer[0] = {REMOTE_DP | REMOTE_WR | DP_CTLSTAT, 0x50000000};
+  xfer[1] = {REMOTE_DP | REMOTE_RD | REMOTE_MATCH | DP_CTLSTAT, 0xf0000000, 0xf0000000};
+  if (targ->RemoteTransfer (xfer, 2) != 2) {
     log (LOG_ERR, "remote timeout.");
     goto cleanup;
   }
   log (LOG_DEBUG, "SYS|DBG powered up.");
 
-  // Scan all APs for MEM-AP
-  for (i = 0; i < 256; i++) {
-
-    // Get IDR register
-    uint32_t idr = targ->RemoteAPRead (AP_IDR, i);
-    if (idr == 0)
+  // Scan APs in batches - each selects AP bank 0xF0 and reads IDR
+  for (i = 0, idr = 1; (i < 256) && idr; i += AP_BATCH) {
+    cnt = (256 - i < AP_BATCH) ? 256 - i : AP_BATCH;
+    for (j = 0; j < cnt; j++) {
+      xfer[j * 2] = {REMOTE_DP | REMOTE_WR | DP_SELECT, ((uint32_t)(i + j) << 24) | 0xf0};
+      xfer[j * 2 + 1] = {REMOTE_AP | REMOTE_RD | AP_IDR};
+    }
+    n = targ->RemoteTransfer (xfer, cnt * 2);
+
+    // First empty IDR ends the scan
+    for (j = 0; j < n / 2; j++) {
+      idr = xfer[j * 2 + 1].data;
+      if (idr == 0)
+        break;
+      log (LOG_NORMAL, "  [%d] Found AP: %s %s%s [%08X]", i + j,
+           jedec_manufacturer ((idr >> 17) & 0x7f),
+           ap_idcode (idr & 0xf),
+           ((idr >> 13) & 0xf) == 0x8 ? "MEMAP" : "",
+           idr);
+
+      // Save MEM-AP
+      if (((idr >> 13) & 0xf) == 0x8)
+        apsel = i + j;
+    }
+    if (n != cnt * 2)
       break;
-    log (LOG_NORMAL, "  [%d] Found AP: %s %s%s [%08X]", i,
-         jedec_manufacturer ((idr >> 17) & 0x7f),
-         ap_idcode (idr & 0xf),
-         ((idr >> 13) & 0xf) == 0x8 ? "MEMAP" : "",
-         idr);
-
-    // Save MEM-AP
-    if (((idr >> 13) & 0xf) == 0x8)
-      apsel = i;
   }
 
   // Check if we failed to find MEM-AP
-  if (apsel == 256) {
+  if (apsel == 255) {
     log (LOG_ERR, "  Failed to find MEM-AP!");
     goto cleanup;
   }
 
   // Set CSW for word access
   targ->RemoteAPWrite (AP_CSW, CSW_CFG_WORD, apsel);
-  
-  // Halt processor if requested
+  n = 0;
+
+  // Halt processor if requested - write key + halt then wait for S_HALT
   if (halt) {
     log_nonl (LOG_NORMAL, "  Halt remote CPU... ");
+    xfer[n++] = {REMOTE_AP | REMOTE_WR | AP_TAR, SCB_DHCSR};
+    xfer[n++] = {REMOTE_AP | REMOTE_WR | AP_DRW, DEBUG_HALT};
+    xfer[n++] = {REMOTE_AP | REMOTE_RD | REMOTE_MATCH | AP_DRW, S_HALT, S_HALT};
+  }
 
-    // Write SCB_DHCSR to TAR
-    targ->RemoteAPWrite (AP_TAR, SCB_DHCSR);
-
-    // Try and halt processor
-    n = timeout;
-    do {
-      // Write key + halt to DHCSR
-      targ->RemoteAPWrite (AP_DRW, DEBUG_HALT);
-      n--;
-    } while ((targ->RemoteAPRead (AP_DRW) & (1 << 17) == 0) && n);
+  // Check if byte/hwrd access is supported
+  xfer[n++] = {REMOTE_AP | REMOTE_WR | AP_CSW, CSW_CFG_BYTE};
+  xfer[n++] = {REMOTE_AP | REMOTE_RD | AP_CSW};
+  rv = targ->RemoteTransfer (xfer, n);
 
-    // Check if we succeeded
-    if (!n) {
+  // Check if we succeeded
+  if (halt) {
+    if (rv < 3) {
       log (LOG_NORMAL, "timed out.");
       goto cleanup;
     }
@@ -174,9 +245,7 @@ int remote_open (uint8_t div, bool halt)
   else
     log (LOG_NORMAL, "  Remote CPU left running...");
 
-  // Check if byte/hwrd access is supported
-  targ->RemoteAPWrite (AP_CSW, CSW_CFG_BYTE);
-  if ((targ->RemoteAPRead (AP_CSW) & 3) != 0) {
+  if ((rv != n) || ((xfer[n - 1].data & 3) != 0)) {
     log (LOG_NORMAL, "  -- BYTE/HWRD access not supported on remote.");
     log (LOG_NORMAL, "  -- AHB bridge will not work for these accesses");
 
@@ -215,22 +284,23 @@ void remote_close (void)
 void remote_dump (uint32_t base)
 {
   int i;
-  uint8_t reg = 0;
+  core_regs_t regs;
+  uint32_t *reg = (uint32_t *)&regs;
+  static const char *name[CORE_REG_CNT] = {
+    "R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "R8", "R9", "R10",
+    "R11", "R12", "SP", "LR", "PC", "xPSR", "MSP", "PSP", "SPECIAL"
+  };
   
   // Get target pointer
   Target *targ = Target::Ptr ();
 
-  // Dump each register
-  for (i = 0; i < 0x14; i++) {
-    
-    // Select register for read (DCRSR)
-    targ->WriteReg (base + 0xedf4, i);
-
-    // Wait for it to complete (DHCSR)
-    while (targ->ReadReg (base + 0xedf0) & (1 << 16) == 0)
-      ;
-
-    // Print reg (DCRDR)
-    log (LOG_NORMAL, "[%02X] = %08X", i, targ->ReadReg (base + 0xedf8));
+  // Snapshot all registers in one batch
+  if (targ->CoreRegs (base, &regs)) {
+    log (LOG_ERR, "Remote core not halted");
+    return;
   }
+
+  // Dump each register
+  for (i = 0; i < CORE_REG_CNT; i++)
+    log (LOG_NORMAL, "%-7s = %08X", name[i], reg[i]);
 }
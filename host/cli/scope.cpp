@@ -0,0 +1,276 @@
+/**
+ *  Scope - live variable capture.
+ *
+ *  Each sample is one vectored read of every variable, pipelined in a single
+ *  stream and stamped with the midpoint of its round trip. Sampling runs on
+ *  its own thread in the bulk lane, so plugins keep priority and the event
+ *  loop is not held up.
+ *
+ *  Samples go straight into a shared mapping of the capture file. The file
+ *  grows a few blocks at a time and the header sample count is published
+ *  every FLUSH_MS, so readers can follow a live capture.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "scope.h"
+#include "log.h"
+
+// Samples per block
+#define BLOCK         4096
+
+// Blocks added when file fills
+#define GROW          16
+
+// Header sample count publish interval
+#define FLUSH_MS      100
+
+static struct {
+  flexsoc_ctx   *ctx;
+  pthread_t      thread;
+  volatile bool  running;
+  int            fd;
+  uint8_t       *map;
+  size_t         map_sz;
+  uint32_t       blocks;        // Blocks in file
+  uint32_t       blk_sz;        // Bytes per block
+  uint32_t      *col;           // Variable column offsets in block
+  scope_hdr_t   *hdr;
+  flexsoc_vec_t *vec;
+  int            cnt;
+  uint64_t       period;        // ns (0 = max rate)
+  uint64_t       samples;
+  uint64_t       errors;        // Samples dropped on link failure
+  uint64_t       elapsed;       // ns of last sample
+} scope = {NULL, 0, false, -1};
+
+static uint64_t now_ns (clockid_t clk)
+{
+  timespec ts;
+  clock_gettime (clk, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int scope_grow (void)
+{
+  size_t sz = SCOPE_HDR_SZ + (size_t)(scope.blocks + GROW) * scope.blk_sz;
+  void *map;
+
+  if (ftruncate (scope.fd, sz))
+    return -1;
+  map = mremap (scope.map, scope.map_sz, sz, MREMAP_MAYMOVE);
+  if (map == MAP_FAILED)
+    return -1;
+  scope.map = (uint8_t *)map;
+  scope.map_sz = sz;
+  scope.hdr = (scope_hdr_t *)map;
+  scope.blocks += GROW;
+  return 0;
+}
+
+static int scope_store (uint64_t ns)
+{
+  uint32_t blk = scope.samples / BLOCK, i = scope.samples % BLOCK;
+  uint8_t *base, *p;
+  int v;
+
+  if ((blk >= scope.blocks) && scope_grow ())
+    return -1;
+  base = scope.map + SCOPE_HDR_SZ + (size_t)blk * scope.blk_sz;
+  ((uint64_t *)base)[i] = ns;
+
+  // Values in target byte order
+  for (v = 0; v < scope.cnt; v++) {
+    p = base + scope.col[v] + i * scope.vec[v].width;
+    switch (scope.vec[v].width) {
+      case 4:
+        p[3] = scope.vec[v].data >> 24;
+        p[2] = scope.vec[v].data >> 16;
+        // Fall through
+      case 2:
+        p[1] = scope.vec[v].data >> 8;
+        // Fall through
+      case 1:
+        p[0] = scope.vec[v].data;
+    }
+  }
+  scope.samples++;
+  return 0;
+}
+
+static void scope_flush (bool sync)
+{
+  __atomic_store_n (&scope.hdr->samples, scope.samples, __ATOMIC_RELEASE);
+  msync (scope.map, scope.map_sz, sync ? MS_SYNC : MS_ASYNC);
+}
+
+static void *scope_thread (void *arg)
+{
+  uint64_t t0, t1, start, next, flush;
+  timespec ts;
+  int rv;
+
+  start = next = now_ns (CLOCK_MONOTONIC);
+  flush = start + FLUSH_MS * 1000000ULL;
+  scope.hdr->start = now_ns (CLOCK_REALTIME);
+
+  while (scope.running) {
+
+    // One pipelined read of all variables - drop sample if any failed
+    t0 = now_ns (CLOCK_MONOTONIC);
+    rv = flexsoc_ctx_vec (scope.ctx, scope.vec, scope.cnt);
+    t1 = now_ns (CLOCK_MONOTONIC);
+    scope.elapsed = t1 - start;
+    if (rv)
+      scope.errors++;
+    else if (scope_store ((t0 + t1) / 2 - start)) {
+      log (LOG_ERR, "Scope: capture file full");
+      break;
+    }
+
+    // Publish progress
+    if (t1 >= flush) {
+      scope_flush (false);
+      flush = t1 + FLUSH_MS * 1000000ULL;
+    }
+
+    // Pace fixed rate - skip slots rather than burst after a stall
+    if (scope.period) {
+      next += scope.period;
+      if (next > t1) {
+        ts.tv_sec = next / 1000000000;
+        ts.tv_nsec = next % 1000000000;
+        clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+      }
+      else
+        next = t1;
+    }
+  }
+  return NULL;
+}
+
+int scope_open (flexsoc_ctx *ctx, const char *path, const scope_var_t *var,
+                int cnt, uint32_t rate)
+{
+  int i;
+  uint32_t off;
+  scope_var_t *hvar;
+
+  if ((cnt < 1) || (cnt > (int)SCOPE_VAR_MAX))
+    return -1;
+  for (i = 0; i < cnt; i++)
+    if (((var[i].width != 1) && (var[i].width != 2) && (var[i].width != 4)) ||
+        (var[i].addr & (var[i].width - 1))) {
+      log (LOG_ERR, "Scope: invalid variable %08X:%d", var[i].addr, var[i].width);
+      return -1;
+    }
+
+  // Read ops and column layout - time column first
+  scope.vec = (flexsoc_vec_t *)calloc (cnt, sizeof (flexsoc_vec_t));
+  scope.col = (uint32_t *)calloc (cnt, sizeof (uint32_t));
+  if (!scope.vec || !scope.col)
+    goto fail;
+  off = BLOCK * sizeof (uint64_t);
+  for (i = 0; i < cnt; i++) {
+    scope.vec[i].addr = var[i].addr;
+    scope.vec[i].width = var[i].width;
+    scope.col[i] = off;
+    off += BLOCK * var[i].width;
+  }
+  scope.blk_sz = off;
+  scope.cnt = cnt;
+  scope.ctx = ctx;
+  scope.period = rate ? 1000000000ULL / rate : 0;
+  scope.samples = 0;
+  scope.errors = 0;
+
+  // Map header, blocks are added as samples arrive
+  scope.fd = open (path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (scope.fd < 0)
+    goto fail;
+  if (ftruncate (scope.fd, SCOPE_HDR_SZ))
+    goto fail;
+  scope.map = (uint8_t *)mmap (NULL, SCOPE_HDR_SZ, PROT_READ | PROT_WRITE,
+                               MAP_SHARED, scope.fd, 0);
+  if (scope.map == MAP_FAILED) {
+    scope.map = NULL;
+    goto fail;
+  }
+  scope.map_sz = SCOPE_HDR_SZ;
+  scope.blocks = 0;
+  scope.hdr = (scope_hdr_t *)scope.map;
+  scope.hdr->magic = SCOPE_MAGIC;
+  scope.hdr->version = SCOPE_VERSION;
+  scope.hdr->vars = cnt;
+  scope.hdr->block = BLOCK;
+  hvar = (scope_var_t *)(scope.hdr + 1);
+  memcpy (hvar, var, sizeof (scope_var_t) * cnt);
+
+  // Start sampling
+  scope.running = true;
+  if (pthread_create (&scope.thread, NULL, scope_thread, NULL)) {
+    scope.running = false;
+    goto fail;
+  }
+  log (LOG_NORMAL, "Scope: %d variables -> %s", cnt, path);
+  return 0;
+
+ fail:
+  log (LOG_ERR, "Scope: failed to open %s", path);
+  if (scope.map)
+    munmap (scope.map, scope.map_sz);
+  if (scope.fd >= 0)
+    close (scope.fd);
+  free (scope.vec);
+  free (scope.col);
+  scope.map = NULL;
+  scope.fd = -1;
+  scope.vec = NULL;
+  scope.col = NULL;
+  return -1;
+}
+
+uint64_t scope_close (void)
+{
+  uint64_t samples;
+  uint32_t used;
+
+  if (scope.fd < 0)
+    return 0;
+
+  // Stop sampler
+  scope.running = false;
+  pthread_join (scope.thread, NULL);
+  samples = scope.samples;
+
+  // Drop unused blocks
+  scope_flush (true);
+  used = (scope.samples + BLOCK - 1) / BLOCK;
+  munmap (scope.map, scope.map_sz);
+  if (ftruncate (scope.fd, SCOPE_HDR_SZ + (size_t)used * scope.blk_sz))
+    log (LOG_ERR, "Scope: failed to trim capture file");
+  close (scope.fd);
+  log (LOG_NORMAL, "Scope: %llu samples in %.3f s (%.0f Hz)", (unsigned long long)samples,
+       scope.elapsed / 1e9, scope.elapsed ? samples * 1e9 / scope.elapsed : 0.0);
+  if (scope.errors)
+    log (LOG_ERR, "Scope: %llu samples dropped on link errors", (unsigned long long)scope.errors);
+
+  // Release
+  free (scope.vec);
+  free (scope.col);
+  scope.map = NULL;
+  scope.fd = -1;
+  scope.vec = NULL;
+  scope.col = NULL;
+  return samples;
+}
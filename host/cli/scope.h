@@ -0,0 +1,24 @@
+/**
+ *  Scope - samples a list of target variables on its own thread and streams
+ *  timestamped samples to a columnar capture file (see scope_file.h).
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#ifndef SCOPE_H
+#define SCOPE_H
+
+#include <stdint.h>
+
+#include "flexsoc.h"
+#include "scope_file.h"
+
+// Start sampling var[cnt] into path at rate Hz (0 = as fast as link allows)
+int scope_open (flexsoc_ctx *ctx, const char *path, const scope_var_t *var,
+                int cnt, uint32_t rate);
+
+// Stop, flush and close - returns samples captured
+uint64_t scope_close (void);
+
+#endif /* SCOPE_H */
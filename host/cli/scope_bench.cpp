@@ -0,0 +1,55 @@
+/**
+ *  Measure sustained scope sample rate against variable count. Each point
+ *  captures word variables in RAM at max rate for a fixed time.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "scope.h"
+#include "Target.h"
+#include "err.h"
+#include "log.h"
+
+#define ADDR       0x20000000
+#define VARS_MAX   256
+#define DEF_MS     1000
+
+int main (int argc, char **argv)
+{
+  Target *target;
+  scope_var_t var[VARS_MAX];
+  uint64_t samples;
+  int i, cnt, ms;
+  const char *path;
+
+  if (argc < 3)
+    err ("Usage: %s DEVICE FILE [MS]", argv[0]);
+  path = argv[2];
+  ms = (argc > 3) ? strtoul (argv[3], NULL, 0) : DEF_MS;
+  log_init (LOG_ERR);
+
+  // Open interface to flexsoc
+  target = Target::Ptr (argv[1]);
+  for (i = 0; i < VARS_MAX; i++)
+    var[i] = {ADDR + (uint32_t)i * 4, 4};
+
+  printf ("vars  samples/s   vars/s\n");
+  for (cnt = 1; cnt <= VARS_MAX; cnt *= 2) {
+    if (scope_open (target->Ctx (), path, var, cnt, 0))
+      err ("Failed to start scope");
+    usleep (ms * 1000);
+    samples = scope_close ();
+    printf ("%4d  %9.0f  %9.0f\n", cnt, samples * 1000.0 / ms, samples * cnt * 1000.0 / ms);
+  }
+  unlink (path);
+
+  // Close interface
+  delete target;
+  return 0;
+}
@@ -0,0 +1,97 @@
+/**
+ *  Run small position independent helpers on the local CPU.
+ *
+ *  The CPU fetches SP and PC from ROM when it leaves reset, so the first two
+ *  ROM words are swapped for the helper's and put back afterwards. Helpers
+ *  only ever run while the host holds the target, one at a time.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <time.h>
+
+#include "stub.h"
+#include "Target.h"
+
+#define RAM_BASE     0x20000000
+
+// Mailbox word stalled with no progress
+#define TIMEOUT_MS   1000
+
+static uint32_t save[2];
+static bool saved;
+
+static uint64_t now_ms (void)
+{
+  timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint32_t stub_base (uint32_t size)
+{
+  uint32_t top = RAM_BASE + ((Target::Ptr ()->MemoryID () >> 16) << 10);
+
+  // Leave at least as much RAM below
+  if (top < RAM_BASE + 2 * size)
+    return 0;
+  return (top - size) & ~0xf;
+}
+
+void stub_start (uint32_t base, const void *code, uint32_t len)
+{
+  Target *target = Target::Ptr ();
+  uint32_t vec[2];
+
+  target->WriteB (base, (const uint8_t *)code, len);
+
+  // Boot into helper - stack below it
+  target->ReadW (0, save, 2);
+  saved = true;
+  vec[0] = base;
+  vec[1] = base | 1;
+  target->WriteW (0, vec, 2);
+  target->CPUReset (false);
+}
+
+void stub_vectors (void)
+{
+  if (saved)
+    Target::Ptr ()->WriteW (0, save, 2);
+  saved = false;
+}
+
+void stub_stop (uint32_t addr, uint32_t size)
+{
+  Target *target = Target::Ptr ();
+  uint32_t i;
+
+  target->CPUReset (true);
+  if (!saved)
+    return;
+  for (i = 0; i < 2; i++)
+    if ((i * 4 < addr) || (i * 4 >= addr + size))
+      target->WriteW (i * 4, &save[i], 1);
+  saved = false;
+}
+
+int stub_wait (uint32_t addr, uint32_t n)
+{
+  Target *target = Target::Ptr ();
+  uint32_t val, last;
+  uint64_t start = now_ms ();
+
+  target->ReadW (addr, &val, 1);
+  last = val;
+  while ((int32_t)(val - n) < 0) {
+    if (val != last) {
+      last = val;
+      start = now_ms ();
+    }
+    else if (now_ms () - start > TIMEOUT_MS)
+      return -1;
+    target->ReadW (addr, &val, 1);
+  }
+  return 0;
+}
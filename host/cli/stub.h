@@ -0,0 +1,32 @@
+/**
+ *  Run small position independent helpers on the local CPU. A helper is
+ *  placed at the top of RAM and the CPU is booted into it through a
+ *  temporary vector table. Host and helper talk through mailbox words laid
+ *  out by each helper.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#ifndef STUB_H
+#define STUB_H
+
+#include <stdint.h>
+
+// Base of size bytes at the top of RAM (0 = RAM too small)
+uint32_t stub_base (uint32_t size);
+
+// Upload helper code to base and release the CPU into it
+void stub_start (uint32_t base, const void *code, uint32_t len);
+
+// Put back original vectors - safe once the helper is running
+void stub_vectors (void);
+
+// Back into reset. Vectors not yet put back are restored unless they lie
+// in [addr, addr + size), which the helper has written.
+void stub_stop (uint32_t addr = 0, uint32_t size = 0);
+
+// Wait until mailbox word at addr reaches n - fails if it stops moving
+int stub_wait (uint32_t addr, uint32_t n);
+
+#endif /* STUB_H */
@@ -34,6 +34,10 @@
  *    rirq@A:B (Map remote IRQ B to local IRQ A) A/B=[0,240)
  *  or:
  *    rirq@A-B:C-D (Map remote IRQ range C-D to local range A-B)
+ *  or:
+ *    region@base:size:depth=N chunk=N timeout=ms strict=W (link profile for address range)
+ *  or:
+ *    cache@base:size:rom|ram|none (host page cache for address range)
  *
  *  For instance a GPIO controller and SPI controller may be mapped as:
  *    pl061@0x40001000::A   (maps ARM primecell GPIO periph to addr, export as port A)
@@ -53,6 +57,23 @@
  *  connect to the SPI.0 bus. ie:
  *    sd@SPI.0,A.10:sz=4G
  *
+ *  Host link transfers can be tuned per address range. For instance slow remote
+ *  bridge accesses may use shallow pipelining and a response timeout while local
+ *  memory keeps the default high speed profile:
+ *    region@0x80000000:512M:depth=2 chunk=9 timeout=1000
+ *  Unspecified fields use the builtin high speed profile.
+ *
+ *  Byte copies (firmware loading etc) are widened to word accesses where
+ *  possible. Ranges with strict access width semantics (ie peripheral FIFOs)
+ *  opt out by declaring the only width allowed:
+ *    region@0x40000000:64k:strict=4
+ *
+ *  Host tools reading target memory through the master interface can be served
+ *  from a host page cache. ROM is cached always, RAM only while the CPU is held
+ *  in reset. Ranges are page (1k) aligned, later declarations take precedence:
+ *    cache@0x00000000:64k:rom
+ *    cache@0x20000000:64k:ram
+ *
  *  The beauty of all of this is (if done right) the firmware running on the target
  *  is 100% compatible between physical hardware and virtual peripherals. This makes
  *  it easy to quickly prototype a new system using mostly virtual peripherals and then
@@ -103,6 +124,14 @@ static uint32_t parse_uint (const char *str)
   return val;
 }
 
+// Parse key=val from option string, val unchanged if not found
+static void parse_opt (const string &opts, const char *key, int *val)
+{
+  size_t pos = opts.find (key);
+  if (pos != string::npos)
+    *val = parse_uint (opts.c_str () + pos + strlen (key));
+}
+
 int sysmap_parse (const char *map, BusPeripheral ***bp, int *cnt)
 {
   int rv = 0;
@@ -115,7 +144,7 @@ int sysmap_parse (const char *map, BusPeripheral ***bp, int *cnt)
   Target *target = Target::Ptr ();
   
   // Create plugin target
-  ptarget = new PluginTarget ();
+  ptarget = new PluginTarget (target ? target->Ctx () : NULL);
   
   // Clear count
   *cnt = 0;
@@ -172,6 +201,13 @@ int sysmap_parse (const char *map, BusPeripheral ***bp, int *cnt)
       goto cleanup;
     }
 
+    // Builtin functions configure the device - skip if loading without one
+    if (!target && ((plugin == "alias") || (plugin == "region") ||
+                    (plugin == "cache") || (plugin == "remap32") || (plugin == "remap256"))) {
+      log (LOG_NORMAL, "  %s: skipped (no device)", plugin.c_str ());
+      continue;
+    }
+
     // Handle builtin functions
     if (plugin == "alias") {
       alias_t alias;
@@ -208,6 +244,59 @@ int sysmap_parse (const char *map, BusPeripheral ***bp, int *cnt)
           log (LOG_ERR, "Failed to set code alias %d", idx);
       }
     }
+    else if (plugin == "region") {
+      flexsoc_profile_t prof = *flexsoc_profile_builtin (true);
+      uint32_t base, size;
+
+      if ((tokens.size () < 2) || (tokens.size () > 3)) {
+        log (LOG_ERR, "Invalid region: region@base:size:depth=N chunk=N timeout=ms strict=W");
+        rv = -1;
+        goto cleanup;
+      }
+
+      // Parse profile
+      base = parse_uint (addr.c_str ());
+      size = parse_uint (tokens[1].c_str ());
+      if (tokens.size () == 3) {
+        parse_opt (tokens[2], "depth=", &prof.depth);
+        parse_opt (tokens[2], "chunk=", &prof.chunk);
+        parse_opt (tokens[2], "timeout=", &prof.timeout);
+        parse_opt (tokens[2], "strict=", &prof.strict);
+      }
+
+      // Install on link
+      if (target->LinkRegion (base, size, &prof)) {
+        log (LOG_ERR, "Invalid region profile [%s]", line.c_str ());
+        rv = -1;
+        goto cleanup;
+      }
+      log (LOG_NORMAL, "  %08X: region sz=0x%X depth=%d chunk=%d timeout=%d strict=%d",
+           base, size, prof.depth, prof.chunk, prof.timeout, prof.strict);
+    }
+    else if (plugin == "cache") {
+      cache_mode_t mode;
+      uint32_t base, size;
+
+      if (tokens.size () == 3)
+        mode = (tokens[2] == "rom") ? CACHE_ROM :
+          (tokens[2] == "ram") ? CACHE_RAM : CACHE_NONE;
+      if ((tokens.size () != 3) ||
+          ((mode == CACHE_NONE) && (tokens[2] != "none"))) {
+        log (LOG_ERR, "Invalid cache: cache@base:size:rom|ram|none");
+        rv = -1;
+        goto cleanup;
+      }
+
+      // Declare cacheability
+      base = parse_uint (addr.c_str ());
+      size = parse_uint (tokens[1].c_str ());
+      if (target->CacheRegion (base, size, mode)) {
+        log (LOG_ERR, "Invalid cache range [%s]", line.c_str ());
+        rv = -1;
+        goto cleanup;
+      }
+      log (LOG_NORMAL, "  %08X: cache sz=0x%X %s", base, size, tokens[2].c_str ());
+    }
     else if (plugin == "remap32") {
       if ((tokens.size () != 2) || (stoi (addr) < 0) || (stoi (addr) > 7)) {
         log (LOG_ERR, "Invalid remap32: remap32@<0-7>:<remote addr>");
@@ -0,0 +1,458 @@
+/**
+ *  Master access client library - shared ring transport.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mclient.h"
+#include "mserver_proto.h"
+#include "err.h"
+
+// Ring entries
+#define ENTRIES       256
+
+// Arena allocation unit
+#define PAGE_SZ       4096
+#define ARENA_DEF     (4 << 20)
+
+// Staging for buffers outside arena
+#define CHUNK         0x10000
+#define DEPTH         4
+
+// Completion polls before sleeping on socket
+#define SPIN          200
+
+#define ALIGN(x, a)   (((x) + (a) - 1) & ~((a) - 1))
+
+typedef struct {
+  int      tag;
+  uint8_t *dst;       // Copy out on completion (staged reads)
+  uint8_t *buf;
+  uint32_t len;
+} flight_t;
+
+struct mclient {
+  int          fd;
+  msrv_shm_t  *shm;
+  uint32_t     shm_sz;
+  msrv_sqe_t  *sq;
+  msrv_resp_t *cq;
+  uint8_t     *arena;
+  uint32_t     arena_sz;
+  uint32_t     sq_tail, cq_head;
+  uint32_t     pending;   // Submitted and not reaped
+
+  // Completion state by tag
+  int16_t      rv[ENTRIES];
+  bool         done[ENTRIES];
+
+  // Arena pages in use
+  uint64_t    *map;
+  uint32_t    *run;       // Pages allocated at page
+  uint32_t     pages;
+
+  // Staging buffers
+  uint8_t     *stage[DEPTH];
+};
+
+static bool in_arena (mclient *cl, const void *p, uint32_t len)
+{
+  const uint8_t *b = (const uint8_t *)p;
+  return (b >= cl->arena) && (b + len <= cl->arena + cl->arena_sz);
+}
+
+static bool page_used (mclient *cl, uint32_t i)
+{
+  return cl->map[i / 64] & (1ULL << (i % 64));
+}
+
+static void page_set (mclient *cl, uint32_t i, uint32_t n, bool used)
+{
+  for (; n; n--, i++) {
+    if (used)
+      cl->map[i / 64] |= (1ULL << (i % 64));
+    else
+      cl->map[i / 64] &= ~(1ULL << (i % 64));
+  }
+}
+
+void *mclient_alloc (mclient *cl, uint32_t len)
+{
+  uint32_t i, j, n = ALIGN (len, PAGE_SZ) / PAGE_SZ;
+
+  if (!n)
+    return NULL;
+
+  // First fit run of free pages
+  for (i = 0; i + n <= cl->pages; i = j + 1) {
+    for (j = i; (j < i + n) && !page_used (cl, j); j++)
+      ;
+    if (j == i + n) {
+      page_set (cl, i, n, true);
+      cl->run[i] = n;
+      return &cl->arena[i * PAGE_SZ];
+    }
+  }
+  return NULL;
+}
+
+void mclient_free (mclient *cl, void *buf)
+{
+  uint32_t i;
+
+  if (!buf || !in_arena (cl, buf, 1))
+    return;
+  i = ((uint8_t *)buf - cl->arena) / PAGE_SZ;
+  page_set (cl, i, cl->run[i], false);
+  cl->run[i] = 0;
+}
+
+// Collect completions
+static void reap (mclient *cl)
+{
+  uint32_t tail;
+  msrv_resp_t *c;
+
+  tail = __atomic_load_n (&cl->shm->cq_tail, __ATOMIC_ACQUIRE);
+  while (cl->cq_head != tail) {
+    c = &cl->cq[cl->cq_head++ % ENTRIES];
+    cl->rv[c->tag % ENTRIES] = c->rv;
+    cl->done[c->tag % ENTRIES] = true;
+    cl->pending--;
+  }
+  __atomic_store_n (&cl->shm->cq_head, cl->cq_head, __ATOMIC_RELEASE);
+}
+
+// Wait for any completion
+static int sleep_cq (mclient *cl)
+{
+  int i, rv;
+  uint8_t buf[64];
+
+  // Server is usually mid round - poll first
+  for (i = 0; i < SPIN; i++) {
+    if (__atomic_load_n (&cl->shm->cq_tail, __ATOMIC_ACQUIRE) != cl->cq_head)
+      return 0;
+    sched_yield ();
+  }
+
+  // Ask for a wakeup then check again before sleeping
+  __atomic_store_n (&cl->shm->wait, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n (&cl->shm->cq_tail, __ATOMIC_SEQ_CST) == cl->cq_head) {
+    rv = recv (cl->fd, buf, sizeof (buf), 0);
+    if ((rv == 0) || ((rv < 0) && (errno != EINTR))) {
+      __atomic_store_n (&cl->shm->wait, 0, __ATOMIC_RELAXED);
+      return -1;
+    }
+  }
+  __atomic_store_n (&cl->shm->wait, 0, __ATOMIC_RELAXED);
+
+  // Drop extra wakeups
+  while (recv (cl->fd, buf, sizeof (buf), MSG_DONTWAIT) > 0)
+    ;
+  return 0;
+}
+
+int mclient_submit (mclient *cl, int op, int width, uint32_t addr, void *buf, uint32_t len)
+{
+  msrv_sqe_t *e;
+  uint8_t ring = 1;
+  int tag;
+
+  if (!in_arena (cl, buf, (op == MSRV_VEC) ? len * sizeof (msrv_vec_t) : len))
+    return -1;
+
+  // Ring full - completions free entries
+  while (cl->pending == ENTRIES) {
+    reap (cl);
+    if ((cl->pending == ENTRIES) && sleep_cq (cl))
+      return -1;
+  }
+  tag = cl->sq_tail & 0xffff;
+  e = &cl->sq[cl->sq_tail % ENTRIES];
+  e->op = op;
+  e->width = width;
+  e->tag = tag;
+  e->addr = addr;
+  e->len = len;
+  e->off = (uint8_t *)buf - cl->arena;
+  cl->done[tag % ENTRIES] = false;
+  cl->pending++;
+  __atomic_store_n (&cl->shm->sq_tail, ++cl->sq_tail, __ATOMIC_SEQ_CST);
+
+  // Server only needs the socket when idle
+  if (!__atomic_load_n (&cl->shm->busy, __ATOMIC_SEQ_CST) &&
+      (send (cl->fd, &ring, 1, MSG_NOSIGNAL) != 1))
+    return -1;
+  return tag;
+}
+
+int mclient_wait (mclient *cl, int tag)
+{
+  for (;;) {
+    reap (cl);
+    if (cl->done[tag % ENTRIES])
+      return cl->rv[tag % ENTRIES];
+    if (sleep_cq (cl))
+      return -1;
+  }
+}
+
+// Finish oldest staged request
+static int retire (mclient *cl, flight_t *f)
+{
+  int rv = mclient_wait (cl, f->tag);
+
+  if (!rv && f->dst)
+    memcpy (f->dst, f->buf, f->len);
+  return rv;
+}
+
+// Pipelined transfer in chunks - staged unless caller buffer is shared
+static int xfer (mclient *cl, int op, int width, uint32_t addr, uint8_t *data, uint32_t len)
+{
+  flight_t fl[DEPTH];
+  uint32_t n, i = 0, head = 0, done = 0;
+  bool shared = in_arena (cl, data, len);
+  int rv = 0, ret;
+
+  while ((done < len) || (head < i)) {
+
+    // Keep DEPTH chunks in flight
+    if ((done < len) && (i - head < DEPTH)) {
+      n = (len - done > CHUNK) ? CHUNK : len - done;
+      fl[i % DEPTH].len = n;
+      fl[i % DEPTH].dst = NULL;
+      if (shared)
+        fl[i % DEPTH].buf = &data[done];
+      else {
+        fl[i % DEPTH].buf = cl->stage[i % DEPTH];
+        if (op == MSRV_WRITE)
+          memcpy (fl[i % DEPTH].buf, &data[done], n);
+        else
+          fl[i % DEPTH].dst = &data[done];
+      }
+      fl[i % DEPTH].tag = mclient_submit (cl, op, width, addr + done,
+                                          fl[i % DEPTH].buf, n);
+      if (fl[i % DEPTH].tag < 0)
+        return -1;
+      done += n;
+      i++;
+      continue;
+    }
+
+    // Complete oldest - keep first error
+    ret = retire (cl, &fl[head++ % DEPTH]);
+    if (!rv)
+      rv = ret;
+  }
+  return rv;
+}
+
+int mclient_readw (mclient *cl, uint32_t addr, uint32_t *data, int len)
+{
+  return xfer (cl, MSRV_READ, 4, addr, (uint8_t *)data, len * 4);
+}
+
+int mclient_readh (mclient *cl, uint32_t addr, uint16_t *data, int len)
+{
+  return xfer (cl, MSRV_READ, 2, addr, (uint8_t *)data, len * 2);
+}
+
+int mclient_readb (mclient *cl, uint32_t addr, uint8_t *data, int len)
+{
+  return xfer (cl, MSRV_READ, 1, addr, data, len);
+}
+
+int mclient_writew (mclient *cl, uint32_t addr, const uint32_t *data, int len)
+{
+  return xfer (cl, MSRV_WRITE, 4, addr, (uint8_t *)data, len * 4);
+}
+
+int mclient_writeh (mclient *cl, uint32_t addr, const uint16_t *data, int len)
+{
+  return xfer (cl, MSRV_WRITE, 2, addr, (uint8_t *)data, len * 2);
+}
+
+int mclient_writeb (mclient *cl, uint32_t addr, const uint8_t *data, int len)
+{
+  return xfer (cl, MSRV_WRITE, 1, addr, (uint8_t *)data, len);
+}
+
+int mclient_memcpy_to (mclient *cl, uint32_t addr, const void *src, int len)
+{
+  return xfer (cl, MSRV_WRITE, MSRV_WIDTH_ANY, addr, (uint8_t *)src, len);
+}
+
+int mclient_memcpy_from (mclient *cl, void *dst, uint32_t addr, int len)
+{
+  return xfer (cl, MSRV_READ, MSRV_WIDTH_ANY, addr, (uint8_t *)dst, len);
+}
+
+int mclient_vec (mclient *cl, mclient_vec_t *vec, int cnt)
+{
+  int i, j, n, tag, rv;
+  msrv_vec_t *op = (msrv_vec_t *)cl->stage[0];
+  uint32_t *res = (uint32_t *)cl->stage[0];
+
+  for (i = 0; i < cnt; i += n) {
+    n = (cnt - i > MSRV_VEC_MAX) ? MSRV_VEC_MAX : cnt - i;
+    for (j = 0; j < n; j++) {
+      op[j].addr = vec[i + j].addr | (vec[i + j].write ? MSRV_VEC_WR : 0);
+      op[j].data = vec[i + j].data;
+    }
+    tag = mclient_submit (cl, MSRV_VEC, 0, 0, op, n);
+    if (tag < 0)
+      return -1;
+    rv = mclient_wait (cl, tag);
+    if (rv)
+      return rv;
+    for (j = 0; j < n; j++)
+      vec[i + j].data = res[j];
+  }
+  return 0;
+}
+
+uint32_t mclient_reg_read (mclient *cl, uint32_t addr)
+{
+  uint32_t val;
+
+  if (mclient_readw (cl, addr, &val, 1))
+    err ("Reg read failed: %08X", addr);
+  return val;
+}
+
+void mclient_reg_write (mclient *cl, uint32_t addr, const uint32_t data)
+{
+  if (mclient_writew (cl, addr, &data, 1))
+    err ("Reg write failed: %08X", addr);
+}
+
+// Pass rings to server
+static int attach (mclient *cl, int mfd)
+{
+  msrv_req_t req = {};
+  msrv_resp_t resp;
+  struct iovec iov;
+  struct msghdr msg = {};
+  struct cmsghdr *cm;
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE (sizeof (int))];
+  } ctl;
+
+  req.op = MSRV_SHM;
+  req.len = cl->shm_sz;
+  iov.iov_base = &req;
+  iov.iov_len = sizeof (req);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = &ctl;
+  msg.msg_controllen = sizeof (ctl);
+  cm = CMSG_FIRSTHDR (&msg);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN (sizeof (int));
+  memcpy (CMSG_DATA (cm), &mfd, sizeof (int));
+  if (sendmsg (cl->fd, &msg, MSG_NOSIGNAL) != sizeof (req))
+    return -1;
+  if (recv (cl->fd, &resp, sizeof (resp), MSG_WAITALL) != sizeof (resp))
+    return -1;
+  return resp.rv;
+}
+
+mclient *mclient_open (const char *path, uint32_t arena)
+{
+  mclient *cl;
+  struct sockaddr_un addr = {};
+  uint32_t sq_off, cq_off, arena_off;
+  int i, mfd = -1;
+
+  if (strlen (path) >= sizeof (addr.sun_path))
+    return NULL;
+  cl = (mclient *)calloc (1, sizeof (mclient));
+  if (!cl)
+    return NULL;
+
+  // Connect
+  cl->fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, path);
+  if ((cl->fd < 0) || connect (cl->fd, (struct sockaddr *)&addr, sizeof (addr)))
+    goto fail;
+
+  // Layout rings and arena - staging chunks on top of caller buffers
+  arena = ALIGN (arena ? arena : ARENA_DEF, PAGE_SZ) + DEPTH * CHUNK;
+  sq_off = ALIGN (sizeof (msrv_shm_t), 64);
+  cq_off = sq_off + ENTRIES * sizeof (msrv_sqe_t);
+  arena_off = ALIGN (cq_off + ENTRIES * sizeof (msrv_resp_t), PAGE_SZ);
+  cl->shm_sz = arena_off + arena;
+  if (cl->shm_sz > MSRV_SHM_MAX)
+    goto fail;
+
+  // Sealed so server can map it safely
+  mfd = memfd_create ("mclient", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if ((mfd < 0) || ftruncate (mfd, cl->shm_sz) ||
+      fcntl (mfd, F_ADD_SEALS, F_SEAL_SHRINK))
+    goto fail;
+  cl->shm = (msrv_shm_t *)mmap (NULL, cl->shm_sz, PROT_READ | PROT_WRITE,
+                                MAP_SHARED, mfd, 0);
+  if (cl->shm == MAP_FAILED) {
+    cl->shm = NULL;
+    goto fail;
+  }
+  cl->shm->magic = MSRV_SHM_MAGIC;
+  cl->shm->entries = ENTRIES;
+  cl->shm->sq_off = sq_off;
+  cl->shm->cq_off = cq_off;
+  cl->shm->arena_off = arena_off;
+  cl->shm->arena_sz = arena;
+  cl->sq = (msrv_sqe_t *)((uint8_t *)cl->shm + sq_off);
+  cl->cq = (msrv_resp_t *)((uint8_t *)cl->shm + cq_off);
+  cl->arena = (uint8_t *)cl->shm + arena_off;
+  cl->arena_sz = arena;
+
+  // Page allocator
+  cl->pages = arena / PAGE_SZ;
+  cl->map = (uint64_t *)calloc ((cl->pages + 63) / 64, sizeof (uint64_t));
+  cl->run = (uint32_t *)calloc (cl->pages, sizeof (uint32_t));
+  if (!cl->map || !cl->run)
+    goto fail;
+  for (i = 0; i < DEPTH; i++)
+    cl->stage[i] = (uint8_t *)mclient_alloc (cl, CHUNK);
+
+  if (attach (cl, mfd))
+    goto fail;
+  close (mfd);
+  return cl;
+
+ fail:
+  if (mfd >= 0)
+    close (mfd);
+  mclient_close (cl);
+  return NULL;
+}
+
+void mclient_close (mclient *cl)
+{
+  if (!cl)
+    return;
+  if (cl->fd >= 0)
+    close (cl->fd);
+  if (cl->shm)
+    munmap (cl->shm, cl->shm_sz);
+  free (cl->map);
+  free (cl->run);
+  free (cl);
+}
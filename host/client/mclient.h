@@ -0,0 +1,70 @@
+/**
+ *  Master access client library. Attaches to a running flexsoc-cm3 master
+ *  access server (--server PATH) and mirrors the flexsoc master API.
+ *
+ *  Requests and completions go through rings in memory shared with the
+ *  server. Read data lands in a shared arena - buffers from mclient_alloc ()
+ *  are transferred in place, other buffers are staged through the arena.
+ *  The socket is only used to wake a sleeping side.
+ *
+ *  A handle must only be used from one thread at a time.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#ifndef MCLIENT_H
+#define MCLIENT_H
+
+#include <stdint.h>
+
+// Opaque client handle
+typedef struct mclient mclient;
+
+// Vectored word access - see flexsoc_vec_t
+typedef struct {
+  uint32_t addr;
+  uint32_t data;    // Write data or read result
+  bool     write;
+} mclient_vec_t;
+
+// Connect to server socket - arena is shared buffer bytes (0 = default)
+mclient *mclient_open (const char *path, uint32_t arena);
+void mclient_close (mclient *cl);
+
+// Shared buffers - transfers to/from these are not copied
+void *mclient_alloc (mclient *cl, uint32_t len);
+void mclient_free (mclient *cl, void *buf);
+
+// Master read/write interface - 0 on success
+int mclient_readw (mclient *cl, uint32_t addr, uint32_t *data, int len);
+int mclient_readh (mclient *cl, uint32_t addr, uint16_t *data, int len);
+int mclient_readb (mclient *cl, uint32_t addr, uint8_t  *data, int len);
+int mclient_writew (mclient *cl, uint32_t addr, const uint32_t *data, int len);
+int mclient_writeh (mclient *cl, uint32_t addr, const uint16_t *data, int len);
+int mclient_writeb (mclient *cl, uint32_t addr, const uint8_t  *data, int len);
+
+// Vectored word access - independent commands pipelined in one stream
+int mclient_vec (mclient *cl, mclient_vec_t *vec, int cnt);
+
+// Copy arbitrary byte ranges using widest access possible
+int mclient_memcpy_to (mclient *cl, uint32_t addr, const void *src, int len);
+int mclient_memcpy_from (mclient *cl, void *dst, uint32_t addr, int len);
+
+// Simplified register access
+uint32_t mclient_reg_read (mclient *cl, uint32_t addr);
+void mclient_reg_write (mclient *cl, uint32_t addr, const uint32_t data);
+
+//
+// Asynchronous interface - buf must come from mclient_alloc ()
+//
+
+// Queue request (MSRV_READ/WRITE/VEC, see mserver_proto.h) - returns tag
+// Vec results replace the ops in buf as uint32_t[len]
+int mclient_submit (mclient *cl, int op, int width, uint32_t addr, void *buf, uint32_t len);
+
+// Wait for tag - returns request status
+// Each tag must be waited once before ring size more requests are queued
+int mclient_wait (mclient *cl, int tag);
+
+#endif /* MCLIENT_H */
@@ -0,0 +1,87 @@
+/**
+ *  Measure master access through a running flexsoc-cm3 --server. Reports
+ *  single word round trips, vectored word reads and block reads into shared
+ *  and private buffers.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mclient.h"
+#include "err.h"
+
+static double now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main (int argc, char **argv)
+{
+  mclient *cl;
+  mclient_vec_t vec[256];
+  uint32_t addr, size, val, *priv, *shared;
+  double t;
+  int i, cnt;
+
+  if (argc < 3)
+    err ("Usage: %s SOCKET ADDR [BYTES]", argv[0]);
+  addr = strtoul (argv[2], NULL, 0);
+  size = (argc > 3) ? strtoul (argv[3], NULL, 0) : 0x10000;
+
+  cl = mclient_open (argv[1], 0);
+  if (!cl)
+    err ("Failed to attach: %s", argv[1]);
+  priv = (uint32_t *)malloc (size);
+  shared = (uint32_t *)mclient_alloc (cl, size);
+  if (!priv || !shared)
+    err ("Failed to malloc");
+
+  // Round trip
+  cnt = 1000;
+  t = now ();
+  for (i = 0; i < cnt; i++)
+    val = mclient_reg_read (cl, addr);
+  t = now () - t;
+  printf ("reg_read     %8.1f us/op\n", t * 1e6 / cnt);
+
+  // Vectored
+  for (i = 0; i < 256; i++) {
+    vec[i].addr = addr + (i % 64) * 4;
+    vec[i].write = false;
+  }
+  cnt = 100;
+  t = now ();
+  for (i = 0; i < cnt; i++)
+    if (mclient_vec (cl, vec, 256))
+      err ("Vec failed");
+  t = now () - t;
+  printf ("vec x256     %8.1f us/op %8.2f Mword/s\n", t * 1e6 / cnt, cnt * 256 / t / 1e6);
+
+  // Block reads
+  t = now ();
+  if (mclient_readw (cl, addr, shared, size / 4))
+    err ("Read failed");
+  t = now () - t;
+  printf ("read shared  %8.1f us    %8.2f MB/s\n", t * 1e6, size / t / 1e6);
+  t = now ();
+  if (mclient_readw (cl, addr, priv, size / 4))
+    err ("Read failed");
+  t = now () - t;
+  printf ("read staged  %8.1f us    %8.2f MB/s\n", t * 1e6, size / t / 1e6);
+  if (memcmp (priv, shared, size))
+    err ("Shared/staged reads differ");
+
+  (void)val;
+  mclient_free (cl, shared);
+  mclient_close (cl);
+  free (priv);
+  return 0;
+}
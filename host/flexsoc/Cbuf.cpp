@@ -8,6 +8,8 @@
 #include "Cbuf.h"
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 
 
 int Cbuf::SpaceAvail (void)
@@ -63,16 +65,35 @@ int Cbuf::Write (const uint8_t *buf, int len)
   return written;
 }
 
-int Cbuf::Read (uint8_t *buf, int len)
+int Cbuf::Read (uint8_t *buf, int len, int timeout)
 {
   int read = 0, sz;
+  struct timespec ts;
+
+  // Calculate deadline (ms) if timeout set
+  if (timeout) {
+    clock_gettime (CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout / 1000;
+    ts.tv_nsec += (timeout % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000;
+    }
+  }
 
   // Lock mutex
   pthread_mutex_lock (&lock);
 
-  // Check data
-  if (!DataAvail ())
-    pthread_cond_wait (&data_avail, &lock);
+  // Wait for data
+  while (!DataAvail ()) {
+    if (!timeout)
+      pthread_cond_wait (&data_avail, &lock);
+    else if ((pthread_cond_timedwait (&data_avail, &lock, &ts) == ETIMEDOUT) &&
+             !DataAvail ()) {
+      pthread_mutex_unlock (&lock);
+      return CBUF_TIMEOUT;
+    }
+  }
   
   // Calculate size to copy
   if (ridx < widx)
@@ -13,6 +13,9 @@
 #include <stdint.h>
 #include "err.h"
 
+// Returned by Read on timeout
+#define CBUF_TIMEOUT  -1
+
 class Cbuf {
 
  private:
@@ -26,7 +29,7 @@ class Cbuf {
   
 public:
   int Write (const uint8_t *buf, int len);
-  int Read (uint8_t *buf, int len);
+  int Read (uint8_t *buf, int len, int timeout = 0);
   
   Cbuf (int size) {
     int rv;
@@ -8,6 +8,7 @@
 #include "TCPTransport.h"
 
 #include <arpa/inet.h>
+#include <poll.h>
 #include <sys/fcntl.h>
 #include <string.h>
 #include <stdlib.h>
@@ -16,6 +17,9 @@
 
 #define DEFAULT_PORT  7878
 
+// Max time to block in Read - bounds listener shutdown latency
+#define READ_POLL_MS  100
+
 TCPTransport::TCPTransport (void)
   : Transport ()
 {
@@ -133,10 +137,17 @@ void TCPTransport::Flush (void)
 int TCPTransport::Read (uint8_t *buf, int len)
 {
   int rv;
+  struct pollfd pfd = {sockfd, POLLIN, 0};
 
   // Grab lock - the entire read must be atomic
   pthread_mutex_lock (&rlock);
 
+  // Sleep until data arrives instead of spinning the listener
+  if (poll (&pfd, 1, READ_POLL_MS) <= 0) {
+    pthread_mutex_unlock (&rlock);
+    return 0;
+  }
+
   // Read from socket
   rv = read (sockfd, buf, len);
 
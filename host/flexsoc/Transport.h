@@ -21,7 +21,7 @@ class Transport {
     pthread_mutex_init (&rlock, NULL);
     pthread_mutex_init (&wlock, NULL);
   }
-  ~Transport () {}
+  virtual ~Transport () {}
 
   // Interface to be met
   virtual int Open (char *id) = 0;
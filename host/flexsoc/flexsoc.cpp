@@ -16,45 +16,98 @@
 #include "Cbuf.h"
 #include "log.h"
 
-// Two transfer rates
+// Two builtin link profiles
 // High speed for internal BRAM/Reg
 // Low speed for external bridge (SWD/JTAG)
 #define LOW_SPEED_SEND_SZ   9
 #define HIGH_SPEED_SEND_SZ  180
-#define WRITE_RECV_BUF_SZ   ((HIGH_SPEED_SEND_SZ * 5) / 2)
-#define READ_RECV_BUF_SZ    (HIGH_SPEED_SEND_SZ * 5)
+static const flexsoc_profile_t hispeed_profile = {16, HIGH_SPEED_SEND_SZ, 0, 0};
+static const flexsoc_profile_t lospeed_profile = {2, LOW_SPEED_SEND_SZ, 0, 0};
 
-static int read_send_sz;
-static int read_recv_sz;
-static int write_send_sz;
-static int write_recv_sz;
+// Profile limits
+#define PROFILE_MAX_DEPTH   16
+#define PROFILE_MAX_CHUNK   1024
+
+// Largest command per beat (cmd + addr + word)
+#define CMD_MAX_SZ          9
+
+// Device command FIFO depth if not reported/configured
+// Must match host rx FIFO in flexsoc_cm3.sv
+#define FIFO_DEPTH_DEFAULT  256
+
+// Largest slave reply (hdr + word)
+// Master traffic leaves room for one in the device FIFO, otherwise a CPU
+// stalled on a plugin access can't be answered until the master drains
+#define SLAVE_RESP_MAX      5
+
+// Address region with its own link profile
+typedef struct {
+  uint32_t base;
+  uint32_t size;
+  flexsoc_profile_t prof;
+} region_t;
 
 // Master buf size
 #define MBUF_SZ   (16 * 1024)
 
-// Local variables
-static Transport *dev = NULL;
-static pthread_t read_tid, slave_tid;
-static bool kill_thread = false;
+// Default beats per preemptible chunk
+// Bounds high lane wait to one chunk of bulk traffic
+#define CHUNK_BEATS  256
+
+// Per-device link state
+struct flexsoc_ctx {
+
+  // Transport and threads
+  Transport *dev;
+  pthread_t read_tid, slave_tid;
+  bool kill_thread;
+
+  // Circular buffer
+  Cbuf *mbuf;
+
+  // Transaction and response buffers
+  uint8_t *tbuf;
+  uint8_t *rbuf;
+
+  // Device command FIFO depth (command credits)
+  int fifo_depth;
+
+  // Protect outgoing writes
+  pthread_mutex_t write_lock, api_lock, slave_lock;
 
-// Circular buffer
-static Cbuf *mbuf;
+  // Master engine lane arbitration (protected by api_lock)
+  pthread_cond_t lane_cond;
+  bool busy;
+  int hi_wait;
+  int chunk_beats;
 
-// Ping-pong transaction buffers
-static uint8_t *tbuf[2];
+  // Callbacks for plugin interface
+  recv_cb_t recv_cb;
 
-// Protect outgoing writes
-static pthread_mutex_t write_lock, api_lock, slave_lock; 
+  // Return code - just store
+  int returncode;
 
-// Callbacks for plugin interface
-static recv_cb_t recv_cb = NULL;
+  // Slave packet data
+  uint8_t slave_pkt[9];
+  int slave_sz;
 
-// Return code - just store
-static int returncode = 0;
+  // Link profiles - default plus per address region
+  // Updates hold the lane (chunks keep profile pointers) and region_lock
+  // (lookups outside the lane)
+  flexsoc_profile_t def_prof;
+  region_t *region;
+  int region_cnt;
+  pthread_mutex_t region_lock;
+};
 
-// Slave packet data
-static uint8_t slave_pkt[9];
-static int slave_sz;
+// Context created by flexsoc_open ()
+static flexsoc_ctx *default_ctx = NULL;
+
+// Context bound to calling thread
+static thread_local flexsoc_ctx *bound_ctx = NULL;
+
+// Lane of calling thread
+static thread_local flexsoc_lane_t thread_lane = FLEXSOC_LANE_BULK;
 
 // Must match fifo_host_pkg.sv
 typedef enum {
@@ -122,23 +175,32 @@ static void dump (const char *str, const uint8_t *data, int len)
 
 static void *flexsoc_slave (void *arg)
 {
+  flexsoc_ctx *ctx = (flexsoc_ctx *)arg;
+
+  // Callbacks use default API - bind to our context
+  flexsoc_ctx_bind (ctx);
+
+  // Plugin traffic must not queue behind bulk transfers
+  flexsoc_lane (FLEXSOC_LANE_HIGH);
+
   while (1) {
 
     // Wait for transaction
-    pthread_mutex_lock (&slave_lock);
+    pthread_mutex_lock (&ctx->slave_lock);
 
     // Check if thread is killed
-    if (kill_thread)
+    if (ctx->kill_thread)
       return NULL;
 
     // Process transaction
-    if (recv_cb)
-      recv_cb (slave_pkt, slave_sz);
+    if (ctx->recv_cb)
+      ctx->recv_cb (ctx->slave_pkt, ctx->slave_sz);
   }
 }
 
 static void *flexsoc_listen (void *arg)
 {
+  flexsoc_ctx *ctx = (flexsoc_ctx *)arg;
   int rv, pread;
   uint8_t pkt[17];
   
@@ -146,12 +208,12 @@ static void *flexsoc_listen (void *arg)
   while (1) {
 
     // Read from target interface
-    rv = dev->Read (pkt, 1);
+    rv = ctx->dev->Read (pkt, 1);
 
     // Device closed - kill thread
-    if ((rv == DEVICE_NOTAVAIL) || kill_thread) {
+    if ((rv == DEVICE_NOTAVAIL) || ctx->kill_thread) {
       // Unblock slave mutex and return
-      pthread_mutex_unlock (&slave_lock);
+      pthread_mutex_unlock (&ctx->slave_lock);
       return NULL;
     }
     // Write to buffer
@@ -164,7 +226,7 @@ static void *flexsoc_listen (void *arg)
     
       // Read rest of packet
       while (pread < sz) {
-        rv = dev->Read (&pkt[1 + pread], sz - pread);
+        rv = ctx->dev->Read (&pkt[1 + pread], sz - pread);
         pread += rv;
       }
 
@@ -176,7 +238,7 @@ static void *flexsoc_listen (void *arg)
         int written = 0;
         
         while (written < sz + 1) {
-          rv = mbuf->Write (&pkt[written], sz + 1 - written);
+          rv = ctx->mbuf->Write (&pkt[written], sz + 1 - written);
           written += rv;
         }
       }
@@ -184,117 +246,202 @@ static void *flexsoc_listen (void *arg)
       else {
 
         // Copy to slave packet
-        memcpy (slave_pkt, pkt, sz + 1);
-        slave_sz = sz + 1;
+        memcpy (ctx->slave_pkt, pkt, sz + 1);
+        ctx->slave_sz = sz + 1;
 
         // Unblock slave thread
-        pthread_mutex_unlock (&slave_lock);
+        pthread_mutex_unlock (&ctx->slave_lock);
       }
     }
   }
 }
 
-
-int flexsoc_open (char *id)
+flexsoc_ctx *flexsoc_ctx_open (char *id)
 {
   int rv;
+  flexsoc_ctx *ctx;
+
+  // Allocate context
+  ctx = (flexsoc_ctx *)calloc (1, sizeof (flexsoc_ctx));
+  if (!ctx)
+    err ("Failed to malloc flexsoc_ctx");
   
   // If it looks like an IP address create TCP connection
   // Else try FTDI
   if (strchr (id, ':') || strchr (id, '.'))
-    dev = new TCPTransport ();
+    ctx->dev = new TCPTransport ();
   else
-    dev = new FTDITransport ();
+    ctx->dev = new FTDITransport ();
 
   // Default to high speed mode
-  flexsoc_hispeed (true);
+  ctx->def_prof = hispeed_profile;
   
   // Open transport
-  rv = dev->Open (id);
+  rv = ctx->dev->Open (id);
   if (rv)
     err ("Failed to open device: %s (rv=%d)", id, rv);
 
   // Create cirular buffer
-  mbuf = new Cbuf (MBUF_SZ);
+  ctx->mbuf = new Cbuf (MBUF_SZ);
 
   // Create slave lock and take lock
-  pthread_mutex_init (&slave_lock, NULL);
-  pthread_mutex_lock (&slave_lock);
+  pthread_mutex_init (&ctx->slave_lock, NULL);
+  pthread_mutex_lock (&ctx->slave_lock);
   
   // Create write lock (mux master/slave)
-  pthread_mutex_init (&write_lock, NULL);
-
-  // API lock
-  pthread_mutex_init (&api_lock, NULL);
-
-  // Malloc tbuf
-  tbuf[0] = (uint8_t *)malloc (HIGH_SPEED_SEND_SZ * 5);
-  tbuf[1] = (uint8_t *)malloc (HIGH_SPEED_SEND_SZ * 5);
-  if (!tbuf[0] || (!tbuf[1]))
+  pthread_mutex_init (&ctx->write_lock, NULL);
+
+  // API lock and lanes
+  pthread_mutex_init (&ctx->api_lock, NULL);
+  pthread_cond_init (&ctx->lane_cond, NULL);
+  pthread_mutex_init (&ctx->region_lock, NULL);
+  ctx->chunk_beats = CHUNK_BEATS;
+
+  // Malloc tbuf/rbuf - responses owed never exceed mbuf
+  ctx->tbuf = (uint8_t *)malloc (PROFILE_MAX_CHUNK * CMD_MAX_SZ);
+  ctx->rbuf = (uint8_t *)malloc (MBUF_SZ);
+  if (!ctx->tbuf || !ctx->rbuf)
     err ("Failed to malloc tbuf");
+  ctx->fifo_depth = FIFO_DEPTH_DEFAULT;
 
   // Create slave thread
-  rv = pthread_create (&slave_tid, NULL, &flexsoc_slave, NULL);
+  rv = pthread_create (&ctx->slave_tid, NULL, &flexsoc_slave, ctx);
   if (rv)
     err ("Failed to spawn flexsoc thread!");
 
   // Spin up thread to read transport
-  rv = pthread_create (&read_tid, NULL, &flexsoc_listen, NULL);
+  rv = pthread_create (&ctx->read_tid, NULL, &flexsoc_listen, ctx);
   if (rv)
     err ("Failed to spawn flexsoc thread!");
 
   // Success
-  return 0;
+  return ctx;
 }
 
-void flexsoc_send (const uint8_t *buf, int len)
+flexsoc_ctx *flexsoc_ctx_bind (flexsoc_ctx *ctx)
+{
+  flexsoc_ctx *prev = bound_ctx;
+  bound_ctx = ctx;
+  return prev;
+}
+
+flexsoc_lane_t flexsoc_lane (flexsoc_lane_t lane)
+{
+  flexsoc_lane_t prev = thread_lane;
+  thread_lane = lane;
+  return prev;
+}
+
+void flexsoc_ctx_chunk (flexsoc_ctx *ctx, int beats)
+{
+  ctx->chunk_beats = (beats > 0) ? beats : CHUNK_BEATS;
+}
+
+static void lane_acquire (flexsoc_ctx *ctx)
+{
+  bool hi = (thread_lane == FLEXSOC_LANE_HIGH);
+
+  pthread_mutex_lock (&ctx->api_lock);
+
+  // High lane goes next, bulk waits for high lane to drain
+  if (hi)
+    ctx->hi_wait++;
+  while (ctx->busy || (!hi && ctx->hi_wait))
+    pthread_cond_wait (&ctx->lane_cond, &ctx->api_lock);
+  if (hi)
+    ctx->hi_wait--;
+
+  // Own the master engine
+  ctx->busy = true;
+  pthread_mutex_unlock (&ctx->api_lock);
+}
+
+static void lane_release (flexsoc_ctx *ctx)
+{
+  pthread_mutex_lock (&ctx->api_lock);
+  ctx->busy = false;
+  pthread_cond_broadcast (&ctx->lane_cond);
+  pthread_mutex_unlock (&ctx->api_lock);
+}
+
+flexsoc_ctx *flexsoc_ctx_current (void)
+{
+  return bound_ctx ? bound_ctx : default_ctx;
+}
+
+void flexsoc_ctx_send (flexsoc_ctx *ctx, const uint8_t *buf, int len)
 {
   int rv, written = 0;
   // Lock write mutex
-  pthread_mutex_lock (&write_lock);
-  if (dev) {
+  pthread_mutex_lock (&ctx->write_lock);
+  if (ctx->dev) {
     dump ("=>", (uint8_t *)buf, len);
     while (written < len) {
-      rv = dev->Write (buf, len);
+      rv = ctx->dev->Write (buf, len);
       if (rv < 0) {
         err ("flexsoc_send() failed");
       }
       written += rv;
     }
   }
-  pthread_mutex_unlock (&write_lock);
+  pthread_mutex_unlock (&ctx->write_lock);
 }
 
-static int flexsoc_recv (uint8_t *buf, int len)
+// Returns -1 on timeout - caller decides if that is fatal
+static int flexsoc_recv (flexsoc_ctx *ctx, uint8_t *buf, int len, int timeout)
 {
   int read = 0, rv;
 
   while (read < len) {
-    rv = mbuf->Read (&buf[read], len - read);
+    rv = ctx->mbuf->Read (&buf[read], len - read, timeout);
+    if (rv == CBUF_TIMEOUT) {
+      log (LOG_ERR, "Response timeout: %d/%d bytes after %dms", read, len, timeout);
+      return -1;
+    }
     read += rv;
   }
   return read;
 }
 
-void flexsoc_close (void)
+// Drop late responses after a timeout so the next transfer starts in sync
+static void flexsoc_resync (flexsoc_ctx *ctx, int timeout)
+{
+  while (ctx->mbuf->Read (ctx->rbuf, MBUF_SZ, timeout) != CBUF_TIMEOUT)
+    ;
+}
+
+void flexsoc_ctx_close (flexsoc_ctx *ctx)
 {
+  if (!ctx)
+    return;
+
   // Kill thread
-  kill_thread = true;
+  ctx->kill_thread = true;
   
   // Wait for threads
-  pthread_join (read_tid, NULL);
-  pthread_join (slave_tid, NULL);
+  pthread_join (ctx->read_tid, NULL);
+  pthread_join (ctx->slave_tid, NULL);
   
   // Close transport
-  if (dev)
-    dev->Close ();
+  if (ctx->dev) {
+    ctx->dev->Close ();
+    delete ctx->dev;
+  }
 
   // Free buffers
-  free (tbuf[0]);
-  free (tbuf[1]);
+  free (ctx->tbuf);
+  free (ctx->rbuf);
+  free (ctx->region);
 
   // Free cbuf
-  delete mbuf;
+  delete ctx->mbuf;
+
+  // Drop any references
+  if (ctx == default_ctx)
+    default_ctx = NULL;
+  if (ctx == bound_ctx)
+    bound_ctx = NULL;
+  free (ctx);
 }
 
 static void host16_to_buf (uint8_t *buf, const uint8_t *host)
@@ -317,18 +464,21 @@ static void buf_to_host32 (uint8_t *host, const uint8_t *buf)
   *((uint32_t *)host) = ntohl (*((uint32_t *)buf));
 }
 
-static int read_process (uint8_t width, uint8_t *data, int rcnt)
+// Returns beats the device failed or -1 on timeout
+static int read_process (flexsoc_ctx *ctx, const flexsoc_profile_t *prof,
+                         uint8_t width, uint8_t *data, int rcnt)
 {
-  int i, read = 0;
-  uint8_t rbuf[READ_RECV_BUF_SZ];
+  int i, read = 0, fail = 0;
+  uint8_t *rbuf = ctx->rbuf;
 
   // Read results
-  flexsoc_recv (rbuf, rcnt);
+  if (flexsoc_recv (ctx, rbuf, rcnt, prof->timeout) < 0)
+    return -1;
   for (i = 0; i < (rcnt / (1 + width)); i++) {
     
     // Verify there wasn't an error
     if (rbuf[i * (1 + width)] & 1)
-      err ("Read failed: %02X", rbuf[i * (1 + width)]);
+      fail++;
 
     // Convert back to host endian
     switch (width) {
@@ -340,259 +490,783 @@ static int read_process (uint8_t width, uint8_t *data, int rcnt)
     // Increment read
     read += width;
   }
-  
-  // Return read
-  return read;
+  if (fail)
+    log (LOG_ERR, "Read failed: %d/%d beats", fail, i);
+  return fail;
 }
 
-static int write_process (int rcnt)
+// Returns beats the device failed or -1 on timeout
+static int write_process (flexsoc_ctx *ctx, const flexsoc_profile_t *prof, int rcnt)
 {
-  int i, written = 0;
-  uint8_t rbuf[WRITE_RECV_BUF_SZ];
+  int i, fail = 0;
+  uint8_t *rbuf = ctx->rbuf;
 
   // Read results
-  flexsoc_recv (rbuf, rcnt);
+  if (flexsoc_recv (ctx, rbuf, rcnt, prof->timeout) < 0)
+    return -1;
   for (i = 0; i < rcnt; i++) {
     
     // Verify there wasn't an error
     if (rbuf[i] & 1)
-      err ("Write failed: %02X", rbuf[i]);    
-    
-    // Increment read
-    written++;
+      fail++;
   }
-  
-  // Return read
-  return written;
+  if (fail)
+    log (LOG_ERR, "Write failed: %d/%d beats", fail, rcnt);
+  return fail;
 }
 
-static int flexsoc_read (uint8_t width, uint32_t addr, uint8_t *data, int len)
+// Find profile for address. Returns beats of width until profile may change.
+static const flexsoc_profile_t *profile_find (flexsoc_ctx *ctx, uint32_t addr,
+                                              uint8_t width, int *beats)
 {
-  int rv, i, bi = 0, idx = 0, read = 0;
-  bool process = false;
-  int rcnt[2] = {0, 0};
-  
-  // Handle empty reads
-  if (len <= 0)
+  int i;
+  uint64_t end = 1ULL << 32;
+  const flexsoc_profile_t *prof = &ctx->def_prof;
+
+  // Later regions take precedence
+  for (i = ctx->region_cnt - 1; i >= 0; i--) {
+    region_t *r = &ctx->region[i];
+    if ((addr >= r->base) && (addr < (uint64_t)r->base + r->size)) {
+      prof = &r->prof;
+      end = (uint64_t)r->base + r->size;
+      break;
+    }
+  }
+
+  // Stop at start of any region above us
+  for (i = 0; i < ctx->region_cnt; i++)
+    if ((ctx->region[i].base > addr) && (ctx->region[i].base < end))
+      end = ctx->region[i].base;
+
+  // At least one beat - clamp before narrowing
+  end = (end - addr) / width;
+  if (end > INT32_MAX)
+    end = INT32_MAX;
+  *beats = (end < 1) ? 1 : (int)end;
+  return prof;
+}
+
+// Master pipeline state for one chunk
+//
+// Credits bound what is outstanding on the link:
+//   cmd_out  - command bytes sent without a response yet. Only a response
+//              proves the device consumed a command, so this never exceeds
+//              the device command FIFO depth less a slave reply.
+//   resp_out - response bytes still owed. Stays below mbuf size so the
+//              listener never fills it.
+// Commands are sent whenever credits allow. When they run out, responses
+// are drained to half the window before sending resumes.
+typedef struct {
+  const flexsoc_profile_t *prof;
+  bool write;
+  uint8_t width;
+  uint8_t *data;
+  int done;       // Beats completed
+  int sent;       // Beats queued
+  int cmd_out;    // Command credits in use
+  int resp_out;   // Response bytes owed
+  int fail;       // Beats the device failed
+} pipe_t;
+
+static int pipe_cmd_sz (pipe_t *p, int beat)
+{
+  return (beat ? 1 : 5) + (p->write ? p->width : 0);
+}
+
+static int pipe_resp_sz (pipe_t *p)
+{
+  return p->write ? 1 : 1 + p->width;
+}
+
+// Command bytes allowed in flight - headroom for a slave reply
+static int cmd_window (flexsoc_ctx *ctx)
+{
+  int window = ctx->fifo_depth - SLAVE_RESP_MAX;
+  return (window < CMD_MAX_SZ) ? CMD_MAX_SZ : window;
+}
+
+// Complete oldest beats until within limits - returns -1 on timeout
+static int pipe_drain (flexsoc_ctx *ctx, pipe_t *p, int cmd_lim, int resp_lim, int beat_lim)
+{
+  int rv;
+  int n = 0, cmd = p->cmd_out, resp = p->resp_out;
+
+  // Count beats to complete
+  while ((p->done + n < p->sent) &&
+         ((cmd > cmd_lim) || (resp > resp_lim) || (p->sent - p->done - n > beat_lim))) {
+    cmd -= pipe_cmd_sz (p, p->done + n);
+    resp -= pipe_resp_sz (p);
+    n++;
+  }
+  if (!n)
     return 0;
 
-  // Lock API lock
-  pthread_mutex_lock (&api_lock);
-  
+  // Process responses
+  if (p->write)
+    rv = write_process (ctx, p->prof, n);
+  else
+    rv = read_process (ctx, p->prof, p->width, &p->data[p->done * p->width],
+                       n * pipe_resp_sz (p));
+  if (rv < 0)
+    return -1;
+  p->fail += rv;
+
+  // Return credits
+  p->done += n;
+  p->cmd_out = cmd;
+  p->resp_out = resp;
+  return 0;
+}
+
+static int xfer_chunk (flexsoc_ctx *ctx, const flexsoc_profile_t *prof, bool write,
+                       uint8_t width, uint32_t addr, uint8_t *data, int len)
+{
+  int i, csz, rsz, idx = 0, pend = 0;
+  int window = cmd_window (ctx);
+  int beats = prof->depth * prof->chunk;
+  uint8_t *tbuf = ctx->tbuf;
+  pipe_t p = {prof, write, width, data, 0, 0, 0, 0, 0};
+
   // Set read/write size
-  dev->WriteSize (read_send_sz);
-  dev->ReadSize (read_recv_sz);
+  rsz = pipe_resp_sz (&p);
+  ctx->dev->WriteSize (prof->chunk * pipe_cmd_sz (&p, 1) + 4);
+  ctx->dev->ReadSize (prof->chunk * rsz);
 
-  // Read all data
   for (i = 0; i < len; i++) {
-
-    // If we've hit buffer size then flush
-    if (idx == read_send_sz) {        
-      flexsoc_send (tbuf[bi], idx);
-      bi = !bi; // Switch buffers
-      if (!bi) // Start processing responses
-        process = true;
-      idx = 0;
-
-      // If we've already sent two buffers then start processing
-      if (process) {
-        read += read_process (width, &data[read], rcnt[bi]);
-        rcnt[bi] = 0;
+    csz = pipe_cmd_sz (&p, i);
+
+    // Out of credits - send pending and wait for responses
+    if ((p.cmd_out + csz > window) ||
+        (p.resp_out + rsz >= MBUF_SZ) ||
+        (p.sent - p.done + 1 > beats)) {
+      if (idx) {
+        flexsoc_ctx_send (ctx, tbuf, idx);
+        idx = pend = 0;
       }
+      if (pipe_drain (ctx, &p, window / 2, MBUF_SZ / 2, beats / 2))
+        goto timeout;
     }
 
-    // Send full read with address
+    // Send full command with address
     if (i == 0) {
-      tbuf[bi][idx] = CMD_INTERFACE_MASTER | payload2cmd (4) | CMD_READ | CMD_WIDTH (width);
-      idx++;
-      host32_to_buf (&tbuf[bi][idx], (uint8_t *)&addr);
+      tbuf[idx++] = CMD_INTERFACE_MASTER | CMD_WIDTH (width) |
+        (write ? (payload2cmd (4 + width) | CMD_WRITE) : (payload2cmd (4) | CMD_READ));
+      host32_to_buf (&tbuf[idx], (uint8_t *)&addr);
       idx += 4;
     }
 
-    // Send incrementing read after first command
-    else {
-      tbuf[bi][idx] = CMD_INTERFACE_MASTER | payload2cmd (0) | CMD_READ | CMD_AUTOINC | CMD_WIDTH (width);
-      idx++;
+    // Send incrementing command after first
+    else
+      tbuf[idx++] = CMD_INTERFACE_MASTER | CMD_AUTOINC | CMD_WIDTH (width) |
+        (write ? (payload2cmd (width) | CMD_WRITE) : (payload2cmd (0) | CMD_READ));
+
+    // Copy data to write buffer
+    if (write) {
+      switch (width) {
+        case 1: tbuf[idx] = data[i]; break;
+        case 2: host16_to_buf (&tbuf[idx], &data[i * width]); break;
+        case 4: host32_to_buf (&tbuf[idx], &data[i * width]); break;
+      }
+      idx += width;
     }
 
-    // Update bytes expected back
-    rcnt[bi] += (1 + width);
+    // Take credits
+    p.cmd_out += csz;
+    p.resp_out += rsz;
+    p.sent++;
+
+    // Send when buffer full
+    if (++pend == prof->chunk) {
+      flexsoc_ctx_send (ctx, tbuf, idx);
+      idx = pend = 0;
+    }
   }
-  
-  // Flush any remaining data
-  if (idx != 0)
-    flexsoc_send (tbuf[bi], idx);
-  
-  // Process any remaining data
-  if (rcnt[!bi])
-    read += read_process (width, &data[read], rcnt[!bi]);
-  if (rcnt[bi])
-    read += read_process (width, &data[read], rcnt[bi]);
-  
-  // Unlock API lock
-  pthread_mutex_unlock (&api_lock);
-  
+
+  // Flush and wait for everything
+  if (idx)
+    flexsoc_ctx_send (ctx, tbuf, idx);
+  if (pipe_drain (ctx, &p, 0, 0, 0))
+    goto timeout;
+
+  // Device errors don't desync the link - report once all beats are done
+  return p.fail ? -1 : 0;
+
+ timeout:
+  flexsoc_resync (ctx, prof->timeout);
+  return -1;
+}
+
+// Vectored pipeline state - same credits as pipe_t
+// Every op is a full command with its own address and width
+typedef struct {
+  const flexsoc_profile_t *prof;
+  flexsoc_vec_t *vec;
+  int done;       // Ops completed
+  int sent;       // Ops queued
+  int cmd_out;    // Command credits in use
+  int resp_out;   // Response bytes owed
+  int fail;       // Ops the device failed
+} vpipe_t;
+
+static int vec_width (const flexsoc_vec_t *v)
+{
+  return v->width ? v->width : 4;
+}
+
+static int vec_cmd_sz (const flexsoc_vec_t *v)
+{
+  return v->write ? 5 + vec_width (v) : 5;
+}
+
+static int vec_resp_sz (const flexsoc_vec_t *v)
+{
+  return v->write ? 1 : 1 + vec_width (v);
+}
+
+// Strict regions only take aligned accesses of their width
+static bool vec_allowed (const flexsoc_profile_t *prof, const flexsoc_vec_t *v)
+{
+  return !prof->strict ||
+    ((vec_width (v) == prof->strict) && !(v->addr & (prof->strict - 1)));
+}
+
+// Complete oldest ops until within limits - returns -1 on timeout
+static int vec_drain (flexsoc_ctx *ctx, vpipe_t *p, int cmd_lim, int resp_lim, int op_lim)
+{
+  int i, idx = 0, rcnt = 0, n = p->done;
+  int cmd = p->cmd_out, resp = p->resp_out;
+  uint8_t *rbuf = ctx->rbuf;
+
+  // Count ops to complete
+  while ((n < p->sent) &&
+         ((cmd > cmd_lim) || (resp > resp_lim) || (p->sent - n > op_lim))) {
+    cmd -= vec_cmd_sz (&p->vec[n]);
+    resp -= vec_resp_sz (&p->vec[n]);
+    rcnt += vec_resp_sz (&p->vec[n]);
+    n++;
+  }
+  if (n == p->done)
+    return 0;
+
+  // Read results
+  if (flexsoc_recv (ctx, rbuf, rcnt, p->prof->timeout) < 0)
+    return -1;
+  for (i = p->done; i < n; i++) {
+
+    // Verify there wasn't an error
+    p->vec[i].ok = !(rbuf[idx] & 1);
+    if (!p->vec[i].ok) {
+      log (LOG_ERR, "%s failed: %08X", p->vec[i].write ? "Write" : "Read", p->vec[i].addr);
+      p->fail++;
+    }
+    idx++;
+
+    // Convert back to host endian
+    if (!p->vec[i].write) {
+      switch (vec_width (&p->vec[i])) {
+        case 1: p->vec[i].data = rbuf[idx]; break;
+        case 2: p->vec[i].data = (rbuf[idx] << 8) | rbuf[idx + 1]; break;
+        case 4: buf_to_host32 ((uint8_t *)&p->vec[i].data, &rbuf[idx]); break;
+      }
+      idx += vec_width (&p->vec[i]);
+    }
+  }
+
+  // Return credits
+  p->done = n;
+  p->cmd_out = cmd;
+  p->resp_out = resp;
+  return 0;
+}
+
+// Returns ops the device failed or -1 on timeout
+static int xfer_vec (flexsoc_ctx *ctx, const flexsoc_profile_t *prof,
+                     flexsoc_vec_t *vec, int cnt)
+{
+  int i, csz, rsz, width, idx = 0, pend = 0;
+  int window = cmd_window (ctx);
+  int ops = prof->depth * prof->chunk;
+  uint8_t *tbuf = ctx->tbuf;
+  vpipe_t p = {prof, vec, 0, 0, 0, 0, 0};
+
+  // Set read/write size
+  ctx->dev->WriteSize (prof->chunk * 9 + 4);
+  ctx->dev->ReadSize (prof->chunk * 5);
+
+  for (i = 0; i < cnt; i++) {
+    csz = vec_cmd_sz (&vec[i]);
+    rsz = vec_resp_sz (&vec[i]);
+
+    // Out of credits - send pending and wait for responses
+    if ((p.cmd_out + csz > window) ||
+        (p.resp_out + rsz >= MBUF_SZ) ||
+        (p.sent - p.done + 1 > ops)) {
+      if (idx) {
+        flexsoc_ctx_send (ctx, tbuf, idx);
+        idx = pend = 0;
+      }
+      if (vec_drain (ctx, &p, window / 2, MBUF_SZ / 2, ops / 2))
+        goto timeout;
+    }
+
+    // Full command with address
+    width = vec_width (&vec[i]);
+    tbuf[idx++] = CMD_INTERFACE_MASTER | CMD_WIDTH (width) |
+      (vec[i].write ? (payload2cmd (4 + width) | CMD_WRITE) : (payload2cmd (4) | CMD_READ));
+    host32_to_buf (&tbuf[idx], (uint8_t *)&vec[i].addr);
+    idx += 4;
+    if (vec[i].write) {
+      switch (width) {
+        case 1: tbuf[idx] = vec[i].data; break;
+        case 2: tbuf[idx] = vec[i].data >> 8; tbuf[idx + 1] = vec[i].data; break;
+        case 4: host32_to_buf (&tbuf[idx], (uint8_t *)&vec[i].data); break;
+      }
+      idx += width;
+    }
+
+    // Take credits
+    p.cmd_out += csz;
+    p.resp_out += rsz;
+    p.sent++;
+
+    // Send when buffer full
+    if (++pend == prof->chunk) {
+      flexsoc_ctx_send (ctx, tbuf, idx);
+      idx = pend = 0;
+    }
+  }
+
+  // Flush and wait for everything
+  if (idx)
+    flexsoc_ctx_send (ctx, tbuf, idx);
+  if (vec_drain (ctx, &p, 0, 0, 0))
+    goto timeout;
+
+  // Ops are independent - a failed op doesn't stop the rest
+  return p.fail;
+
+ timeout:
+  flexsoc_resync (ctx, prof->timeout);
+  return -1;
+}
+
+static int flexsoc_read (flexsoc_ctx *ctx, uint8_t width, uint32_t addr, uint8_t *data, int len)
+{
+  int i, n, lim, rv;
+  const flexsoc_profile_t *prof;
+
+  // Handle empty reads
+  if (len <= 0)
+    return 0;
+
+  // Split into chunks so high lane can preempt between them
+  // Chunks never span regions so each uses a single profile
+  for (i = 0; i < len; i += n) {
+    lane_acquire (ctx);
+    prof = profile_find (ctx, addr + (i * width), width, &lim);
+    n = (len - i > ctx->chunk_beats) ? ctx->chunk_beats : len - i;
+    if (n > lim)
+      n = lim;
+    rv = xfer_chunk (ctx, prof, false, width, addr + (i * width), &data[i * width], n);
+    lane_release (ctx);
+    if (rv)
+      return -1;
+  }
+
   // Return success
   return 0;
 }
 
-static int flexsoc_write (uint8_t width, uint32_t addr, const uint8_t *data, int len)
+static int flexsoc_write (flexsoc_ctx *ctx, uint8_t width, uint32_t addr, const uint8_t *data, int len)
 {
-  int rv, i, bi = 0, idx = 0, written = 0;
-  bool process = false;
-  int rcnt[2] = {0, 0};
-  
+  int i, n, lim, rv;
+  const flexsoc_profile_t *prof;
+
   // Ignore empty writes
   if (len <= 0)
     return 0;
-  
-  // Lock API lock
-  pthread_mutex_lock (&api_lock);
 
-  // Set read/write size
-  dev->WriteSize (write_send_sz);
-  dev->ReadSize (write_recv_sz);
+  // Split into chunks so high lane can preempt between them
+  // Chunks never span regions so each uses a single profile
+  for (i = 0; i < len; i += n) {
+    lane_acquire (ctx);
+    prof = profile_find (ctx, addr + (i * width), width, &lim);
+    n = (len - i > ctx->chunk_beats) ? ctx->chunk_beats : len - i;
+    if (n > lim)
+      n = lim;
+    rv = xfer_chunk (ctx, prof, true, width, addr + (i * width), (uint8_t *)&data[i * width], n);
+    lane_release (ctx);
+    if (rv)
+      return -1;
+  }
 
-  // Loop over data to write
-  for (i = 0; i < len; i++) {
+  // Return success
+  return 0;
+}
+
+// Below this size a single byte transfer beats split round trips
+#define MEMCPY_MIN_SPLIT  16
 
-    // If we've hit buffer size then flush
-    if (idx + 1 + width > write_send_sz) {
-      flexsoc_send (tbuf[bi], idx);
-      bi = !bi; // Switch buffers
-      idx = 0;
-      if (!bi) // Start processing responses
-        process = true;
-
-      // If we've already sent two buffers then start processing
-      if (process) {
-        written += write_process (rcnt[bi]);
-        rcnt[bi] = 0;
+// Plan access widths for byte range
+//
+// Ranges are split at region boundaries. Strict regions only use their
+// declared width. Elsewhere byte/halfword heads align to a word middle and
+// the remaining tail goes as one byte transfer.
+static int flexsoc_memcpy (flexsoc_ctx *ctx, bool write, uint32_t addr, uint8_t *data, int len)
+{
+  int n, lim, width, cnt;
+  int strict;
+
+  while (len > 0) {
+
+    // Get access width of region - doesn't need the lane
+    pthread_mutex_lock (&ctx->region_lock);
+    strict = profile_find (ctx, addr, 1, &lim)->strict;
+    pthread_mutex_unlock (&ctx->region_lock);
+    n = (len > lim) ? lim : len;
+
+    // Strict region must be aligned to width
+    if (strict) {
+      if ((addr | n) & (strict - 1)) {
+        log (LOG_ERR, "Unaligned access to strict region: %08X+%d", addr, n);
+        return -1;
       }
+      width = strict;
+      cnt = n / strict;
     }
-
-    // Send full write with address
-    if (i == 0) {
-      tbuf[bi][idx] = CMD_INTERFACE_MASTER | payload2cmd (4 + width) | CMD_WRITE | CMD_WIDTH (width);
-      idx++;
-      host32_to_buf (&tbuf[bi][idx], (uint8_t *)&addr);
-      idx += 4;
+    // Short copy - single byte transfer
+    else if (n < MEMCPY_MIN_SPLIT) {
+      width = 1;
+      cnt = n;
     }
-
-    // Send incrementing write after first command
-    else {
-      tbuf[bi][idx] = CMD_INTERFACE_MASTER | payload2cmd (width) |
-        CMD_WRITE | CMD_AUTOINC | CMD_WIDTH (width);
-      idx++;
+    // Byte head
+    else if (addr & 1) {
+      width = 1;
+      cnt = 1;
     }
-
-    // Copy data to write buffer
-    switch (width) {
-      case 1: tbuf[bi][idx] = data[i]; break;
-      case 2: host16_to_buf (&tbuf[bi][idx], &data[i * width]); break;
-      case 4: host32_to_buf (&tbuf[bi][idx], &data[i * width]); break;
+    // Halfword head
+    else if (addr & 2) {
+      width = 2;
+      cnt = 1;
+    }
+    // Word aligned middle
+    else {
+      width = 4;
+      cnt = n / 4;
     }
 
-    // Update idx
-    idx += width;
-    
-    // Update bytes expected back
-    rcnt[bi] += 1;
+    // Transfer
+    if (write ? flexsoc_write (ctx, width, addr, data, cnt) :
+        flexsoc_read (ctx, width, addr, data, cnt))
+      return -1;
+    addr += width * cnt;
+    data += width * cnt;
+    len -= width * cnt;
   }
-  
-  // Flush any remaining data
-  if (idx != 0)
-    flexsoc_send (tbuf[bi], idx);
-    
-  // Process any remaining data
-  if (rcnt[!bi])
-    written += write_process (rcnt[!bi]);
-  if (rcnt[bi])
-    written += write_process (rcnt[bi]);
-
-  // Unlock API lock
-  pthread_mutex_unlock (&api_lock);
-  
+
   // Return success
   return 0;
 }
 
-int flexsoc_readw (uint32_t addr, uint32_t *data, int len)
+int flexsoc_ctx_memcpy_to (flexsoc_ctx *ctx, uint32_t addr, const void *src, int len)
 {
-  return flexsoc_read (4, addr, (uint8_t *)data, len);
+  return flexsoc_memcpy (ctx, true, addr, (uint8_t *)src, len);
 }
 
-int flexsoc_readh (uint32_t addr, uint16_t *data, int len)
+int flexsoc_ctx_memcpy_from (flexsoc_ctx *ctx, void *dst, uint32_t addr, int len)
 {
-  return flexsoc_read (2, addr, (uint8_t *)data, len);
+  return flexsoc_memcpy (ctx, false, addr, (uint8_t *)dst, len);
 }
 
-int flexsoc_readb (uint32_t addr, uint8_t *data, int len)
+int flexsoc_ctx_readw (flexsoc_ctx *ctx, uint32_t addr, uint32_t *data, int len)
 {
-  return flexsoc_read (1, addr, (uint8_t *)data, len);
+  return flexsoc_read (ctx, 4, addr, (uint8_t *)data, len);
 }
 
-int flexsoc_writew (uint32_t addr, const uint32_t *data, int len)
+int flexsoc_ctx_readh (flexsoc_ctx *ctx, uint32_t addr, uint16_t *data, int len)
 {
-  return flexsoc_write (4, addr, (const uint8_t *)data, len);
+  return flexsoc_read (ctx, 2, addr, (uint8_t *)data, len);
 }
 
-int flexsoc_writeh (uint32_t addr, const uint16_t *data, int len)
+int flexsoc_ctx_readb (flexsoc_ctx *ctx, uint32_t addr, uint8_t *data, int len)
 {
-  return flexsoc_write (2, addr, (const uint8_t *)data, len);
+  return flexsoc_read (ctx, 1, addr, (uint8_t *)data, len);
 }
 
-int flexsoc_writeb (uint32_t addr, const uint8_t *data, int len)
+int flexsoc_ctx_writew (flexsoc_ctx *ctx, uint32_t addr, const uint32_t *data, int len)
 {
-  return flexsoc_write (1, addr, (const uint8_t *)data, len);
+  return flexsoc_write (ctx, 4, addr, (const uint8_t *)data, len);
 }
 
-uint32_t flexsoc_reg_read (uint32_t addr)
+int flexsoc_ctx_writeh (flexsoc_ctx *ctx, uint32_t addr, const uint16_t *data, int len)
+{
+  return flexsoc_write (ctx, 2, addr, (const uint8_t *)data, len);
+}
+
+int flexsoc_ctx_writeb (flexsoc_ctx *ctx, uint32_t addr, const uint8_t *data, int len)
+{
+  return flexsoc_write (ctx, 1, addr, (const uint8_t *)data, len);
+}
+
+int flexsoc_ctx_vec (flexsoc_ctx *ctx, flexsoc_vec_t *vec, int cnt)
+{
+  int i, n, max, lim, fail, rv = 0;
+  const flexsoc_profile_t *prof;
+
+  // Ops not reached stay failed
+  for (i = 0; i < cnt; i++)
+    vec[i].ok = false;
+
+  // Split into chunks so high lane can preempt between them
+  // Chunks end where an op falls in another region so each uses one profile
+  for (i = 0; i < cnt; i += n) {
+    lane_acquire (ctx);
+    max = (cnt - i > ctx->chunk_beats) ? ctx->chunk_beats : cnt - i;
+    prof = profile_find (ctx, vec[i].addr, vec_width (&vec[i]), &lim);
+
+    // Refused op fails on its own
+    if (!vec_allowed (prof, &vec[i])) {
+      lane_release (ctx);
+      log (LOG_ERR, "Invalid access to strict region: %08X:%d",
+           vec[i].addr, vec_width (&vec[i]));
+      n = 1;
+      rv = -1;
+      continue;
+    }
+    for (n = 1; n < max; n++)
+      if ((profile_find (ctx, vec[i + n].addr, vec_width (&vec[i + n]), &lim) != prof) ||
+          !vec_allowed (prof, &vec[i + n]))
+        break;
+    fail = xfer_vec (ctx, prof, &vec[i], n);
+    lane_release (ctx);
+
+    // Link stopped responding - later ops aren't sent
+    if (fail < 0)
+      return -1;
+    if (fail)
+      rv = -1;
+  }
+  return rv;
+}
+
+uint32_t flexsoc_ctx_reg_read (flexsoc_ctx *ctx, uint32_t addr)
 {
   int rv;
   uint32_t val;
-  rv = flexsoc_readw (addr, &val, 1);
+  rv = flexsoc_ctx_readw (ctx, addr, &val, 1);
   if (rv)
     err ("Reg read failed: %08X", addr);
   return val;
 }
 
-void flexsoc_reg_write (uint32_t addr, const uint32_t data)
+void flexsoc_ctx_reg_write (flexsoc_ctx *ctx, uint32_t addr, const uint32_t data)
 {
   int rv;
-  rv = flexsoc_writew (addr, &data, 1);
+  rv = flexsoc_ctx_writew (ctx, addr, &data, 1);
   if (rv)
     err ("Reg write failed: %08X", addr);
 }
 
+void flexsoc_ctx_register (flexsoc_ctx *ctx, recv_cb_t cb)
+{
+  ctx->recv_cb = cb;
+}
+
+void flexsoc_ctx_unregister (flexsoc_ctx *ctx)
+{
+  ctx->recv_cb = NULL;
+}
+
+int flexsoc_ctx_read_returnval (flexsoc_ctx *ctx)
+{
+  return ctx->returncode;
+}
+
+void flexsoc_ctx_write_returnval (flexsoc_ctx *ctx, int val)
+{
+  ctx->returncode = val;
+}
+
+void flexsoc_ctx_hispeed (flexsoc_ctx *ctx, bool en)
+{
+  flexsoc_ctx_profile (ctx, en ? &hispeed_profile : &lospeed_profile);
+}
+
+static int profile_check (const flexsoc_profile_t *prof)
+{
+  if (!prof ||
+      (prof->depth < 1) || (prof->depth > PROFILE_MAX_DEPTH) ||
+      (prof->chunk < 1) || (prof->chunk > PROFILE_MAX_CHUNK) ||
+      (prof->timeout < 0) ||
+      ((prof->strict != 0) && (prof->strict != 1) &&
+       (prof->strict != 2) && (prof->strict != 4)))
+    return -1;
+  return 0;
+}
+
+int flexsoc_ctx_profile (flexsoc_ctx *ctx, const flexsoc_profile_t *prof)
+{
+  if (profile_check (prof))
+    return -1;
+
+  // Update between chunks
+  lane_acquire (ctx);
+  pthread_mutex_lock (&ctx->region_lock);
+  ctx->def_prof = *prof;
+  pthread_mutex_unlock (&ctx->region_lock);
+  lane_release (ctx);
+  return 0;
+}
+
+int flexsoc_ctx_region (flexsoc_ctx *ctx, uint32_t base, uint32_t size,
+                        const flexsoc_profile_t *prof)
+{
+  region_t *r;
+
+  if (!size || profile_check (prof))
+    return -1;
+
+  // Update between chunks
+  lane_acquire (ctx);
+  pthread_mutex_lock (&ctx->region_lock);
+  r = (region_t *)realloc (ctx->region, sizeof (region_t) * (ctx->region_cnt + 1));
+  if (!r)
+    err ("Failed to malloc region");
+  ctx->region = r;
+  r = &ctx->region[ctx->region_cnt++];
+  r->base = base;
+  r->size = size;
+  r->prof = *prof;
+  pthread_mutex_unlock (&ctx->region_lock);
+  lane_release (ctx);
+  return 0;
+}
+
+void flexsoc_ctx_fifo_depth (flexsoc_ctx *ctx, int bytes)
+{
+  lane_acquire (ctx);
+  ctx->fifo_depth = (bytes > 0) ? bytes : FIFO_DEPTH_DEFAULT;
+  lane_release (ctx);
+}
+
+void flexsoc_ctx_region_clear (flexsoc_ctx *ctx)
+{
+  lane_acquire (ctx);
+  pthread_mutex_lock (&ctx->region_lock);
+  free (ctx->region);
+  ctx->region = NULL;
+  ctx->region_cnt = 0;
+  pthread_mutex_unlock (&ctx->region_lock);
+  lane_release (ctx);
+}
+
+const flexsoc_profile_t *flexsoc_profile_builtin (bool hispeed)
+{
+  return hispeed ? &hispeed_profile : &lospeed_profile;
+}
+
+//
+// Default context wrappers
+//
+
+static flexsoc_ctx *current (void)
+{
+  flexsoc_ctx *ctx = flexsoc_ctx_current ();
+  if (!ctx)
+    err ("flexsoc not open");
+  return ctx;
+}
+
+int flexsoc_open (char *id)
+{
+  // Only one default context
+  if (default_ctx)
+    return -1;
+  default_ctx = flexsoc_ctx_open (id);
+  return 0;
+}
+
+void flexsoc_close (void)
+{
+  flexsoc_ctx_close (default_ctx);
+}
+
+void flexsoc_send (const uint8_t *buf, int len)
+{
+  flexsoc_ctx_send (current (), buf, len);
+}
+
+int flexsoc_readw (uint32_t addr, uint32_t *data, int len)
+{
+  return flexsoc_ctx_readw (current (), addr, data, len);
+}
+
+int flexsoc_readh (uint32_t addr, uint16_t *data, int len)
+{
+  return flexsoc_ctx_readh (current (), addr, data, len);
+}
+
+int flexsoc_readb (uint32_t addr, uint8_t *data, int len)
+{
+  return flexsoc_ctx_readb (current (), addr, data, len);
+}
+
+int flexsoc_writew (uint32_t addr, const uint32_t *data, int len)
+{
+  return flexsoc_ctx_writew (current (), addr, data, len);
+}
+
+int flexsoc_writeh (uint32_t addr, const uint16_t *data, int len)
+{
+  return flexsoc_ctx_writeh (current (), addr, data, len);
+}
+
+int flexsoc_writeb (uint32_t addr, const uint8_t *data, int len)
+{
+  return flexsoc_ctx_writeb (current (), addr, data, len);
+}
+
+int flexsoc_memcpy_to (uint32_t addr, const void *src, int len)
+{
+  return flexsoc_ctx_memcpy_to (current (), addr, src, len);
+}
+
+int flexsoc_memcpy_from (void *dst, uint32_t addr, int len)
+{
+  return flexsoc_ctx_memcpy_from (current (), dst, addr, len);
+}
+
+uint32_t flexsoc_reg_read (uint32_t addr)
+{
+  return flexsoc_ctx_reg_read (current (), addr);
+}
+
+void flexsoc_reg_write (uint32_t addr, const uint32_t data)
+{
+  flexsoc_ctx_reg_write (current (), addr, data);
+}
+
 void flexsoc_register (recv_cb_t cb)
 {
-  recv_cb = cb;
+  flexsoc_ctx_register (current (), cb);
 }
 
 void flexsoc_unregister (void)
 {
-  recv_cb = NULL;
+  flexsoc_ctx_unregister (current ());
 }
 
 int flexsoc_read_returnval (void)
 {
-  return returncode;
+  return flexsoc_ctx_read_returnval (current ());
 }
+
 void flexsoc_write_returnval (int val)
 {
-  returncode = val;
+  flexsoc_ctx_write_returnval (current (), val);
 }
 
 void flexsoc_hispeed (bool en)
 {
-  if (en)
-    read_send_sz = HIGH_SPEED_SEND_SZ;
-  else
-    read_send_sz = LOW_SPEED_SEND_SZ;
-
-  // Derive the others
-  write_send_sz = read_send_sz * 5;
-  write_recv_sz = write_send_sz / 2;
-  read_recv_sz = read_send_sz * 5;
+  flexsoc_ctx_hispeed (current (), en);
 }
@@ -1,7 +1,15 @@
 /**
- *  flexsoc communication library. Send/receive commands to flexsoc using 
+ *  flexsoc communication library. Send/receive commands to flexsoc using
  *  various transport layers.
  *
+ *  Each device is driven through its own flexsoc_ctx which owns the transport,
+ *  listener/slave threads and locks. Multiple contexts can be open at once and
+ *  driven from independent threads.
+ *
+ *  The original flexsoc_xxx API is kept as a thin wrapper. It operates on the
+ *  context bound to the calling thread, falling back to the default context
+ *  created by flexsoc_open (). Slave callbacks run with their context bound.
+ *
  *  All rights reserved.
  *  Tiny Labs Inc.
  *  2020
@@ -11,9 +19,116 @@
 
 #include <stdint.h>
 
+// Opaque per-device context
+typedef struct flexsoc_ctx flexsoc_ctx;
+
 // Callback for slave interface
 typedef void (*recv_cb_t) (uint8_t *buf, int len);
 
+// Master transfer lanes
+// Bulk transfers are split into chunks. A pending high lane request is
+// served before the next bulk chunk, so its wait is bounded by one chunk.
+// Slave callbacks (plugins) run on the high lane.
+typedef enum {
+  FLEXSOC_LANE_BULK = 0,
+  FLEXSOC_LANE_HIGH = 1,
+} flexsoc_lane_t;
+
+// Link profile - how master transfers are pipelined
+// Commands in flight are further limited by the device FIFO depth
+typedef struct {
+  int depth;    // Transaction buffers in flight [1, 16]
+  int chunk;    // Max commands per transaction buffer [1, 1024]
+  int timeout;  // Response timeout in ms (0 = wait forever)
+  int strict;   // Only access with this width [1, 2, 4] (0 = any)
+} flexsoc_profile_t;
+
+//
+// Context interface
+//
+flexsoc_ctx *flexsoc_ctx_open (char *id);
+void flexsoc_ctx_close (flexsoc_ctx *ctx);
+
+// Bind context to calling thread for default API calls
+// Returns previous binding (NULL if unbound) so it can be restored
+flexsoc_ctx *flexsoc_ctx_bind (flexsoc_ctx *ctx);
+
+// Get context used by default API on calling thread
+flexsoc_ctx *flexsoc_ctx_current (void);
+
+// Set lane for master transfers from calling thread
+// Returns previous lane so it can be restored
+flexsoc_lane_t flexsoc_lane (flexsoc_lane_t lane);
+
+// Set beats per preemptible chunk (<= 0 restores default)
+void flexsoc_ctx_chunk (flexsoc_ctx *ctx, int beats);
+
+// Raw interface
+void flexsoc_ctx_send (flexsoc_ctx *ctx, const uint8_t *buf, int len);
+
+// Master read/write interface
+// Transfers return -1 on device error or if the device stops responding
+// within profile timeout - the link stays usable either way
+int flexsoc_ctx_readw (flexsoc_ctx *ctx, uint32_t addr, uint32_t *data, int len);
+int flexsoc_ctx_readh (flexsoc_ctx *ctx, uint32_t addr, uint16_t *data, int len);
+int flexsoc_ctx_readb (flexsoc_ctx *ctx, uint32_t addr, uint8_t  *data, int len);
+int flexsoc_ctx_writew (flexsoc_ctx *ctx, uint32_t addr, const uint32_t *data, int len);
+int flexsoc_ctx_writeh (flexsoc_ctx *ctx, uint32_t addr, const uint16_t *data, int len);
+int flexsoc_ctx_writeb (flexsoc_ctx *ctx, uint32_t addr, const uint8_t  *data, int len);
+
+// Vectored access - independent commands pipelined in one stream
+// Each op carries its own address and width. Results are collected in order.
+// Ops in a strict region must use its width. Ops are independent - one the
+// device fails or a strict region refuses doesn't stop the rest. Returns -1
+// if any op failed, check ok per op. A timeout fails all ops not yet done.
+typedef struct {
+  uint32_t addr;
+  uint32_t data;    // Write data or read result (zero extended)
+  bool     write;
+  uint8_t  width;   // 1, 2 or 4 bytes (0 = word)
+  bool     ok;      // Set when op completed
+} flexsoc_vec_t;
+int flexsoc_ctx_vec (flexsoc_ctx *ctx, flexsoc_vec_t *vec, int cnt);
+
+// Copy arbitrary byte ranges using widest access possible
+int flexsoc_ctx_memcpy_to (flexsoc_ctx *ctx, uint32_t addr, const void *src, int len);
+int flexsoc_ctx_memcpy_from (flexsoc_ctx *ctx, void *dst, uint32_t addr, int len);
+
+// Simplified register access
+uint32_t flexsoc_ctx_reg_read (flexsoc_ctx *ctx, uint32_t addr);
+void flexsoc_ctx_reg_write (flexsoc_ctx *ctx, uint32_t addr, const uint32_t data);
+
+// Register fn pointer with slave interface
+void flexsoc_ctx_register (flexsoc_ctx *ctx, recv_cb_t cb);
+void flexsoc_ctx_unregister (flexsoc_ctx *ctx);
+
+// Read/write return code
+int flexsoc_ctx_read_returnval (flexsoc_ctx *ctx);
+void flexsoc_ctx_write_returnval (flexsoc_ctx *ctx, int val);
+
+// Enable/disable high speed mode (selects builtin default profile)
+void flexsoc_ctx_hispeed (flexsoc_ctx *ctx, bool en);
+
+// Set profile for addresses outside any region
+int flexsoc_ctx_profile (flexsoc_ctx *ctx, const flexsoc_profile_t *prof);
+
+// Add profile for address region - later regions take precedence
+// Transfers are split at region boundaries
+int flexsoc_ctx_region (flexsoc_ctx *ctx, uint32_t base, uint32_t size,
+                        const flexsoc_profile_t *prof);
+void flexsoc_ctx_region_clear (flexsoc_ctx *ctx);
+
+// Set device command FIFO depth in bytes (<= 0 restores default)
+// Bounds command bytes in flight (credits)
+void flexsoc_ctx_fifo_depth (flexsoc_ctx *ctx, int bytes);
+
+// Builtin high/low speed profiles
+const flexsoc_profile_t *flexsoc_profile_builtin (bool hispeed);
+
+//
+// Default context interface
+//
+
 // Open/close flexsoc
 int flexsoc_open (char *id);
 void flexsoc_close (void);
@@ -31,6 +146,10 @@ int flexsoc_writew (uint32_t addr, const uint32_t *data, int len);
 int flexsoc_writeh (uint32_t addr, const uint16_t *data, int len);
 int flexsoc_writeb (uint32_t addr, const uint8_t  *data, int len);
 
+// Copy arbitrary byte ranges using widest access possible
+int flexsoc_memcpy_to (uint32_t addr, const void *src, int len);
+int flexsoc_memcpy_from (void *dst, uint32_t addr, int len);
+
 // Simplified register access
 uint32_t flexsoc_reg_read (uint32_t addr);
 void flexsoc_reg_write (uint32_t addr, const uint32_t data);
@@ -0,0 +1,33 @@
+/**
+ *  Scoped CSR access. The autogen CSR accessors go through the default
+ *  flexsoc API, so the owning link is bound to the calling thread for the
+ *  lifetime of one expression and the previous binding restored after:
+ *
+ *    Csr ()->cpu_reset (1);
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#ifndef CSRREF_H
+#define CSRREF_H
+
+#include "flexsoc.h"
+#include "flexsoc_csr.h"
+
+class CsrRef {
+
+ private:
+  flexsoc_csr *csr;
+  flexsoc_ctx *prev;
+
+ public:
+  CsrRef (flexsoc_csr *csr, flexsoc_ctx *ctx)
+    : csr (csr), prev (flexsoc_ctx_bind (ctx)) {}
+  ~CsrRef () { flexsoc_ctx_bind (prev); }
+  CsrRef (const CsrRef &) = delete;
+  CsrRef &operator= (const CsrRef &) = delete;
+  flexsoc_csr *operator-> (void) { return csr; }
+};
+
+#endif /* CSRREF_H */
@@ -0,0 +1,29 @@
+/**
+ *  Scoped lane selection. Master transfers from the calling thread ride
+ *  the given lane for the lifetime of the guard and the previous lane is
+ *  restored after:
+ *
+ *    LaneRef lane (FLEXSOC_LANE_HIGH);
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#ifndef LANEREF_H
+#define LANEREF_H
+
+#include "flexsoc.h"
+
+class LaneRef {
+
+ private:
+  flexsoc_lane_t prev;
+
+ public:
+  LaneRef (flexsoc_lane_t lane) : prev (flexsoc_lane (lane)) {}
+  ~LaneRef () { flexsoc_lane (prev); }
+  LaneRef (const LaneRef &) = delete;
+  LaneRef &operator= (const LaneRef &) = delete;
+};
+
+#endif /* LANEREF_H */
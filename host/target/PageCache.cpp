@@ -0,0 +1,346 @@
+/**
+ *  Host page cache over master memory accesses
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <string.h>
+#include <stdlib.h>
+
+#include "PageCache.h"
+#include "err.h"
+
+// Direct link access with caller width
+static int link_xfer (flexsoc_ctx *ctx, bool write, uint32_t addr, uint8_t *buf,
+                      uint32_t len, int width)
+{
+  switch (width) {
+    case 1:
+      return write ? flexsoc_ctx_writeb (ctx, addr, buf, len) :
+        flexsoc_ctx_readb (ctx, addr, buf, len);
+    case 2:
+      return write ? flexsoc_ctx_writeh (ctx, addr, (uint16_t *)buf, len / 2) :
+        flexsoc_ctx_readh (ctx, addr, (uint16_t *)buf, len / 2);
+    case 4:
+      return write ? flexsoc_ctx_writew (ctx, addr, (uint32_t *)buf, len / 4) :
+        flexsoc_ctx_readw (ctx, addr, (uint32_t *)buf, len / 4);
+    default:
+      return write ? flexsoc_ctx_memcpy_to (ctx, addr, buf, len) :
+        flexsoc_ctx_memcpy_from (ctx, buf, addr, len);
+  }
+}
+
+PageCache::PageCache (flexsoc_ctx *ctx)
+{
+  this->ctx = ctx;
+  pthread_mutex_init (&lock, NULL);
+  page = (cache_page_t *)calloc (CACHE_SETS * CACHE_WAYS, sizeof (cache_page_t));
+  if (!page)
+    err ("Failed to malloc");
+}
+
+PageCache::~PageCache ()
+{
+  pthread_mutex_destroy (&lock);
+  free (page);
+}
+
+int PageCache::Region (uint32_t base, uint32_t size, cache_mode_t mode)
+{
+  if ((region_cnt == CACHE_REGIONS) || !size ||
+      ((base | size) & (CACHE_PAGE - 1)) ||
+      ((uint64_t)base + size > 0x100000000ULL))
+    return -1;
+
+  pthread_mutex_lock (&lock);
+  region[region_cnt].base = base;
+  region[region_cnt].size = size;
+  region[region_cnt].mode = mode;
+  region_cnt++;
+  pthread_mutex_unlock (&lock);
+
+  // Drop anything cached under the old rules
+  return Invalidate (base, size);
+}
+
+bool PageCache::Enabled (void)
+{
+  return region_cnt != 0;
+}
+
+// Page address to cacheability - later regions take precedence
+bool PageCache::Cacheable (uint32_t pg)
+{
+  int i;
+
+  for (i = region_cnt - 1; i >= 0; i--) {
+    if ((pg < region[i].base) || (pg - region[i].base >= region[i].size))
+      continue;
+    return (region[i].mode == CACHE_ROM) ||
+      ((region[i].mode == CACHE_RAM) && halted);
+  }
+  return false;
+}
+
+// Any cacheable page in range
+bool PageCache::Covers (uint32_t addr, uint32_t len)
+{
+  uint64_t end = (uint64_t)addr + len;
+  uint64_t pg;
+
+  if (!region_cnt || !len)
+    return false;
+
+  // Walk pages unless range is large - then defer to the copy loop
+  if (len > CACHE_FILL * CACHE_PAGE)
+    return true;
+  for (pg = addr & ~(CACHE_PAGE - 1); pg < end; pg += CACHE_PAGE)
+    if (Cacheable (pg))
+      return true;
+  return false;
+}
+
+cache_page_t *PageCache::Lookup (uint32_t pg)
+{
+  cache_page_t *set = &page[((pg / CACHE_PAGE) % CACHE_SETS) * CACHE_WAYS];
+  int i;
+
+  for (i = 0; i < CACHE_WAYS; i++)
+    if (set[i].valid && (set[i].addr == pg)) {
+      set[i].lru = ++stamp;
+      return &set[i];
+    }
+  return NULL;
+}
+
+// Claim free or least recently used way - contents undefined
+cache_page_t *PageCache::Alloc (uint32_t pg)
+{
+  cache_page_t *set = &page[((pg / CACHE_PAGE) % CACHE_SETS) * CACHE_WAYS];
+  cache_page_t *p = &set[0];
+  int i;
+
+  for (i = 0; i < CACHE_WAYS; i++) {
+    if (!set[i].valid) {
+      p = &set[i];
+      break;
+    }
+    if (set[i].lru < p->lru)
+      p = &set[i];
+  }
+
+  // Evict
+  if (p->valid && WriteBack (p))
+    return NULL;
+  p->addr = pg;
+  p->valid = true;
+  p->lru = ++stamp;
+  p->lo = p->hi = 0;
+  return p;
+}
+
+int PageCache::WriteBack (cache_page_t *p)
+{
+  if (p->lo == p->hi)
+    return 0;
+  if (flexsoc_ctx_memcpy_to (ctx, p->addr + p->lo, p->data + p->lo, p->hi - p->lo))
+    return -1;
+  p->lo = p->hi = 0;
+  return 0;
+}
+
+int PageCache::Read (uint32_t addr, void *data, uint32_t len, int width)
+{
+  uint8_t *buf = (uint8_t *)data;
+  cache_page_t *p;
+  uint32_t pg, off, n, cnt, i;
+  int rv = 0;
+
+  if (!Covers (addr, len))
+    return 1;
+
+  pthread_mutex_lock (&lock);
+  while (len && !rv) {
+    pg = addr & ~(CACHE_PAGE - 1);
+    off = addr - pg;
+    n = CACHE_PAGE - off;
+
+    // Uncached run goes to link in one transfer
+    if (!Cacheable (pg)) {
+      while ((n < len) && !Cacheable (addr + n))
+        n += CACHE_PAGE;
+      if (n > len)
+        n = len;
+      rv = link_xfer (ctx, false, addr, buf, n, width);
+    }
+    // Hit
+    else if ((p = Lookup (pg))) {
+      if (n > len)
+        n = len;
+      memcpy (buf, p->data + off, n);
+      hits++;
+    }
+    // Fetch run of missing pages in one transfer
+    else {
+      for (cnt = 1; (cnt < CACHE_FILL) && (cnt * CACHE_PAGE - off < len); cnt++)
+        if (!Cacheable (pg + cnt * CACHE_PAGE) || Lookup (pg + cnt * CACHE_PAGE))
+          break;
+      rv = flexsoc_ctx_memcpy_from (ctx, fill, pg, cnt * CACHE_PAGE);
+      for (i = 0; (i < cnt) && !rv; i++) {
+        p = Alloc (pg + i * CACHE_PAGE);
+        if (!p)
+          rv = -1;
+        else
+          memcpy (p->data, &fill[i * CACHE_PAGE], CACHE_PAGE);
+      }
+      n = cnt * CACHE_PAGE - off;
+      if (n > len)
+        n = len;
+      memcpy (buf, &fill[off], n);
+      misses += cnt;
+    }
+    addr += n;
+    buf += n;
+    len -= n;
+  }
+  pthread_mutex_unlock (&lock);
+  return rv ? -1 : 0;
+}
+
+int PageCache::Write (uint32_t addr, const void *data, uint32_t len, int width)
+{
+  uint8_t *buf = (uint8_t *)data;
+  cache_page_t *p;
+  uint32_t pg, off, n;
+  int rv = 0;
+
+  if (!Covers (addr, len))
+    return 1;
+
+  pthread_mutex_lock (&lock);
+  while (len && !rv) {
+    pg = addr & ~(CACHE_PAGE - 1);
+    off = addr - pg;
+    n = CACHE_PAGE - off;
+
+    // Uncached run goes to link in one transfer
+    if (!Cacheable (pg)) {
+      while ((n < len) && !Cacheable (addr + n))
+        n += CACHE_PAGE;
+      if (n > len)
+        n = len;
+      rv = link_xfer (ctx, true, addr, buf, n, width);
+    }
+    else {
+      if (n > len)
+        n = len;
+
+      // Update cached or fully overwritten page, write partial misses through.
+      // A running CPU fetches ROM behind our back - write through then too
+      p = Lookup (pg);
+      if (!p && (n == CACHE_PAGE) && halted) {
+        p = Alloc (pg);
+        if (!p) {
+          rv = -1;
+          break;
+        }
+      }
+      if (p)
+        memcpy (p->data + off, buf, n);
+      if (p && halted) {
+        if (p->lo == p->hi) {
+          p->lo = off;
+          p->hi = off + n;
+        }
+        else {
+          if (off < p->lo)
+            p->lo = off;
+          if (off + n > p->hi)
+            p->hi = off + n;
+        }
+      }
+      else
+        rv = link_xfer (ctx, true, addr, buf, n, width);
+    }
+    addr += n;
+    buf += n;
+    len -= n;
+  }
+  pthread_mutex_unlock (&lock);
+  return rv ? -1 : 0;
+}
+
+int PageCache::Flush (void)
+{
+  int i, rv = 0;
+
+  pthread_mutex_lock (&lock);
+  for (i = 0; i < CACHE_SETS * CACHE_WAYS; i++)
+    if (page[i].valid && WriteBack (&page[i]))
+      rv = -1;
+  pthread_mutex_unlock (&lock);
+  return rv;
+}
+
+// Caller holds lock
+int PageCache::Drop (uint32_t base, uint32_t size, bool ram_only)
+{
+  int i, rv = 0;
+
+  for (i = 0; i < CACHE_SETS * CACHE_WAYS; i++) {
+    cache_page_t *p = &page[i];
+    if (!p->valid)
+      continue;
+
+    // Range filter
+    if (size && (((uint64_t)p->addr + CACHE_PAGE <= base) ||
+                 (p->addr >= (uint64_t)base + size)))
+      continue;
+
+    // RAM pages are the only ones not cacheable once running
+    if (ram_only && Cacheable (p->addr))
+      continue;
+    if (WriteBack (p))
+      rv = -1;
+    p->valid = false;
+  }
+  return rv;
+}
+
+int PageCache::Invalidate (uint32_t base, uint32_t size)
+{
+  int rv;
+
+  pthread_mutex_lock (&lock);
+  rv = Drop (base, size, false);
+  pthread_mutex_unlock (&lock);
+  return rv;
+}
+
+int PageCache::Halt (bool halt)
+{
+  int i, rv = 0;
+
+  pthread_mutex_lock (&lock);
+  halted = halt;
+
+  // Running CPU owns RAM - hand over our writes and forget its contents
+  if (!halt) {
+    for (i = 0; i < CACHE_SETS * CACHE_WAYS; i++)
+      if (page[i].valid && WriteBack (&page[i]))
+        rv = -1;
+    if (Drop (0, 0, true))
+      rv = -1;
+  }
+  pthread_mutex_unlock (&lock);
+  return rv;
+}
+
+void PageCache::Stats (uint64_t *hits, uint64_t *misses)
+{
+  pthread_mutex_lock (&lock);
+  *hits = this->hits;
+  *misses = this->misses;
+  pthread_mutex_unlock (&lock);
+}
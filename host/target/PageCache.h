@@ -0,0 +1,103 @@
+/**
+ *  Host page cache over master memory accesses. Tools that repeatedly
+ *  inspect target memory are served from host copies instead of the link.
+ *
+ *  Cacheability is declared per region:
+ *    CACHE_ROM - always cached
+ *    CACHE_RAM - cached while the CPU is halted (held in reset)
+ *  Everything else (peripherals, remote bridge) goes to the link.
+ *
+ *  Writes to cached pages are held until written back: on eviction, Flush,
+ *  Invalidate or when the CPU is released. While the CPU runs, ROM page
+ *  writes update the copy and go straight to the link. Partial page writes
+ *  that miss go straight to the link without allocating.
+ *
+ *  Only accesses through Target are cached, master access server clients
+ *  included. Plugins use the link directly - invalidate ranges they modify.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "flexsoc.h"
+
+// Cache geometry - 4 way set associative
+#define CACHE_PAGE     1024
+#define CACHE_SETS     256
+#define CACHE_WAYS     4
+#define CACHE_FILL     16        // Max pages fetched per miss
+#define CACHE_REGIONS  16
+
+typedef enum {
+  CACHE_NONE = 0,   // Never cached (peripherals)
+  CACHE_ROM,        // Always cached
+  CACHE_RAM,        // Cached while CPU halted
+} cache_mode_t;
+
+typedef struct {
+  uint32_t base;
+  uint32_t size;
+  cache_mode_t mode;
+} cache_region_t;
+
+typedef struct {
+  uint32_t addr;
+  uint32_t lru;       // Last use stamp
+  bool     valid;
+  uint16_t lo, hi;    // Dirty bytes [lo, hi) - clean if equal
+  uint8_t  data[CACHE_PAGE];
+} cache_page_t;
+
+class PageCache {
+
+ private:
+  flexsoc_ctx *ctx;
+  pthread_mutex_t lock;
+  cache_region_t region[CACHE_REGIONS];
+  int region_cnt = 0;
+  cache_page_t *page;
+  uint32_t stamp = 0;
+  bool halted = true;
+  uint64_t hits = 0, misses = 0;
+  uint8_t fill[CACHE_FILL * CACHE_PAGE];
+
+  bool Cacheable (uint32_t pg);
+  bool Covers (uint32_t addr, uint32_t len);
+  cache_page_t *Lookup (uint32_t pg);
+  cache_page_t *Alloc (uint32_t pg);
+  int WriteBack (cache_page_t *p);
+  int Drop (uint32_t base, uint32_t size, bool ram_only);
+
+ public:
+  PageCache (flexsoc_ctx *ctx);
+  ~PageCache ();
+
+  // Declare region cacheability - base/size must be page aligned
+  int Region (uint32_t base, uint32_t size, cache_mode_t mode);
+  bool Enabled (void);
+
+  // Access through cache - width 1/2/4 or 0 for widest access possible
+  // Returns 1 if no part of range is cacheable (caller goes to link),
+  // 0 on success or -1 on link failure
+  int Read (uint32_t addr, void *data, uint32_t len, int width);
+  int Write (uint32_t addr, const void *data, uint32_t len, int width);
+
+  // Write back all dirty pages
+  int Flush (void);
+
+  // Write back and drop pages overlapping range (size 0 = everything)
+  int Invalidate (uint32_t base, uint32_t size);
+
+  // CPU run state - releasing the CPU writes back and drops RAM pages
+  int Halt (bool halt);
+
+  void Stats (uint64_t *hits, uint64_t *misses);
+};
+
+#endif /* PAGECACHE_H */
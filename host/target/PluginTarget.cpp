@@ -9,14 +9,20 @@
 #include <unistd.h>
 
 #include "PluginTarget.h"
+#include "CsrRef.h"
+#include "LaneRef.h"
 
 #include "hwreg.h"
 #include "flexsoc.h"
 #include "err.h"
 #include "log.h"
 
-PluginTarget::PluginTarget (void)
+PluginTarget::PluginTarget (flexsoc_ctx *ctx)
 {
+  // Link plugins talk over
+  this->ctx = ctx;
+
+  // Accessors use the link bound to the calling thread - see Csr ()
   csr = new flexsoc_csr (CSR_BASE, &flexsoc_reg_read, &flexsoc_reg_write);
   if (!csr)
     err ("Failed to inst flesoc_csr");
@@ -30,49 +36,96 @@ PluginTarget::~PluginTarget ()
   delete csr;
 }
 
+CsrRef PluginTarget::Csr (void)
+{
+  return CsrRef (csr, ctx);
+}
+
+// Plugin and IRQ traffic always rides the high lane - LaneRef restores
+// the caller's lane on return
 uint32_t PluginTarget::ReadW (uint32_t addr)
 {
-  return flexsoc_reg_read (addr);
+  LaneRef lane (FLEXSOC_LANE_HIGH);
+  return flexsoc_ctx_reg_read (ctx, addr);
 }
 
 void PluginTarget::WriteW (uint32_t addr, uint32_t data, uint32_t mask)
 {
   uint8_t bval;
   uint16_t hval;
+  int rv = 0;
+
+  // Use high lane
+  LaneRef lane (FLEXSOC_LANE_HIGH);
   
   // Decode mask
   switch (mask) {
     // Handle byte accesses
     case 0xff:
       bval = data & 0xff;
-      flexsoc_writeb (addr, &bval, 1);
+      rv = flexsoc_ctx_writeb (ctx, addr, &bval, 1);
       break;
     case 0xff00:
       bval = (data >> 8) & 0xff;
-      flexsoc_writeb (addr + 1, &bval, 1);
+      rv = flexsoc_ctx_writeb (ctx, addr + 1, &bval, 1);
       break;
     case 0xff0000:
       bval = (data >> 16) & 0xff;
-      flexsoc_writeb (addr + 2, &bval, 1);
+      rv = flexsoc_ctx_writeb (ctx, addr + 2, &bval, 1);
       break;
     case 0xff000000:
       bval = (data >> 24) & 0xff;
-      flexsoc_writeb (addr + 3, &bval, 1);
+      rv = flexsoc_ctx_writeb (ctx, addr + 3, &bval, 1);
       break;
     // Handle hword accesses
     case 0xffff:
       hval = data & 0xffff;
-      flexsoc_writeh (addr, &hval, 1);
+      rv = flexsoc_ctx_writeh (ctx, addr, &hval, 1);
       break;
     case 0xffff0000:
       hval = (data  >> 16) & 0xffff;
-      flexsoc_writeh (addr + 2, &hval, 1);
+      rv = flexsoc_ctx_writeh (ctx, addr + 2, &hval, 1);
       break;      
     // Handle word accesses
     case 0xffffffff:
-      flexsoc_writew (addr, &data, 1);
+      rv = flexsoc_ctx_writew (ctx, addr, &data, 1);
       break;
   }
+  if (rv)
+    err ("flexsoc_write failed!");
+}
+
+void PluginTarget::MemcpyFrom (void *dst, uint32_t addr, uint32_t len)
+{
+  // Block reads are chunked on the bulk lane so they never hold up
+  // slave/IRQ traffic on the high lane
+  LaneRef lane (FLEXSOC_LANE_BULK);
+  if (flexsoc_ctx_memcpy_from (ctx, dst, addr, len))
+    err ("flexsoc_memcpy_from failed!");
+}
+
+bool PluginTarget::RemoteAHBEn (void)
+{
+  LaneRef lane (FLEXSOC_LANE_HIGH);
+  return Csr ()->brg_ahb_en ();
+}
+
+uint32_t PluginTarget::RemoteBase (void)
+{
+  LaneRef lane (FLEXSOC_LANE_HIGH);
+  return Csr ()->brg_base ();
+}
+
+uint8_t PluginTarget::RemoteClkDiv (void)
+{
+  LaneRef lane (FLEXSOC_LANE_HIGH);
+  return Csr ()->brg_clkdiv ();
+}
+
+void PluginTarget::RemoteClkDiv (uint8_t div)
+{
+  LaneRef lane (FLEXSOC_LANE_HIGH);
+  Csr ()->brg_clkdiv (div & 0x1f);
 }
 
 void PluginTarget::Log (uint8_t lvl, const char *fmt, ...)
@@ -95,25 +148,28 @@ void PluginTarget::Fail (const char *fmt, ...)
 
 void PluginTarget::IRQ (uint32_t n)
 {
-  csr->irq_edge (n >> 5, 1 << (n & 0x1f));
+  LaneRef lane (FLEXSOC_LANE_HIGH);
+  Csr ()->irq_edge (n >> 5, 1 << (n & 0x1f));
 }
 
 void PluginTarget::IRQSet (uint8_t n)
 {
-  csr->irq_level (n >> 5, 1 << (n & 0x1f));
+  LaneRef lane (FLEXSOC_LANE_HIGH);
+  Csr ()->irq_level (n >> 5, 1 << (n & 0x1f));
 }
 
 void PluginTarget::IRQClr (uint8_t n)
 {
-  uint32_t cur = csr->irq_level (n >> 5);
+  LaneRef lane (FLEXSOC_LANE_HIGH);
+  uint32_t cur = Csr ()->irq_level (n >> 5);
   cur &= ~(1 << (n & 0x1f));
-  csr->irq_level (n >> 5, cur);
+  Csr ()->irq_level (n >> 5, cur);
 }
 
 void PluginTarget::Exit (int status)
 {
   // Set return code
-  flexsoc_write_returnval (status);
+  flexsoc_ctx_write_returnval (ctx, status);
 
   // Send host interrupt to stop
   pthread_kill (host_tid, SIGINT);
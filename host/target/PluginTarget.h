@@ -11,13 +11,17 @@
 #ifndef PLUGINTARGET_H
 #define PLUGINTARGET_H
 
+class CsrRef;
+
 class PluginTarget {
 
  private:
+  struct flexsoc_ctx *ctx;
   flexsoc_csr *csr;
   pthread_t host_tid;
+  CsrRef Csr (void);
  public:
-  PluginTarget (void);
+  PluginTarget (struct flexsoc_ctx *ctx);
   ~PluginTarget ();
   // IRQ access
   void IRQ (uint32_t irq);
@@ -26,6 +30,13 @@ class PluginTarget {
   // Memory space access
   uint32_t ReadW (uint32_t addr);
   void WriteW (uint32_t addr, uint32_t data, uint32_t mask);
+  // Pipelined block read - rides the bulk lane
+  void MemcpyFrom (void *dst, uint32_t addr, uint32_t len);
+  // Remote bridge - divisor applies from the next SWD transaction
+  bool RemoteAHBEn (void);
+  uint32_t RemoteBase (void);
+  uint8_t RemoteClkDiv (void);
+  void RemoteClkDiv (uint8_t div);
   // Log data
   void Log (uint8_t lvl, const char *fmt, ...);
   // For unit testing
@@ -5,6 +5,8 @@
  *  Tiny Labs Inc
  *  2020
  */
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "Target.h"
@@ -16,32 +18,161 @@
 // Singleton pointer
 Target *Target::inst = NULL;
 
-Target::Target (char *id)
+// DP registers
+#define DP_IDCODE     0x0
+#define DP_ABORT      0x0
+#define DP_CTRLSTAT   0x4
+#define DP_SELECT     0x8
+#define DP_RDBUFF     0xc
+
+// DP CTRL/STAT and ABORT bits
+#define STICKYERR     (1 << 5)
+#define STKERRCLR     (1 << 2)
+
+// MEM-AP registers
+#define AP_CSW        0x0
+#define AP_TAR        0x4
+#define AP_DRW        0xc
+
+// CSW for word access (with single auto-increment)
+#define CSW_WORD      0xA2000002
+#define CSW_WORD_INC  0xA2000012
+
+// MEM-AP banked data registers - access TAR[31:4] + n*4
+#define AP_BD0        0x10
+#define AP_BD1        0x14
+#define AP_BD2        0x18
+
+// Core debug registers
+#define SCB_DHCSR     0xE000EDF0
+#define SCB_DCRSR     0xE000EDF4
+#define SCB_DCRDR     0xE000EDF8
+#define REGWnR        (1 << 16)
+#define S_REGRDY      (1 << 16)
+#define S_HALT        (1 << 17)
+
+// DCRSR selector for each core_regs_t word
+static const uint8_t core_regsel[CORE_REG_CNT] = {
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+  16, 17, 18, 20
+};
+
+// TAR auto-increment is only guaranteed within a 1KB block
+#define TAR_WRAP      1024
+
+// brg_ctrl fields
+#define BRG_START     (1 << 0)
+#define BRG_WRITE     (1 << 1)
+#define BRG_AP        (1 << 4)
+
+// Queued bridge ops
+// Each op is sent as [write data] write ctrl, done polls, [read data], read
+// stat. Polls are sized so the op completes before the next one is sent.
+#define QUEUE_OPS     128
+#define POLL_MAX      16
+
+struct brg_op {
+  uint8_t  ctrl;     // brg_ctrl without START
+  uint32_t data;     // Write data or read result
+  uint8_t  stat;     // Bridge status after op
+  bool     late;     // Op outlasted its polls
+  int      res;      // Transfer receiving read data (-1 = none)
+  int      owner;    // Transfer issuing op
+  int      resume;   // Transfer to restart expansion at
+  int      posted;   // Posted AP read pending before op
+  uint8_t  apsel;    // AP selected before op
+};
+
+// Transfer expansion state
+typedef struct {
+  brg_op_t *op;
+  int cnt;
+  int next;          // Transfer being expanded
+  int posted;        // Transfer awaiting posted AP read result
+  int64_t sel;       // Cached DP SELECT (-1 = unknown)
+  uint8_t apsel;     // AP for AP requests - follows SELECT writes
+} queue_t;
+
+// Resolves generated CSR offsets - accessor address is captured
+static uint32_t csr_addr;
+
+static uint32_t csr_capture_read (uint32_t addr)
 {
-  int rv;
-  rv = flexsoc_open (id);
-  if (rv)
-    err ("Failed to open: %s", id);
+  csr_addr = addr;
+  return 0;
+}
+
+static void csr_capture_write (uint32_t addr, uint32_t data)
+{
+  csr_addr = addr;
+}
+
+static uint64_t now_ms (void)
+{
+  timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+Target::Target (flexsoc_ctx *ctx)
+{
+  this->ctx = ctx;
 
   // Create autogen CSR classes
+  // Accessors use the link bound to the calling thread - see Csr ()
   csr = new flexsoc_csr (CSR_BASE, &flexsoc_reg_read, &flexsoc_reg_write);
   if (!csr)
     err ("Failed to inst flexsoc_csr");
+
+  // Bridge CSR addresses for queued remote transfers
+  flexsoc_csr cap (CSR_BASE, &csr_capture_read, &csr_capture_write);
+  cap.brg_ctrl ();
+  brg_ctrl_addr = csr_addr;
+  cap.brg_data ();
+  brg_data_addr = csr_addr;
+  cap.brg_stat ();
+  brg_stat_addr = csr_addr;
+  cap.cpu_reset ();
+  cpu_reset_addr = csr_addr;
+
+  // Limit commands in flight to device FIFO if reported
+  if ((Csr ()->flexsoc_id () & 0xf) >= 2)
+    LinkFifoDepth (Csr ()->host_fifo_depth ());
+}
+
+Target::Target (char *id)
+  : Target (flexsoc_ctx_open (id))
+{
 }
 
 Target::~Target ()
 {
+  uint64_t hits, misses;
+
+  // Write back cached pages
+  if (cache) {
+    CacheFlush ();
+    cache->Stats (&hits, &misses);
+    log (LOG_DEBUG, "Page cache: %llu hits %llu misses",
+         (unsigned long long)hits, (unsigned long long)misses);
+    delete cache;
+  }
+
   // Delete CSR classes
   delete csr;
     
   // Close comm link
-  flexsoc_close ();
+  flexsoc_ctx_close (ctx);
+
+  // Clear singleton
+  if (this == inst)
+    inst = NULL;
 }
 
 Target *Target::Ptr (char *id)
 {
-  if (!inst) 
-    inst =  new Target (id);
+  if (!inst)
+    inst = new Target (id);
   return inst;
 }
 
@@ -50,122 +181,336 @@ Target *Target::Ptr (void)
   return inst;
 }
 
+flexsoc_ctx *Target::Ctx (void)
+{
+  return ctx;
+}
+
+void Target::Bind (void)
+{
+  flexsoc_ctx_bind (ctx);
+}
+
+int Target::LinkRegion (uint32_t base, uint32_t size, const flexsoc_profile_t *prof)
+{
+  return flexsoc_ctx_region (ctx, base, size, prof);
+}
+
+void Target::LinkFifoDepth (int bytes)
+{
+  flexsoc_ctx_fifo_depth (ctx, bytes);
+}
+
+CsrRef Target::Csr (void)
+{
+  // Route autogen accessors to our link
+  return CsrRef (csr, ctx);
+}
+
 // General APIs
 void Target::ReadW (uint32_t addr, uint32_t *data, uint32_t cnt)
 {
-  if (flexsoc_readw (addr, data, cnt))
+  int rv = cache ? cache->Read (addr, data, cnt * 4, 4) : 1;
+
+  if (rv > 0)
+    rv = flexsoc_ctx_readw (ctx, addr, data, cnt);
+  if (rv)
     err ("flexsoc_readw failed!");
 }
 
 void Target::ReadH (uint32_t addr, uint16_t *data, uint32_t cnt)
 {
-  if (flexsoc_readh (addr, data, cnt))
+  int rv = cache ? cache->Read (addr, data, cnt * 2, 2) : 1;
+
+  if (rv > 0)
+    rv = flexsoc_ctx_readh (ctx, addr, data, cnt);
+  if (rv)
     err ("flexsoc_readh failed!");
 }
 
 void Target::ReadB (uint32_t addr, uint8_t *data, uint32_t cnt)
 {
-  if (flexsoc_readb (addr, data, cnt))
+  int rv = cache ? cache->Read (addr, data, cnt, 1) : 1;
+
+  if (rv > 0)
+    rv = flexsoc_ctx_readb (ctx, addr, data, cnt);
+  if (rv)
     err ("flexsoc_readb failed!");
 }
 
 void Target::WriteW (uint32_t addr, const uint32_t *data, uint32_t cnt)
 {
-  if (flexsoc_writew (addr, data, cnt))
+  int rv = cache ? cache->Write (addr, data, cnt * 4, 4) : 1;
+
+  if (rv > 0)
+    rv = flexsoc_ctx_writew (ctx, addr, data, cnt);
+  if (rv)
     err ("flexsoc_writew failed!");
 }
 
 void Target::WriteH (uint32_t addr, const uint16_t *data, uint32_t cnt)
 {
-  if (flexsoc_writeh (addr, data, cnt))
+  int rv = cache ? cache->Write (addr, data, cnt * 2, 2) : 1;
+
+  if (rv > 0)
+    rv = flexsoc_ctx_writeh (ctx, addr, data, cnt);
+  if (rv)
     err ("flexsoc_writeh failed!");
 }
 
 void Target::WriteB (uint32_t addr, const uint8_t *data, uint32_t cnt)
 {
-  if (flexsoc_writeb (addr, data, cnt))
+  int rv = cache ? cache->Write (addr, data, cnt, 1) : 1;
+
+  if (rv > 0)
+    rv = flexsoc_ctx_writeb (ctx, addr, data, cnt);
+  if (rv)
     err ("flexsoc_writeb failed!");
 }
 
+void Target::MemcpyTo (uint32_t addr, const void *src, uint32_t len)
+{
+  int rv = cache ? cache->Write (addr, src, len, 0) : 1;
+
+  if (rv > 0)
+    rv = flexsoc_ctx_memcpy_to (ctx, addr, src, len);
+  if (rv)
+    err ("flexsoc_memcpy_to failed!");
+}
+
+void Target::MemcpyFrom (void *dst, uint32_t addr, uint32_t len)
+{
+  int rv = cache ? cache->Read (addr, dst, len, 0) : 1;
+
+  if (rv > 0)
+    rv = flexsoc_ctx_memcpy_from (ctx, dst, addr, len);
+  if (rv)
+    err ("flexsoc_memcpy_from failed!");
+}
+
+// Direct link access with caller width
+static int link_xfer (flexsoc_ctx *ctx, bool write, uint32_t addr, uint8_t *buf,
+                      uint32_t len, int width)
+{
+  switch (width) {
+    case 1:
+      return write ? flexsoc_ctx_writeb (ctx, addr, buf, len) :
+        flexsoc_ctx_readb (ctx, addr, buf, len);
+    case 2:
+      return write ? flexsoc_ctx_writeh (ctx, addr, (uint16_t *)buf, len / 2) :
+        flexsoc_ctx_readh (ctx, addr, (uint16_t *)buf, len / 2);
+    case 4:
+      return write ? flexsoc_ctx_writew (ctx, addr, (uint32_t *)buf, len / 4) :
+        flexsoc_ctx_readw (ctx, addr, (uint32_t *)buf, len / 4);
+    default:
+      return write ? flexsoc_ctx_memcpy_to (ctx, addr, buf, len) :
+        flexsoc_ctx_memcpy_from (ctx, buf, addr, len);
+  }
+}
+
+// Write may release the CPU - cached RAM must be current first, as in
+// CPUReset (). Returns 1 if the write hits the reset CSR.
+int Target::ResetPre (uint32_t addr, uint32_t len)
+{
+  if (!cache || (cpu_reset_addr < addr) || (cpu_reset_addr - addr >= len))
+    return 0;
+  return cache->Halt (false) ? -1 : 1;
+}
+
+// Back in reset - cache RAM again
+void Target::ResetPost (void)
+{
+  if (CPUReset ())
+    cache->Halt (true);
+}
+
+int Target::Xfer (bool write, uint32_t addr, void *data, uint32_t len, int width)
+{
+  int rv, reset = write ? ResetPre (addr, len) : 0;
+
+  if (reset < 0)
+    return -1;
+  rv = cache ? (write ? cache->Write (addr, data, len, width) :
+                cache->Read (addr, data, len, width)) : 1;
+  if (rv > 0)
+    rv = link_xfer (ctx, write, addr, (uint8_t *)data, len, width);
+  if (reset)
+    ResetPost ();
+  return rv;
+}
+
+int Target::Vec (flexsoc_vec_t *vec, int cnt)
+{
+  int i, w, rv, n = 0, reset = 0;
+  flexsoc_vec_t *lv;
+  int *idx;
+
+  if (!cache)
+    return flexsoc_ctx_vec (ctx, vec, cnt);
+
+  // Write to reset CSR goes out with cached RAM written back
+  for (i = 0; (i < cnt) && !reset; i++)
+    if (vec[i].write)
+      reset = ResetPre (vec[i].addr, vec[i].width ? vec[i].width : 4);
+  if (reset < 0) {
+    for (i = 0; i < cnt; i++)
+      vec[i].ok = false;
+    return -1;
+  }
+
+  // Cached ops complete here, the rest go to the link in one stream
+  lv = (flexsoc_vec_t *)malloc (sizeof (flexsoc_vec_t) * cnt);
+  idx = (int *)malloc (sizeof (int) * cnt);
+  if (!lv || !idx)
+    err ("Failed to malloc");
+  for (i = 0; i < cnt; i++) {
+    w = vec[i].width ? vec[i].width : 4;
+    if (!vec[i].write)
+      vec[i].data = 0;
+    rv = vec[i].write ? cache->Write (vec[i].addr, &vec[i].data, w, w) :
+      cache->Read (vec[i].addr, &vec[i].data, w, w);
+    vec[i].ok = !rv;
+    if (rv > 0) {
+      lv[n] = vec[i];
+      idx[n++] = i;
+    }
+  }
+  rv = n ? flexsoc_ctx_vec (ctx, lv, n) : 0;
+  for (i = 0; i < n; i++)
+    vec[idx[i]] = lv[i];
+  for (i = 0; i < cnt; i++)
+    if (!vec[i].ok)
+      rv = -1;
+  if (reset)
+    ResetPost ();
+  free (lv);
+  free (idx);
+  return rv;
+}
+
 uint32_t Target::ReadReg (uint32_t addr)
 {
-  return flexsoc_reg_read (addr);
+  uint32_t val;
+
+  if (cache) {
+    ReadW (addr, &val, 1);
+    return val;
+  }
+  return flexsoc_ctx_reg_read (ctx, addr);
 }
 
 void Target::WriteReg (uint32_t addr, uint32_t val)
 {
-  flexsoc_reg_write (addr, val);
+  if (cache)
+    WriteW (addr, &val, 1);
+  else
+    flexsoc_ctx_reg_write (ctx, addr, val);
+}
+
+int Target::CacheRegion (uint32_t base, uint32_t size, cache_mode_t mode)
+{
+  // Start caching with current run state
+  if (!cache) {
+    cache = new PageCache (ctx);
+    cache->Halt (CPUReset ());
+  }
+  return cache->Region (base, size, mode);
+}
+
+void Target::CacheFlush (void)
+{
+  if (cache && cache->Flush ())
+    err ("Cache write back failed!");
+}
+
+void Target::CacheInvalidate (uint32_t base, uint32_t size)
+{
+  if (cache && cache->Invalidate (base, size))
+    err ("Cache write back failed!");
+}
+
+void Target::CacheStats (uint64_t *hits, uint64_t *misses)
+{
+  *hits = *misses = 0;
+  if (cache)
+    cache->Stats (hits, misses);
 }
 
 void Target::SlaveRegister (void (*cb)(uint8_t *data, int len))
 {
-  flexsoc_register (cb);
+  flexsoc_ctx_register (ctx, cb);
 }
 
 void Target::SlaveUnregister (void)
 {
   // Disable interface first
   SlaveEn (false);
-  flexsoc_unregister ();
+  flexsoc_ctx_unregister (ctx);
 }
 
 void Target::SlaveSend (const uint8_t *data, int len)
 {
-  flexsoc_send (data, len);
+  flexsoc_ctx_send (ctx, data, len);
 }
 
 // Access IRQs
 void Target::IRQ (uint8_t n)
 {
-  csr->irq_edge (n >> 5, 1 << (n & 0x1f));
+  Csr ()->irq_edge (n >> 5, 1 << (n & 0x1f));
 }
 
 void Target::IRQSet (uint8_t n)
 {
-  csr->irq_level (n >> 5, 1 << (n & 0x1f));
+  Csr ()->irq_level (n >> 5, 1 << (n & 0x1f));
 }
 
 void Target::IRQClr (uint8_t n)
 {
-  uint32_t cur = csr->irq_level (n >> 5);
+  uint32_t cur = Csr ()->irq_level (n >> 5);
   cur &= ~(1 << (n & 0x1f));
-  csr->irq_level (n >> 5, cur);
+  Csr ()->irq_level (n >> 5, cur);
 }
 
 // Access CSRs
 uint32_t Target::FlexsocID (void)
 {
-  return csr->flexsoc_id ();
+  return Csr ()->flexsoc_id ();
 }
 
 uint32_t Target::MemoryID (void)
 {
-  return csr->memory_id ();
+  return Csr ()->memory_id ();
 }
 
 uint32_t Target::CoreFreq (void)
 {
-  return csr->core_freq ();
+  return Csr ()->core_freq ();
 }
 
 void Target::CPUReset (bool reset)
 {
-  csr->cpu_reset (reset);
+  // Cached RAM must be current before the CPU runs and stay
+  // uncached until it stops
+  if (cache && !reset && cache->Halt (false))
+    err ("Cache write back failed!");
+  Csr ()->cpu_reset (reset);
+  if (cache && reset)
+    cache->Halt (true);
 }
 
 bool Target::CPUReset (void)
 {
-  return csr->cpu_reset ();
+  return Csr ()->cpu_reset ();
 }
 
 void Target::SlaveEn (bool en)
 {
-  csr->slave_en (en);
+  Csr ()->slave_en (en);
 }
 
 bool Target::SlaveEn (void)
 {
-  return csr->slave_en ();
+  return Csr ()->slave_en ();
 }
 
 
@@ -175,9 +520,9 @@ int Target::CodeAliasSet (uint8_t idx, alias_t *alias)
     return -1;
 
   // Setup alias
-  csr->code_remap_base (idx, alias->base);
-  csr->code_remap_end (idx, alias->base + alias->size);
-  csr->code_remap_off (idx, alias->remap);
+  Csr ()->code_remap_base (idx, alias->base);
+  Csr ()->code_remap_end (idx, alias->base + alias->size);
+  Csr ()->code_remap_off (idx, alias->remap);
   return 0;
 }
 
@@ -187,9 +532,9 @@ int Target::SysAliasSet (uint8_t idx, alias_t *alias)
     return -1;
 
   // Setup alias
-  csr->sys_remap_base (alias->base);
-  csr->sys_remap_end (alias->base + alias->size);
-  csr->sys_remap_off (alias->remap);
+  Csr ()->sys_remap_base (alias->base);
+  Csr ()->sys_remap_end (alias->base + alias->size);
+  Csr ()->sys_remap_off (alias->remap);
   return 0;
 }
 
@@ -199,9 +544,9 @@ int Target::CodeAliasGet (uint8_t idx, alias_t *alias)
     return -1;
 
   // Get values
-  alias->base = csr->code_remap_base (idx);
-  alias->size = csr->code_remap_end (idx) - csr->code_remap_base (idx);
-  alias->remap = csr->code_remap_off (idx);
+  alias->base = Csr ()->code_remap_base (idx);
+  alias->size = Csr ()->code_remap_end (idx) - Csr ()->code_remap_base (idx);
+  alias->remap = Csr ()->code_remap_off (idx);
   return 0;
 }
 
@@ -211,25 +556,25 @@ int Target::SysAliasGet (uint8_t idx, alias_t *alias)
     return -1;
 
   // Get values
-  alias->base = csr->sys_remap_base ();
-  alias->size = csr->sys_remap_end () - csr->sys_remap_base ();
-  alias->remap = csr->sys_remap_off ();
+  alias->base = Csr ()->sys_remap_base ();
+  alias->size = Csr ()->sys_remap_end () - Csr ()->sys_remap_base ();
+  alias->remap = Csr ()->sys_remap_off ();
   return 0;
 }
 
 uint32_t Target::RemoteBase (void)
 {
-  return csr->brg_base ();
+  return Csr ()->brg_base ();
 }
 
 uint8_t Target::RemoteStat (void)
 {
-  return csr->brg_stat ();
+  return Csr ()->brg_stat ();
 }
 
 const char *Target::RemoteStatStr (void)
 {
-  switch (csr->brg_stat ()) {
+  switch (Csr ()->brg_stat ()) {
     case SUCCESS: return "SUCCESS";
     case ERR_FAULT: return "ERR_FAULT";
     case ERR_PARITY: return "ERR_PARITY";
@@ -241,142 +586,575 @@ const char *Target::RemoteStatStr (void)
   }
 }
 
-void Target::RemoteTimeout (int timeout)
+void Target::RemoteTimeout (int ms)
 {
-  remote_timeout = timeout;
+  remote_timeout = ms;
 }
 
 void Target::RemoteEn (bool en)
 {
-  csr->brg_en (en);
+  Csr ()->brg_en (en);
 }
 
 bool Target::RemoteEn (void)
 {
-  return csr->brg_en ();
+  return Csr ()->brg_en ();
 }
 
 void Target::RemoteClkDiv (uint8_t div)
 {
-  csr->brg_clkdiv (div & 0x1f);
+  Csr ()->brg_clkdiv (div & 0x1f);
+
+  // Op time changed - recalibrate queue polls
+  remote_polls = 0;
 }
 
 uint8_t Target::RemoteClkDiv (void)
 {
-  return csr->brg_clkdiv ();
+  return Csr ()->brg_clkdiv ();
 }
 
 uint32_t Target::RemoteIDCODE (void)
 {
-  return csr->brg_idcode ();
+  return Csr ()->brg_idcode ();
+}
+
+// All ops of vector completed
+static bool vec_done (const flexsoc_vec_t *vec, int cnt)
+{
+  int i;
+
+  for (i = 0; i < cnt; i++)
+    if (!vec[i].ok)
+      return false;
+  return true;
+}
+
+int Target::RemoteQueueCal (void)
+{
+  int i, busy = 0;
+  uint64_t end;
+  flexsoc_vec_t vec[1 + POLL_MAX];
+
+  // Count back to back polls a DP IDCODE read stays busy for
+  vec[0] = {brg_ctrl_addr, DP_IDCODE | BRG_START, true};
+  for (i = 1; i <= POLL_MAX; i++)
+    vec[i] = {brg_ctrl_addr, 0, false};
+  if (flexsoc_ctx_vec (ctx, vec, 1 + POLL_MAX)) {
+    log (LOG_ERR, "Remote queue calibration failed");
+    return -1;
+  }
+  for (i = 1; i <= POLL_MAX; i++)
+    if (vec[i].data & BRG_START)
+      busy++;
+
+  // Let it finish
+  end = now_ms () + remote_timeout;
+  while ((Csr ()->brg_ctrl () & BRG_START) && (now_ms () < end))
+    ;
+
+  // Margin for slower ops (writes, retries)
+  remote_polls = 2 * busy + 1;
+  remote_serial = (remote_polls > POLL_MAX);
+  if (remote_serial)
+    remote_polls = POLL_MAX;
+  log (LOG_DEBUG, "Remote queue: %d polls/op%s", remote_polls,
+       remote_serial ? " (serial)" : "");
+  return 0;
+}
+
+int Target::RemoteQueueRun (brg_op_t *op, int cnt)
+{
+  int i, j, rv, n = 0, polls;
+  uint64_t end;
+  flexsoc_vec_t *vec, *v;
+
+  if (!remote_polls && RemoteQueueCal ())
+    return 0;
+  polls = remote_polls;
+
+  // Ops outlast polls - wait on each in turn
+  if (remote_serial && (cnt > 1)) {
+    for (i = 0; i < cnt; i++)
+      if (RemoteQueueRun (&op[i], 1) != 1)
+        break;
+    return i;
+  }
+
+  vec = (flexsoc_vec_t *)malloc (sizeof (flexsoc_vec_t) * cnt * (4 + polls));
+  if (!vec)
+    err ("Failed to malloc");
+
+  // Encode all ops into one stream
+  for (i = 0; i < cnt; i++) {
+    if (op[i].ctrl & BRG_WRITE)
+      vec[n++] = {brg_data_addr, op[i].data, true};
+    vec[n++] = {brg_ctrl_addr, (uint32_t)(op[i].ctrl | BRG_START), true};
+    for (j = 0; j < polls; j++)
+      vec[n++] = {brg_ctrl_addr, 0, false};
+    if (!(op[i].ctrl & BRG_WRITE))
+      vec[n++] = {brg_data_addr, 0, false};
+    vec[n++] = {brg_stat_addr, 0, false};
+  }
+  rv = flexsoc_ctx_vec (ctx, vec, n);
+
+  // Collect results
+  for (i = 0, v = vec; i < cnt; i++) {
+
+    // Link failed an access of this op - it didn't complete
+    if (rv && !vec_done (v, 3 + polls))
+      break;
+
+    if (op[i].ctrl & BRG_WRITE)
+      v++;
+    v += polls;
+    op[i].late = (v->data & BRG_START) != 0;
+    v++;
+    if (!(op[i].ctrl & BRG_WRITE))
+      op[i].data = (v++)->data;
+    op[i].stat = (v++)->data;
+
+    // Last op can be waited on - nothing follows it
+    if (op[i].late && (i == cnt - 1)) {
+      end = now_ms () + remote_timeout;
+      while ((op[i].late = Csr ()->brg_ctrl () & BRG_START) && (now_ms () < end))
+        ;
+      if (!op[i].late) {
+        if (!(op[i].ctrl & BRG_WRITE))
+          op[i].data = Csr ()->brg_data ();
+        op[i].stat = Csr ()->brg_stat ();
+      }
+    }
+
+    // Still running when next op was sent - results can't be trusted
+    if (op[i].late) {
+      op[i].stat = ERR_TIMEOUT;
+      if (i != cnt - 1) {
+        remote_polls *= 2;
+        remote_serial = (remote_polls > POLL_MAX);
+        if (remote_serial)
+          remote_polls = POLL_MAX;
+        log (LOG_DEBUG, "Remote queue overrun: %d polls/op", remote_polls);
+      }
+      break;
+    }
+    if (op[i].stat != SUCCESS)
+      break;
+  }
+  free (vec);
+
+  // Ops completed
+  return i;
 }
 
 uint32_t Target::RemoteRegRead (bool APnDP, uint8_t addr)
 {
-  int n = remote_timeout;
-  
+  brg_op_t op = {};
+
   // CTRL = APnDP, ADDR[1:0], WRnRD, START=1/DONE=0
-  if (APnDP)
-    csr->brg_ctrl ((1 << 4) | (addr & 0xc) | 1);
-  else
-    csr->brg_ctrl ((addr & 0xc) | 1);
+  op.ctrl = (APnDP ? BRG_AP : 0) | (addr & 0xc);
 
-  // Wait until command is complete
-  while ((csr->brg_ctrl () & 1) && n)
-    n--;
-  
   // Return data read
-  return n ? csr->brg_data () : 0;
+  return RemoteQueueRun (&op, 1) ? op.data : 0;
 }
 
 void Target::RemoteRegWrite (bool APnDP, uint8_t addr, uint32_t data)
 {
-  int n = remote_timeout;
+  brg_op_t op = {};
 
-  // Setup data
-  csr->brg_data (data);
-  
   // CTRL = APnDP, ADDR[1:0], WRnRD, START=1/DONE=0
-  if (APnDP)
-    csr->brg_ctrl ((1 << 4) | (addr & 0xc) | 3);
-  else
-    csr->brg_ctrl ((addr & 0xc) | 3);
-
-  // Wait until command is complete
-  while ((csr->brg_ctrl () & 1) && n)
-    n--;
+  op.ctrl = (APnDP ? BRG_AP : 0) | (addr & 0xc) | BRG_WRITE;
+  op.data = data;
+  RemoteQueueRun (&op, 1);
 }
 
 uint32_t Target::RemoteAPRead (uint8_t addr, uint8_t ap)
 {
+  remote_xfer_t xfer = {(uint16_t)(REMOTE_AP | REMOTE_RD | addr)};
+
   // Update AP if specified
   if (ap != 255)
     apsel = ap;
-  
-  // Select address using DP-select
-  RemoteRegWrite (false, 8, (apsel << 24) | addr);
-
-  // Read from AP - Must read RDBUFF after
-  (void)RemoteRegRead (true, addr & 0xc);
 
-  // Read buffer (RDBUFF)
-  return RemoteRegRead (false, 0xc);
+  // SELECT, AP read and RDBUFF in one go
+  RemoteTransfer (&xfer, 1);
+  return xfer.data;
 }
 
 void Target::RemoteAPWrite (uint8_t addr, uint32_t data, uint8_t ap)
 {
+  remote_xfer_t xfer = {(uint16_t)(REMOTE_AP | REMOTE_WR | addr), data};
+
   // Update AP if specified
   if (ap != 255)
     apsel = ap;
-  
-  // Select address using DP-select
-  RemoteRegWrite (false, 8, (apsel << 24) | addr);
-
-  // Write to AP
-  RemoteRegWrite (true, addr & 0xc, data);
+  RemoteTransfer (&xfer, 1);
 }
 
 void Target::RemoteAHBAP (uint8_t ap)
 {
   // Save AP as AHB bridge AP
-  csr->brg_apsel (ap);
+  Csr ()->brg_apsel (ap);
 }
 
-uint32_t Target::RemoteReadW (uint32_t addr)
+void Target::RemoteMatchRetry (int retries)
 {
-  // Setup CSW for word access
-  RemoteAPWrite (0, 0xA2000002);
+  match_retry = retries;
+}
 
-  // Setup address in TAR
-  RemoteAPWrite (4, addr);
+static void queue_op (queue_t *q, uint8_t ctrl, uint32_t data, int res)
+{
+  brg_op_t *op = &q->op[q->cnt++];
+
+  op->ctrl = ctrl;
+  op->data = data;
+  op->res = res;
+  op->owner = (res >= 0) ? res : q->next;
+  op->resume = q->next;
+  op->posted = q->posted;
+  op->apsel = q->apsel;
+}
 
-  // Wait for any previous transactions to finish
-  while ((RemoteAPRead (0) & 0xC0) != 0x40)
-  ;
+// Collect pending posted AP read from RDBUFF
+static void queue_flush (queue_t *q)
+{
+  if (q->posted < 0)
+    return;
+  queue_op (q, DP_RDBUFF, 0, q->posted);
+  q->posted = -1;
+}
 
-  // Read from DRW
-  return RemoteAPRead (0xc);
+static void queue_xfer (queue_t *q, remote_xfer_t *xfer)
+{
+  uint16_t req = xfer[q->next].req;
+  uint8_t reg = req & 0xff, ctrl = reg & 0xc;
+  int64_t sel = ((uint32_t)q->apsel << 24) | (reg & 0xf0);
+
+  // Posted reads only chain across AP reads in the same bank
+  if (!(req & REMOTE_AP) || (req & REMOTE_WR) || (sel != q->sel))
+    queue_flush (q);
+
+  // AP access - select AP and bank if changed
+  if ((req & REMOTE_AP) && (sel != q->sel)) {
+    queue_op (q, DP_SELECT | BRG_WRITE, sel, -1);
+    q->sel = sel;
+  }
+  if (req & REMOTE_AP)
+    ctrl |= BRG_AP;
+
+  // Write
+  if (req & REMOTE_WR) {
+    queue_op (q, ctrl | BRG_WRITE, xfer[q->next].data, -1);
+    if (!(req & REMOTE_AP) && (reg == DP_SELECT)) {
+      q->sel = xfer[q->next].data;
+      q->apsel = xfer[q->next].data >> 24;
+    }
+  }
+  // AP read returns previous AP read result
+  else if (req & REMOTE_AP) {
+    queue_op (q, ctrl, 0, q->posted);
+    q->op[q->cnt - 1].owner = q->next;
+    q->posted = q->next;
+  }
+  else
+    queue_op (q, ctrl, 0, q->next);
 }
 
-void Target::RemoteWriteW (uint32_t addr, uint32_t data)
+// Restart point after an overrun. The late op may have completed and
+// moved TAR on, so a DRW run restarts at the TAR write feeding it
+static int queue_restart (remote_xfer_t *xfer, int cnt, int next)
 {
-  // Setup CSW for word access
-  RemoteAPWrite (0, 0xA2000002);
+  int i = next;
+
+  while ((i > 0) && (i < cnt) &&
+         ((xfer[i].req & (REMOTE_AP | REMOTE_MATCH | 0xff)) == (REMOTE_AP | AP_DRW)))
+    i--;
+  if ((i < cnt) && (xfer[i].req == (REMOTE_AP | REMOTE_WR | AP_TAR)))
+    return i;
+  return next;
+}
 
-  // Setup address in TAR
-  RemoteAPWrite (4, addr);
+int Target::RemoteTransfer (remote_xfer_t *xfer, int cnt)
+{
+  int i, n, tries = 0;
+  bool matching;
+  uint32_t match = 0;
+  uint64_t end, wait_end = 0;
+  brg_op_t *op;
+  queue_t q = {};
+
+  op = (brg_op_t *)malloc (sizeof (brg_op_t) * QUEUE_OPS);
+  if (!op)
+    err ("Failed to malloc");
+  for (i = 0; i < cnt; i++)
+    xfer[i].stat = ERR_UNKNOWN;
+  q.op = op;
+  q.posted = -1;
+  q.sel = -1;
+  q.apsel = apsel;
+
+  while ((q.next < cnt) || (q.posted >= 0)) {
+    q.cnt = 0;
+
+    // Match read runs alone until satisfied
+    matching = (q.next < cnt) && (xfer[q.next].req & REMOTE_MATCH);
+    if (matching) {
+      if (!tries)
+        match = xfer[q.next].data;
+      queue_xfer (&q, xfer);
+      queue_flush (&q);
+    }
+    // Expand up to next match read
+    else {
+      while ((q.next < cnt) && !(xfer[q.next].req & REMOTE_MATCH) &&
+             (q.cnt <= QUEUE_OPS - 4)) {
+        queue_xfer (&q, xfer);
+        q.next++;
+      }
+      queue_flush (&q);
+    }
+
+    // Run batch and hand results to transfers
+    n = RemoteQueueRun (op, q.cnt);
+    for (i = 0; i < n; i++) {
+      if (op[i].res >= 0) {
+        xfer[op[i].res].data = op[i].data;
+        xfer[op[i].res].stat = SUCCESS;
+      }
+      else if (op[i].ctrl & BRG_WRITE)
+        xfer[op[i].owner].stat = SUCCESS;
+    }
+
+    // Batch complete
+    if (n == q.cnt) {
+      wait_end = 0;
+      if (!matching)
+        continue;
+
+      // Retry match read until value matches
+      if ((xfer[q.next].data & xfer[q.next].mask) == match) {
+        tries = 0;
+        q.next++;
+      }
+      else if (++tries >= match_retry) {
+        xfer[q.next].stat = ERR_MISMATCH;
+        break;
+      }
+      continue;
+    }
+
+    // Op overran its polls and later ops went out while the bridge was
+    // busy. Polls have grown - let the bridge settle and resume from it.
+    if (op[n].late && (n < q.cnt - 1)) {
+      end = now_ms () + remote_timeout;
+      while ((Csr ()->brg_ctrl () & BRG_START) && (now_ms () < end))
+        ;
+      q.next = queue_restart (xfer, cnt, op[n].resume);
+      q.posted = (q.next == op[n].resume) ? op[n].posted : -1;
+      q.sel = -1;
+      q.apsel = op[n].apsel;
+      continue;
+    }
+
+    // Target answering WAIT - retry from failing op until timeout
+    if ((op[n].stat == ERR_TIMEOUT) && !op[n].late) {
+      if (!wait_end)
+        wait_end = now_ms () + remote_timeout;
+      if (now_ms () < wait_end) {
+        q.next = op[n].resume;
+        q.posted = op[n].posted;
+        q.sel = -1;
+        q.apsel = op[n].apsel;
+        continue;
+      }
+    }
+
+    // Fault - clear sticky errors for next user
+    if (op[n].stat == ERR_FAULT)
+      RemoteRegWrite (false, DP_ABORT, STKERRCLR);
+    q.next = op[n].owner;
+    xfer[q.next].stat = op[n].stat;
+    break;
+  }
+  free (op);
 
-  // Wait for any previous transactions to finish
-  while ((RemoteAPRead (0) & 0xC0) != 0x40)
+  // Transfers completed - posted reads complete late
+  for (i = 0; (i < cnt) && (xfer[i].stat == SUCCESS); i++)
     ;
+  return i;
+}
 
-  // Write to DRW
-  RemoteAPWrite (0xc, data);
+int Target::RemoteBlock (bool write, uint32_t addr, uint32_t *data, uint32_t cnt)
+{
+  uint32_t i, n, x = 0, d = 0;
+  int rv;
+  remote_xfer_t *xfer;
+
+  if (addr & 3) {
+    log (LOG_ERR, "Remote block access must be word aligned: 0x%08X", addr);
+    return -1;
+  }
+
+  // Data plus TAR per block, CSW set/restore and CTRL/STAT
+  xfer = (remote_xfer_t *)calloc (cnt + cnt / (TAR_WRAP / 4) + 5, sizeof (remote_xfer_t));
+  if (!xfer)
+    err ("Failed to malloc");
+
+  // Enable auto-increment
+  xfer[x++] = {REMOTE_AP | REMOTE_WR | AP_CSW, CSW_WORD_INC};
+
+  for (i = 0; i < cnt; i += n) {
+
+    // Split at auto-increment wrap
+    n = (TAR_WRAP - ((addr + i * 4) & (TAR_WRAP - 1))) / 4;
+    if (n > cnt - i)
+      n = cnt - i;
+    xfer[x++] = {REMOTE_AP | REMOTE_WR | AP_TAR, addr + i * 4};
+
+    // Reads are posted back to back - queue collects results
+    for (d = i; d < i + n; d++)
+      xfer[x++] = {(uint16_t)(REMOTE_AP | AP_DRW | (write ? REMOTE_WR : REMOTE_RD)),
+                   write ? data[d] : 0};
+  }
+
+  // Restore single word CSW for other users and check for bus faults
+  xfer[x++] = {REMOTE_AP | REMOTE_WR | AP_CSW, CSW_WORD};
+  xfer[x++] = {REMOTE_DP | REMOTE_RD | DP_CTRLSTAT};
+  rv = (RemoteTransfer (xfer, x) == (int)x) ? 0 : -1;
+
+  // Copy out read data
+  if (!write) {
+    for (i = 0, d = 0; i < x; i++)
+      if (xfer[i].req == (REMOTE_AP | AP_DRW))
+        data[d++] = xfer[i].data;
+  }
+
+  // Sticky error set during the block
+  if (!rv && (xfer[x - 1].data & STICKYERR)) {
+    RemoteRegWrite (false, DP_ABORT, STKERRCLR);
+    rv = -1;
+  }
+  free (xfer);
+  return rv;
+}
+
+int Target::RemoteCoreRegs (core_regs_t *regs)
+{
+  int i, n = 0, rv = 0;
+  uint32_t *reg = (uint32_t *)regs;
+  remote_xfer_t xfer[3 + CORE_REG_CNT * 3];
+
+  // Banked registers BD0-2 map DHCSR, DCRSR and DCRDR
+  xfer[n++] = {REMOTE_AP | REMOTE_WR | AP_CSW, CSW_WORD};
+  xfer[n++] = {REMOTE_AP | REMOTE_WR | AP_TAR, SCB_DHCSR};
+  xfer[n++] = {REMOTE_AP | REMOTE_RD | AP_BD0};
+
+  // Select each register, then DHCSR and DCRDR. SWD ops are far slower
+  // than a core register transfer so S_REGRDY is checked afterwards.
+  for (i = 0; i < CORE_REG_CNT; i++) {
+    xfer[n++] = {REMOTE_AP | REMOTE_WR | AP_BD1, core_regsel[i]};
+    xfer[n++] = {REMOTE_AP | REMOTE_RD | AP_BD0};
+    xfer[n++] = {REMOTE_AP | REMOTE_RD | AP_BD2};
+  }
+  if ((RemoteTransfer (xfer, n) != n) || !(xfer[2].data & S_HALT))
+    return -1;
+
+  for (i = 0; i < CORE_REG_CNT; i++) {
+    reg[i] = xfer[3 + i * 3 + 2].data;
+    if (xfer[3 + i * 3 + 1].data & S_REGRDY)
+      continue;
+
+    // Not ready in time - wait on this one
+    xfer[0] = {REMOTE_AP | REMOTE_WR | AP_BD1, core_regsel[i]};
+    xfer[1] = {REMOTE_AP | REMOTE_RD | REMOTE_MATCH | AP_BD0, S_REGRDY, S_REGRDY};
+    xfer[2] = {REMOTE_AP | REMOTE_RD | AP_BD2};
+    if (RemoteTransfer (xfer, 3) != 3)
+      rv = -1;
+    reg[i] = xfer[2].data;
+  }
+  return rv;
+}
+
+int Target::RemoteCoreRegWrite (int idx, uint32_t val)
+{
+  remote_xfer_t xfer[5] = {
+    {REMOTE_AP | REMOTE_WR | AP_CSW, CSW_WORD},
+    {REMOTE_AP | REMOTE_WR | AP_TAR, SCB_DHCSR},
+    {REMOTE_AP | REMOTE_WR | AP_BD2, val},
+    {REMOTE_AP | REMOTE_WR | AP_BD1, 0},
+    {REMOTE_AP | REMOTE_RD | REMOTE_MATCH | AP_BD0, S_REGRDY, S_REGRDY},
+  };
+
+  if ((idx < 0) || (idx >= CORE_REG_CNT))
+    return -1;
+
+  // DCRDR then DCRSR write select - wait for transfer
+  xfer[3].data = REGWnR | core_regsel[idx];
+  return (RemoteTransfer (xfer, 5) == 5) ? 0 : -1;
+}
+
+int Target::CoreRegs (uint32_t base, core_regs_t *regs)
+{
+  int i, n = 0, rv = 0;
+  bool ready;
+  uint64_t end;
+  uint32_t *reg = (uint32_t *)regs;
+  uint32_t scs = base - 0xE0000000;
+  flexsoc_vec_t vec[1 + CORE_REG_CNT * 3];
+
+  // DHCSR then select/status/data for each register in one stream
+  vec[n++] = {scs + SCB_DHCSR, 0, false};
+  for (i = 0; i < CORE_REG_CNT; i++) {
+    vec[n++] = {scs + SCB_DCRSR, core_regsel[i], true};
+    vec[n++] = {scs + SCB_DHCSR, 0, false};
+    vec[n++] = {scs + SCB_DCRDR, 0, false};
+  }
+  if (flexsoc_ctx_vec (ctx, vec, n) || !(vec[0].data & S_HALT))
+    return -1;
+
+  for (i = 0; i < CORE_REG_CNT; i++) {
+    reg[i] = vec[1 + i * 3 + 2].data;
+    if (vec[1 + i * 3 + 1].data & S_REGRDY)
+      continue;
+
+    // Not ready in time - wait on this one
+    WriteReg (scs + SCB_DCRSR, core_regsel[i]);
+    end = now_ms () + remote_timeout;
+    while (!(ready = ReadReg (scs + SCB_DHCSR) & S_REGRDY) && (now_ms () < end))
+      ;
+    if (!ready)
+      rv = -1;
+    reg[i] = ReadReg (scs + SCB_DCRDR);
+  }
+  return rv;
+}
+
+int Target::RemoteReadW (uint32_t addr, uint32_t *data, uint32_t cnt)
+{
+  return RemoteBlock (false, addr, data, cnt);
+}
+
+int Target::RemoteWriteW (uint32_t addr, const uint32_t *data, uint32_t cnt)
+{
+  return RemoteBlock (true, addr, (uint32_t *)data, cnt);
+}
+
+uint32_t Target::RemoteReadW (uint32_t addr)
+{
+  uint32_t data = 0;
+
+  RemoteBlock (false, addr, &data, 1);
+  return data;
+}
+
+void Target::RemoteWriteW (uint32_t addr, uint32_t data)
+{
+  RemoteBlock (true, addr, &data, 1);
 }
 
 void Target::RemoteAHBEn (bool en)
 {
-  csr->brg_ahb_en (en);
+  Csr ()->brg_ahb_en (en);
 }
 
 void Target::RemoteRemap32M (uint8_t idx, uint32_t remap)
@@ -391,17 +1169,17 @@ void Target::RemoteRemap32M (uint8_t idx, uint32_t remap)
   }
 
   // RMW remap reg
-  v = csr->brg_remap32 (idx >> 2);
+  v = Csr ()->brg_remap32 (idx >> 2);
   v &= ~(0xff << ((idx & 3) * 8));
   v |= ((remap >> 24) & 0xfe) << ((idx & 3) * 8);
   
   // Setup remap
-  csr->brg_remap32 (idx >> 2, v);
+  Csr ()->brg_remap32 (idx >> 2, v);
 }
 
 uint32_t Target::RemoteRemap32M (uint8_t idx)
 {
-  return (csr->brg_remap32(idx >> 2) >> ((idx & 3) * 8)) << 24;
+  return (Csr ()->brg_remap32(idx >> 2) >> ((idx & 3) * 8)) << 24;
 }
 
 void Target::RemoteRemap256M (uint32_t remap)
@@ -414,20 +1192,20 @@ void Target::RemoteRemap256M (uint32_t remap)
   }
   
   // Set remap
-  csr->brg_remap256 (remap >> 28);
+  Csr ()->brg_remap256 (remap >> 28);
 }
 
 uint32_t Target::RemoteRemap256M (void)
 {
-  return csr->brg_remap256 () << 28;
+  return Csr ()->brg_remap256 () << 28;
 }
 
 void Target::RemoteCSWFixed (bool isfixed)
 {
-  csr->brg_csw_fixed (isfixed);
+  Csr ()->brg_csw_fixed (isfixed);
 }
 
 bool Target::RemoteCSWFixed (void)
 {
-  return csr->brg_csw_fixed ();
+  return Csr ()->brg_csw_fixed ();
 }
@@ -13,6 +13,9 @@
 #include <stdlib.h>
 
 #include "flexsoc_csr.h"
+#include "flexsoc.h"
+#include "CsrRef.h"
+#include "PageCache.h"
 
 
 // Remote stat enum
@@ -26,8 +29,38 @@ typedef enum
    ERR_NOMEMAP   = 5,
    ERR_UNSUPSZ   = 6,
    ERR_UNKNOWN   = 7,
+   ERR_MISMATCH  = 8,  // Host only - match read never matched
   } remote_stat_t;
 
+// Queued remote transfer request (see RemoteTransfer)
+// req = flags | register address. AP addresses include the bank (0x00-0xfc)
+// AP requests use the current AP until a DP SELECT write in the list
+#define REMOTE_DP       (0 << 8)
+#define REMOTE_AP       (1 << 8)
+#define REMOTE_RD       (0 << 9)
+#define REMOTE_WR       (1 << 9)
+#define REMOTE_MATCH    (1 << 10)  // Read until (data & mask) == match
+
+typedef struct {
+  uint16_t req;
+  uint32_t data;    // Write data, read result or match value
+  uint32_t mask;    // Match mask
+  uint8_t  stat;    // remote_stat_t - ERR_UNKNOWN if not reached
+} remote_xfer_t;
+
+// Cortex-M core register snapshot (DCRSR selectors 0-18, 20)
+#define CORE_REG_CNT  20
+typedef struct {
+  uint32_t r[16];     // R0-R12, SP, LR, PC (debug return address)
+  uint32_t xpsr;
+  uint32_t msp;
+  uint32_t psp;
+  uint32_t special;   // CONTROL[31:24] FAULTMASK[23:16] BASEPRI[15:8] PRIMASK[7:0]
+} core_regs_t;
+
+// Bridge op in a queued batch - see Target.cpp
+typedef struct brg_op brg_op_t;
+
 // Aliasing memory structure
 typedef struct {
   uint32_t base;
@@ -40,20 +73,56 @@ class Target {
   static Target *inst;
 
 private:
-  int remote_timeout = 10;
+  int remote_timeout = 100;   // Bridge op timeout (ms)
+  int remote_polls = 0;       // Done polls per queued op (0 = calibrate)
+  bool remote_serial = false; // Ops outlast polls - wait on each op
+  int match_retry = 100;
   uint8_t apsel = 0;
+  flexsoc_ctx *ctx;
   flexsoc_csr *csr;
-  Target (char *id);
+  PageCache *cache = NULL;
+  Target (flexsoc_ctx *ctx);
+
+  // CSRs on our link - binding only lasts for the expression
+  CsrRef Csr (void);
+
+  // Bridge CSR addresses for vectored access
+  uint32_t brg_ctrl_addr, brg_data_addr, brg_stat_addr;
+
+  // CPU reset CSR address - writes from Xfer/Vec keep the cache in step
+  uint32_t cpu_reset_addr;
+  int ResetPre (uint32_t addr, uint32_t len);
+  void ResetPost (void);
+
+  // Queued bridge ops
+  int RemoteQueueCal (void);
+  int RemoteQueueRun (brg_op_t *op, int cnt);
+
+  // Auto-increment block transfer through current MEM-AP
+  int RemoteBlock (bool write, uint32_t addr, uint32_t *data, uint32_t cnt);
   
  public:
 
-  // Get singleton instance
+  // Open target on its own link context
+  Target (char *id);
+
+  // Get singleton instance - opened on its own link by Ptr (id)
   static Target *Ptr (void);
   static Target *Ptr (char *id);
 
   // Destructor
   virtual ~Target ();
 
+  // Link context
+  flexsoc_ctx *Ctx (void);
+  void Bind (void);
+
+  // Link profile for address region
+  int LinkRegion (uint32_t base, uint32_t size, const flexsoc_profile_t *prof);
+
+  // Device command FIFO depth in bytes (<= 0 for default)
+  void LinkFifoDepth (int bytes);
+
   // General APIs
   void ReadW (uint32_t addr, uint32_t *data, uint32_t cnt);
   void ReadH (uint32_t addr, uint16_t *data, uint32_t cnt);
@@ -61,9 +130,28 @@ private:
   void WriteW (uint32_t addr, const uint32_t *data, uint32_t cnt);
   void WriteH (uint32_t addr, const uint16_t *data, uint32_t cnt);
   void WriteB (uint32_t addr, const uint8_t *data, uint32_t cnt);
+
+  // Byte copies using widest access possible
+  void MemcpyTo (uint32_t addr, const void *src, uint32_t len);
+  void MemcpyFrom (void *dst, uint32_t addr, uint32_t len);
   uint32_t ReadReg (uint32_t addr);
   void WriteReg (uint32_t addr, uint32_t val);
 
+  // Access for other link users (master access server) - through the cache
+  // like the APIs above but returns -1 on failure instead of exiting
+  // Width 1/2/4 or 0 for widest access possible
+  int Xfer (bool write, uint32_t addr, void *data, uint32_t len, int width);
+  // Vectored ops - per op status in ok, see flexsoc_ctx_vec ()
+  int Vec (flexsoc_vec_t *vec, int cnt);
+
+  // Host page cache over the APIs above - off until a region is declared
+  int CacheRegion (uint32_t base, uint32_t size, cache_mode_t mode);
+  // Write back dirty pages
+  void CacheFlush (void);
+  // Write back and drop cached range (size 0 = everything)
+  void CacheInvalidate (uint32_t base = 0, uint32_t size = 0);
+  void CacheStats (uint64_t *hits, uint64_t *misses);
+
   // Slave interface
   void SlaveSend (const uint8_t *data, int len);
   void SlaveRegister (void (*cb) (uint8_t *, int));
@@ -80,6 +168,7 @@ private:
   uint32_t FlexsocID (void);
   uint32_t MemoryID (void);
   uint32_t CoreFreq (void);
+  // Releasing the CPU writes back cached pages and drops cached RAM
   void CPUReset (bool reset);
   bool CPUReset (void);
   void SlaveEn (bool en);
@@ -93,7 +182,7 @@ private:
   
   // Remote access
   uint32_t RemoteBase (void);
-  void RemoteTimeout (int timeout);
+  void RemoteTimeout (int ms);
   void RemoteEn (bool en);
   bool RemoteEn (void);
   uint8_t RemoteStat (void);
@@ -106,12 +195,30 @@ private:
   uint32_t RemoteAPRead (uint8_t addr, uint8_t ap = -1);
   void RemoteAPWrite (uint8_t addr, uint32_t data, uint8_t ap = -1);
   void RemoteAHBAP (uint8_t ap);
+
+  // Queued DP/AP transfers - pipelined over the link in one stream
+  // Returns transfers completed, a failing transfer has its stat set
+  int RemoteTransfer (remote_xfer_t *xfer, int cnt);
+  void RemoteMatchRetry (int retries);
+
+  // Core register snapshot of halted core - returns -1 if not halted
+  // Remote core through current MEM-AP
+  int RemoteCoreRegs (core_regs_t *regs);
+  // Core with its 0xE0000000 range mapped at base (bridge window)
+  int CoreRegs (uint32_t base, core_regs_t *regs);
+  // Write one core_regs_t word of halted remote core
+  int RemoteCoreRegWrite (int idx, uint32_t val);
+
   void RemoteCSWFixed (bool isfixed);
   bool RemoteCSWFixed (void);
   
   // Direct remote memory access (not dependent on bridge mapping)
   uint32_t RemoteReadW (uint32_t addr);
   void RemoteWriteW (uint32_t addr, uint32_t data);
+
+  // Block remote memory access - word aligned, returns -1 on fault
+  int RemoteReadW (uint32_t addr, uint32_t *data, uint32_t cnt);
+  int RemoteWriteW (uint32_t addr, const uint32_t *data, uint32_t cnt);
   
   // Remote bridge mapping
   void RemoteAHBEn (bool en);
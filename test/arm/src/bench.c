@@ -0,0 +1,159 @@
+/**
+ *  Cycle accurate access microbenchmarks. Each access is timed with the DWT
+ *  cycle counter (minus timer overhead) and posted to the BenchResults plugin:
+ *    - local ROM/RAM
+ *    - code/sys bus aliases of ROM/RAM
+ *    - plugin backed slave memory by width
+ *    - remote AHB bridge at each clock divisor (if bridge enabled)
+ *
+ *  Run with test/map/bench.map
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include "common.h"
+
+// Must match test/map/bench.map
+#define ROM_ALIAS     0x08000000
+#define RAM_ALIAS     0x30000000
+#define SLAVE_ADDR    0x40000000
+#define RESULTS_ADDR  0xf0001000
+
+#define SAMPLES       64
+#define DIV_MAX       31
+
+// BenchResults registers
+typedef struct {
+  volatile uint32_t label;
+  volatile uint32_t width;
+  volatile uint32_t cnt;
+  volatile uint32_t min;
+  volatile uint32_t max;
+  volatile uint32_t sum;
+  volatile uint32_t post;
+  volatile uint32_t div;
+  volatile uint32_t remote;
+} results_t;
+
+// DWT cycle counter
+#define DEMCR         (*(volatile uint32_t *)0xE000EDFC)
+#define DEMCR_TRCENA  (1 << 24)
+#define DWT_CTRL      (*(volatile uint32_t *)0xE0001000)
+#define DWT_CYCCNT    (*(volatile uint32_t *)0xE0001004)
+#define DWT_CYCCNTENA (1 << 0)
+
+static results_t *results = (results_t *)RESULTS_ADDR;
+static uint32_t overhead;
+static uint32_t ram[SAMPLES];
+
+// Accumulated stats for current benchmark
+static uint32_t cnt, min, max, sum;
+
+static void stat (uint32_t cycles)
+{
+  cycles = (cycles > overhead) ? cycles - overhead : 0;
+  if (!cnt || (cycles < min))
+    min = cycles;
+  if (cycles > max)
+    max = cycles;
+  sum += cycles;
+  cnt++;
+}
+
+static void post (const char *label, uint32_t width)
+{
+  results->label = (uint32_t)label;
+  results->width = width;
+  results->cnt = cnt;
+  results->min = min;
+  results->max = max;
+  results->sum = sum;
+  results->post = 1;
+  cnt = min = max = sum = 0;
+}
+
+// Time a single access expression
+#define TIME(expr)   do {                       \
+    uint32_t _start = DWT_CYCCNT;               \
+    expr;                                       \
+    stat (DWT_CYCCNT - _start);                 \
+  } while (0)
+
+static void bench_read (const char *label, uint32_t addr, uint32_t width)
+{
+  int i;
+
+  for (i = 0; i < SAMPLES; i++, addr += width) {
+    switch (width) {
+      case 1: TIME ((void)*(volatile uint8_t *)addr); break;
+      case 2: TIME ((void)*(volatile uint16_t *)addr); break;
+      default: TIME ((void)*(volatile uint32_t *)addr); break;
+    }
+  }
+  post (label, width);
+}
+
+static void bench_write (const char *label, uint32_t addr, uint32_t width)
+{
+  int i;
+
+  for (i = 0; i < SAMPLES; i++, addr += width) {
+    switch (width) {
+      case 1: TIME (*(volatile uint8_t *)addr = i); break;
+      case 2: TIME (*(volatile uint16_t *)addr = i); break;
+      default: TIME (*(volatile uint32_t *)addr = i); break;
+    }
+  }
+  post (label, width);
+}
+
+static void bench_remote (uint32_t base)
+{
+  uint32_t div, start = results->div;
+
+  // Divisors below the connected one failed to link - only slow down
+  for (div = start; div <= DIV_MAX; div++) {
+    results->div = div;
+    bench_read ("remote-read", base, 4);
+  }
+  results->div = start;
+}
+
+int main (void)
+{
+  uint32_t w, remote;
+
+  // Enable cycle counter
+  DEMCR |= DEMCR_TRCENA;
+  DWT_CYCCNT = 0;
+  DWT_CTRL |= DWT_CYCCNTENA;
+
+  // Measure timer overhead - recorded raw as overhead is still zero
+  TIME ((void)0);
+  overhead = min;
+  cnt = min = max = sum = 0;
+
+  // Local memory and aliases
+  for (w = 1; w <= 4; w <<= 1) {
+    bench_read ("rom-read", 0, w);
+    bench_read ("rom-alias-read", ROM_ALIAS, w);
+    bench_read ("ram-read", (uint32_t)ram, w);
+    bench_write ("ram-write", (uint32_t)ram, w);
+    bench_read ("ram-alias-read", (uint32_t)ram - 0x20000000 + RAM_ALIAS, w);
+    bench_write ("ram-alias-write", (uint32_t)ram - 0x20000000 + RAM_ALIAS, w);
+  }
+
+  // Plugin backed slave memory
+  for (w = 1; w <= 4; w <<= 1) {
+    bench_read ("slave-read", SLAVE_ADDR, w);
+    bench_write ("slave-write", SLAVE_ADDR, w);
+  }
+
+  // Remote bridge across clock divisors
+  remote = results->remote;
+  if (remote)
+    bench_remote (remote);
+
+  return 0;
+}
@@ -0,0 +1,54 @@
+/**
+ *  Test Stream log channel plugin from ARM. Writes enough lines to wrap the
+ *  ring several times then checks the host drained every byte.
+ *
+ *  Run with test/map/stream.map
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <string.h>
+#include "common.h"
+#include "stream.h"
+
+// Must match test/map/stream.map
+#define STREAM_ADDR  0xf0002000
+
+#define LINES        64
+
+static char hex[] = "0123456789ABCDEF";
+
+int main (void)
+{
+  int i, j;
+  uint32_t seed = 0xdeadbeef, val, total = 0;
+  char line[] = "stream 00: 00000000\n";
+
+  stream_init (STREAM_ADDR);
+  stream_puts ("stream: start\n");
+  total += strlen ("stream: start\n");
+
+  // Numbered lines with random payload
+  for (i = 0; i < LINES; i++) {
+    val = rand32 (&seed);
+    line[7] = hex[(i >> 4) & 0xf];
+    line[8] = hex[i & 0xf];
+    for (j = 0; j < 8; j++)
+      line[11 + j] = hex[(val >> (28 - (j * 4))) & 0xf];
+    stream_write (line, sizeof (line) - 1);
+    total += sizeof (line) - 1;
+  }
+
+  // Partial line then flush
+  stream_puts ("stream: done");
+  total += strlen ("stream: done");
+  stream_flush ();
+
+  // Host must have every byte
+  if (stream_count () != total)
+    return -1;
+
+  // Success
+  return 0;
+}
@@ -0,0 +1,72 @@
+/**
+ *  Time slave interface round trips with the DWT cycle counter. Each phase
+ *  reads a host (slave) address back to back while the host decides what
+ *  else runs on the link. Samples are left in a RAM mailbox for the host.
+ *
+ *  Driven by test/hw/slave_load.cpp
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include "common.h"
+
+// Must match test/hw/slave_load.cpp
+#define MBOX_ADDR     0x20002000
+#define SLAVE_ADDR    0x40000000
+#define SAMPLES       1024
+#define CMD_EXIT      0xffffffff
+
+typedef struct {
+  volatile uint32_t cmd;       // Samples to take, CMD_EXIT to return
+  volatile uint32_t done;      // Incremented after each phase
+  volatile uint32_t cnt;       // Samples taken
+  volatile uint32_t overhead;  // Cycles to read counter twice
+  volatile uint32_t cycles[SAMPLES];
+} mbox_t;
+
+// DWT cycle counter
+#define DEMCR         (*(volatile uint32_t *)0xE000EDFC)
+#define DEMCR_TRCENA  (1 << 24)
+#define DWT_CTRL      (*(volatile uint32_t *)0xE0001000)
+#define DWT_CYCCNT    (*(volatile uint32_t *)0xE0001004)
+#define DWT_CYCCNTENA (1 << 0)
+
+int main (void)
+{
+  uint32_t i, cmd, start;
+  volatile uint32_t *slave = (volatile uint32_t *)SLAVE_ADDR;
+  mbox_t *mbox = (mbox_t *)MBOX_ADDR;
+
+  // Enable cycle counter
+  DEMCR |= DEMCR_TRCENA;
+  DWT_CYCCNT = 0;
+  DWT_CTRL |= DWT_CYCCNTENA;
+
+  // Measure timing overhead
+  start = DWT_CYCCNT;
+  mbox->overhead = DWT_CYCCNT - start;
+
+  while (1) {
+
+    // Wait for host
+    while ((cmd = mbox->cmd) == 0)
+      ;
+    if (cmd == CMD_EXIT)
+      return 0;
+    if (cmd > SAMPLES)
+      cmd = SAMPLES;
+
+    // Time slave round trips
+    for (i = 0; i < cmd; i++) {
+      start = DWT_CYCCNT;
+      (void)*slave;
+      mbox->cycles[i] = DWT_CYCCNT - start;
+    }
+
+    // Signal host
+    mbox->cnt = cmd;
+    mbox->cmd = 0;
+    mbox->done++;
+  }
+}
@@ -0,0 +1,98 @@
+/**
+ *  Firmware side of the Stream log channel plugin
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <stdint.h>
+#include <string.h>
+#include "stream.h"
+
+// Ring shared with host - must match Stream plugin
+typedef struct {
+  volatile uint32_t head;   // Written by firmware
+  volatile uint32_t tail;   // Written by host
+  uint32_t size;
+  uint8_t  data[STREAM_SZ];
+} ring_t;
+
+// Stream plugin registers
+typedef struct {
+  volatile uint32_t ring;
+  volatile uint32_t head;
+  volatile uint32_t flush;
+  volatile uint32_t count;
+} stream_t;
+
+static ring_t ring;
+static stream_t *stream;
+
+// Head last handed to host
+static uint32_t rung;
+
+void stream_init (uint32_t base)
+{
+  stream = (stream_t *)base;
+  ring.head = ring.tail = rung = 0;
+  ring.size = STREAM_SZ;
+  stream->ring = (uint32_t)&ring;
+}
+
+static void doorbell (void)
+{
+  if (ring.head != rung) {
+    rung = ring.head;
+    stream->head = rung;
+  }
+}
+
+void stream_write (const void *buf, size_t len)
+{
+  const uint8_t *src = (const uint8_t *)buf;
+  uint32_t head = ring.head, off, n;
+  int nl = 0;
+
+  while (len) {
+
+    // Wait for host to free space
+    while ((n = STREAM_SZ - (head - ring.tail)) == 0) {
+      ring.head = head;
+      doorbell ();
+    }
+
+    // Copy up to wrap
+    off = head & (STREAM_SZ - 1);
+    if (n > STREAM_SZ - off)
+      n = STREAM_SZ - off;
+    if (n > len)
+      n = len;
+    if (!nl && memchr (src, '\n', n))
+      nl = 1;
+    memcpy (&ring.data[off], src, n);
+    head += n;
+    src += n;
+    len -= n;
+  }
+  ring.head = head;
+
+  // Batch doorbells per line or half ring
+  if (nl || (head - rung >= STREAM_SZ / 2))
+    doorbell ();
+}
+
+void stream_puts (const char *str)
+{
+  stream_write (str, strlen (str));
+}
+
+void stream_flush (void)
+{
+  rung = ring.head;
+  stream->flush = rung;
+}
+
+uint32_t stream_count (void)
+{
+  return stream->count;
+}
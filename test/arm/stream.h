@@ -0,0 +1,36 @@
+/**
+ *  Firmware side of the Stream log channel plugin. Bytes are queued in a
+ *  ring in local RAM and the host drains them in the background, so a write
+ *  costs one slave round trip per doorbell rather than one per byte.
+ *
+ *  The doorbell rings on newline, when the ring is half full, or on flush.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Ring data bytes - power of two
+#ifndef STREAM_SZ
+#define STREAM_SZ   1024
+#endif
+
+// Attach to Stream plugin at base
+void stream_init (uint32_t base);
+
+// Queue bytes - blocks only while the ring is full
+void stream_write (const void *buf, size_t len);
+void stream_puts (const char *str);
+
+// Hand everything queued to host and wait for it to drain
+void stream_flush (void);
+
+// Total bytes host has drained
+uint32_t stream_count (void);
+
+#endif /* STREAM_H */
@@ -0,0 +1,470 @@
+/**
+ *  Parametric link benchmark. Sweeps transport, operation, width, transfer
+ *  size, speed mode and pipeline depth. Each configuration is warmed up and
+ *  timed over repeated trials with CLOCK_MONOTONIC.
+ *
+ *  Runs against hardware, the verilated sim or a protocol emulator - any
+ *  device id accepted by flexsoc_open. Multiple device ids sweep transports.
+ *
+ *  Example:
+ *    test-bench 127.0.0.1:5555 --op=read,write --size=4,1k,64k --format=csv
+ *
+ *  CSV with --samples can be compared against stored baselines using
+ *  bench-compare.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <argp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "Target.h"
+#include "flexsoc.h"
+#include "common.h"
+#include "err.h"
+
+#define SEED        0xdeadbeef
+#define MAX_LIST    16
+#define MAX_DEV     4
+
+// Unmapped address - completes on slave interface
+#define SLAVE_ADDR  0x40000000
+
+typedef enum {
+  FMT_TEXT = 0,
+  FMT_CSV  = 1,
+  FMT_JSON = 2,
+} fmt_t;
+
+typedef enum {
+  OP_WRITE = 0,
+  OP_READ  = 1,
+  OP_SLAVE = 2,
+} op_t;
+
+static const char *op_name[] = {"write", "read", "slave"};
+
+// Integer list argument
+typedef struct {
+  int val[MAX_LIST];
+  int cnt;
+} list_t;
+
+typedef struct {
+  char    *dev[MAX_DEV];
+  int     dev_cnt;
+  list_t  op;
+  list_t  width;
+  list_t  size;
+  list_t  hispeed;
+  list_t  depth;       // 0 = profile default
+  int     trials;
+  int     warmup;
+  uint32_t addr;
+  fmt_t   fmt;
+  bool    samples;     // Emit raw trial samples
+  FILE    *out;
+} args_t;
+
+// Single configuration
+typedef struct {
+  const char *dev;
+  op_t     op;
+  int      width;
+  int      size;
+  bool     hispeed;
+  int      depth;
+} config_t;
+
+// Trial statistics
+typedef struct {
+  uint64_t median;
+  uint64_t p99;
+  uint64_t p999;
+  uint64_t min;
+  uint64_t max;
+  double   bps;
+} stats_t;
+
+static args_t args;
+static Target *target;
+static int rows;
+
+static uint64_t now_ns (void)
+{
+  timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static uint32_t parse_uint (const char *str, char **end)
+{
+  uint32_t val = strtoul (str, end, 0);
+  if (**end == 'k')
+    val *= 1024, (*end)++;
+  else if (**end == 'M')
+    val *= (1024 * 1024), (*end)++;
+  return val;
+}
+
+static void parse_list (list_t *list, char *arg, const char **names, int ncnt)
+{
+  char *tok, *end;
+  int i;
+
+  list->cnt = 0;
+  for (tok = strtok (arg, ","); tok; tok = strtok (NULL, ",")) {
+    if (list->cnt == MAX_LIST)
+      err ("Too many values: %s", arg);
+
+    // Named value
+    for (i = 0; i < ncnt; i++)
+      if (!strcmp (tok, names[i]))
+        break;
+    if (i < ncnt) {
+      list->val[list->cnt++] = i;
+      continue;
+    }
+    if (ncnt)
+      err ("Invalid value: %s", tok);
+
+    // Numeric value
+    list->val[list->cnt++] = parse_uint (tok, &end);
+    if (*end)
+      err ("Invalid value: %s", tok);
+  }
+}
+
+static void slave_cb (uint8_t *buf, int len)
+{
+  uint8_t resp[5];
+
+  // Write
+  if (buf[0] & 0x08) {
+    resp[0] = 0x00;
+    target->SlaveSend (resp, 1);
+  }
+  // Readw
+  else {
+    resp[0] = 0x30;
+    memcpy (&resp[1], "\x11\x22\x33\x44", 4);
+    target->SlaveSend (resp, 5);
+  }
+}
+
+static void xfer (config_t *cfg, uint8_t *buf)
+{
+  uint32_t val;
+  int cnt = cfg->size / cfg->width;
+
+  switch (cfg->op) {
+    case OP_WRITE:
+      switch (cfg->width) {
+        case 1: target->WriteB (args.addr, buf, cnt); break;
+        case 2: target->WriteH (args.addr, (uint16_t *)buf, cnt); break;
+        case 4: target->WriteW (args.addr, (uint32_t *)buf, cnt); break;
+      }
+      break;
+    case OP_READ:
+      switch (cfg->width) {
+        case 1: target->ReadB (args.addr, buf, cnt); break;
+        case 2: target->ReadH (args.addr, (uint16_t *)buf, cnt); break;
+        case 4: target->ReadW (args.addr, (uint32_t *)buf, cnt); break;
+      }
+      break;
+    case OP_SLAVE:
+      target->ReadW (SLAVE_ADDR, &val, 1);
+      break;
+  }
+}
+
+static int cmp_u64 (const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// Nearest rank percentile of sorted samples
+static uint64_t percentile (uint64_t *s, int n, double p)
+{
+  int idx = (int)((p * n) + 0.999999) - 1;
+  if (idx < 0)
+    idx = 0;
+  if (idx >= n)
+    idx = n - 1;
+  return s[idx];
+}
+
+static void stats_calc (uint64_t *s, int n, int size, stats_t *st)
+{
+  qsort (s, n, sizeof (uint64_t), cmp_u64);
+  st->median = (n & 1) ? s[n / 2] : (s[(n / 2) - 1] + s[n / 2]) / 2;
+  st->p99 = percentile (s, n, 0.99);
+  st->p999 = percentile (s, n, 0.999);
+  st->min = s[0];
+  st->max = s[n - 1];
+  st->bps = st->median ? (size * 1e9) / st->median : 0;
+}
+
+static void report_samples (uint64_t *s, int n, const char *sep)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    fprintf (args.out, "%s%lu", i ? sep : "", s[i]);
+}
+
+static void report (config_t *cfg, stats_t *st, uint64_t *s)
+{
+  switch (args.fmt) {
+    case FMT_TEXT:
+      if (!rows)
+        fprintf (args.out, "%-20s %-6s %5s %8s %4s %5s %12s %12s %12s %14s\n",
+                 "device", "op", "width", "size", "mode", "depth",
+                 "median_us", "p99_us", "p99.9_us", "bytes/sec");
+      fprintf (args.out, "%-20s %-6s %5d %8d %4s %5d %12.2f %12.2f %12.2f %14.0f\n",
+               cfg->dev, op_name[cfg->op], cfg->width, cfg->size,
+               cfg->hispeed ? "hi" : "lo", cfg->depth,
+               st->median / 1000.0, st->p99 / 1000.0, st->p999 / 1000.0, st->bps);
+      break;
+    case FMT_CSV:
+      if (!rows)
+        fprintf (args.out, "device,op,width,size,mode,depth,trials,"
+                 "min_ns,median_ns,p99_ns,p999_ns,max_ns,bytes_per_sec%s\n",
+                 args.samples ? ",samples_ns" : "");
+      fprintf (args.out, "%s,%s,%d,%d,%s,%d,%d,%lu,%lu,%lu,%lu,%lu,%.0f",
+               cfg->dev, op_name[cfg->op], cfg->width, cfg->size,
+               cfg->hispeed ? "hi" : "lo", cfg->depth, args.trials,
+               st->min, st->median, st->p99, st->p999, st->max, st->bps);
+      if (args.samples) {
+        fprintf (args.out, ",");
+        report_samples (s, args.trials, " ");
+      }
+      fprintf (args.out, "\n");
+      break;
+    case FMT_JSON:
+      fprintf (args.out, "%s\n  {\"device\": \"%s\", \"op\": \"%s\", \"width\": %d, "
+               "\"size\": %d, \"mode\": \"%s\", \"depth\": %d, \"trials\": %d, "
+               "\"min_ns\": %lu, \"median_ns\": %lu, \"p99_ns\": %lu, "
+               "\"p999_ns\": %lu, \"max_ns\": %lu, \"bytes_per_sec\": %.0f",
+               rows ? "," : "[", cfg->dev, op_name[cfg->op], cfg->width, cfg->size,
+               cfg->hispeed ? "hi" : "lo", cfg->depth, args.trials,
+               st->min, st->median, st->p99, st->p999, st->max, st->bps);
+      if (args.samples) {
+        fprintf (args.out, ", \"samples_ns\": [");
+        report_samples (s, args.trials, ", ");
+        fprintf (args.out, "]");
+      }
+      fprintf (args.out, "}");
+      break;
+  }
+  rows++;
+}
+
+static void run (config_t *cfg, uint8_t *buf, uint8_t *exp, uint64_t *samples)
+{
+  int i;
+  uint64_t start;
+  stats_t st;
+  flexsoc_profile_t prof = *flexsoc_profile_builtin (cfg->hispeed);
+
+  // Configure link
+  if (cfg->depth)
+    prof.depth = cfg->depth;
+  if (flexsoc_ctx_profile (target->Ctx (), &prof))
+    err ("Invalid depth: %d", cfg->depth);
+  cfg->depth = prof.depth;
+
+  // Verify data path before timing
+  if (cfg->op == OP_READ) {
+    target->WriteB (args.addr, exp, cfg->size);
+    memset (buf, 0, cfg->size);
+    xfer (cfg, buf);
+    if (memcmp (buf, exp, cfg->size))
+      err ("Read mismatch: width=%d size=%d", cfg->width, cfg->size);
+  }
+  else
+    memcpy (buf, exp, cfg->size);
+
+  // Warm up
+  for (i = 0; i < args.warmup; i++)
+    xfer (cfg, buf);
+
+  // Time trials
+  for (i = 0; i < args.trials; i++) {
+    start = now_ns ();
+    xfer (cfg, buf);
+    samples[i] = now_ns () - start;
+  }
+
+  stats_calc (samples, args.trials, (cfg->op == OP_SLAVE) ? 4 : cfg->size, &st);
+  report (cfg, &st, samples);
+}
+
+static void bench_dev (const char *dev, uint8_t *buf, uint8_t *exp, uint64_t *samples)
+{
+  int o, w, s, h, d;
+  char *id;
+  config_t cfg;
+
+  // Open target - copy id as it's modified inplace
+  id = strdup (dev);
+  if (!id)
+    err ("Failed to malloc id");
+  target = new Target (id);
+  cfg.dev = dev;
+
+  // Setup slave responder
+  target->SlaveRegister (&slave_cb);
+  target->SlaveEn (true);
+
+  for (o = 0; o < args.op.cnt; o++)
+    for (w = 0; w < args.width.cnt; w++)
+      for (s = 0; s < args.size.cnt; s++)
+        for (h = 0; h < args.hispeed.cnt; h++)
+          for (d = 0; d < args.depth.cnt; d++) {
+            cfg.op = (op_t)args.op.val[o];
+            cfg.width = args.width.val[w];
+            cfg.size = args.size.val[s];
+            cfg.hispeed = args.hispeed.val[h];
+            cfg.depth = args.depth.val[d];
+
+            // Slave only uses single word reads
+            if ((cfg.op == OP_SLAVE) && ((w | s) != 0))
+              continue;
+            if (cfg.op == OP_SLAVE)
+              cfg.width = cfg.size = 4;
+
+            // Skip sizes not a multiple of width
+            if ((cfg.size < cfg.width) || (cfg.size % cfg.width))
+              continue;
+            run (&cfg, buf, exp, samples);
+          }
+
+  // Close target
+  target->SlaveEn (false);
+  delete target;
+  target = NULL;
+  free (id);
+}
+
+static int parse_opts (int key, char *arg, struct argp_state *state)
+{
+  static const char *ops[] = {"write", "read", "slave"};
+  static const char *modes[] = {"lo", "hi"};
+  static const char *fmts[] = {"text", "csv", "json"};
+  list_t tmp;
+
+  switch (key) {
+    case 'o': parse_list (&args.op, arg, ops, 3); break;
+    case 'w': parse_list (&args.width, arg, NULL, 0); break;
+    case 's': parse_list (&args.size, arg, NULL, 0); break;
+    case 'm': parse_list (&args.hispeed, arg, modes, 2); break;
+    case 'd': parse_list (&args.depth, arg, NULL, 0); break;
+    case 'n': args.trials = strtoul (arg, NULL, 0); break;
+    case 'u': args.warmup = strtoul (arg, NULL, 0); break;
+    case 'a': args.addr = strtoul (arg, NULL, 0); break;
+    case 'f':
+      parse_list (&tmp, arg, fmts, 3);
+      args.fmt = (fmt_t)tmp.val[0];
+      break;
+    case 'S': args.samples = true; break;
+    case 'O':
+      args.out = fopen (arg, "w");
+      if (!args.out)
+        err ("Failed to open: %s", arg);
+      break;
+
+    case ARGP_KEY_ARG:
+      if (args.dev_cnt == MAX_DEV)
+        argp_usage (state);
+      args.dev[args.dev_cnt++] = arg;
+      break;
+
+    // Check arguments
+    case ARGP_KEY_END:
+      if (!args.dev_cnt || (args.trials < 1))
+        argp_usage (state);
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+  }
+  return 0;
+}
+
+static struct argp_option options[] = {
+  {0, 0, 0, 0, "Sweep (comma separated lists):", 1},
+  {"op",     'o', "OPS",    0, "write,read,slave (default=all)"},
+  {"width",  'w', "BYTES",  0, "Access widths (default=1,2,4)"},
+  {"size",   's', "BYTES",  0, "Transfer sizes, k/M suffix (default=4,256,8k)"},
+  {"mode",   'm', "MODES",  0, "lo,hi speed profile (default=hi)"},
+  {"depth",  'd', "N",      0, "Pipeline depths, 0=profile default (default=0)"},
+  {0, 0, 0, 0, "Measurement:", 2},
+  {"trials", 'n', "N",      0, "Timed trials per configuration (default=20)"},
+  {"warmup", 'u', "N",      0, "Untimed warmup trials (default=2)"},
+  {"addr",   'a', "ADDR",   0, "Target buffer address (default=0x20000000)"},
+  {0, 0, 0, 0, "Output:", 3},
+  {"format", 'f', "FMT",    0, "text,csv,json (default=text)"},
+  {"output", 'O', "FILE",   0, "Write results to file (default=stdout)"},
+  {"samples", 'S', 0,       0, "Include raw trial samples (csv/json)"},
+  {0}
+};
+
+static struct argp bench_argp = {options, &parse_opts, "DEVICE...", 0};
+
+int main (int argc, char **argv)
+{
+  int i, max = 0;
+  uint32_t seed = SEED;
+  uint8_t *buf, *exp;
+  uint64_t *samples;
+
+  // Defaults
+  memset (&args, 0, sizeof (args));
+  args.op = {{OP_WRITE, OP_READ, OP_SLAVE}, 3};
+  args.width = {{1, 2, 4}, 3};
+  args.size = {{4, 256, 8 * 1024}, 3};
+  args.hispeed = {{1}, 1};
+  args.depth = {{0}, 1};
+  args.trials = 20;
+  args.warmup = 2;
+  args.addr = 0x20000000;
+  args.out = stdout;
+
+  // Parse args
+  argp_parse (&bench_argp, argc, argv, 0, 0, 0);
+
+  // Allocate buffers for largest transfer
+  for (i = 0; i < args.size.cnt; i++)
+    if (args.size.val[i] > max)
+      max = args.size.val[i];
+  buf = (uint8_t *)malloc (max + 4);
+  exp = (uint8_t *)malloc (max + 4);
+  samples = (uint64_t *)malloc (args.trials * sizeof (uint64_t));
+  if (!buf || !exp || !samples)
+    err ("Failed to malloc buf");
+
+  // Generate random data
+  for (i = 0; i < max + 4; i++)
+    exp[i] = rand32 (&seed) & 0xff;
+
+  // Run sweep on each device
+  for (i = 0; i < args.dev_cnt; i++)
+    bench_dev (args.dev[i], buf, exp, samples);
+  if (args.fmt == FMT_JSON)
+    fprintf (args.out, rows ? "\n]\n" : "[]\n");
+
+  // Clean up
+  if (args.out != stdout)
+    fclose (args.out);
+  free (samples);
+  free (exp);
+  free (buf);
+  return 0;
+}
@@ -0,0 +1,271 @@
+/**
+ *  Compare test-bench results against stored baselines. Runs must be
+ *  captured with --format=csv --samples so each configuration carries its
+ *  raw trial samples.
+ *
+ *  Matching configurations are compared with a two sided Mann-Whitney U
+ *  test on the samples. A configuration regresses when the difference is
+ *  significant and the median latency grew (throughput dropped) past the
+ *  threshold. Any regression returns a nonzero exit code.
+ *
+ *  Usage:
+ *    bench-compare --save=NAME run.csv      Store run as baseline NAME
+ *    bench-compare --baseline=NAME run.csv  Diff run against baseline NAME
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <argp.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "err.h"
+
+using namespace std;
+
+// Exit codes
+#define EXIT_OK          0
+#define EXIT_REGRESSION  1
+
+typedef struct {
+  string key;               // device,op,width,size,mode,depth
+  uint64_t median;
+  double bps;
+  vector<double> samples;
+} result_t;
+
+static struct {
+  const char *dir;
+  const char *save;
+  const char *baseline;
+  const char *run;
+  double threshold;         // Percent
+  double alpha;             // Significance level
+} args;
+
+static vector<string> split (const string &line, char sep)
+{
+  vector<string> out;
+  string tok;
+  stringstream ss (line);
+
+  while (getline (ss, tok, sep))
+    out.push_back (tok);
+  return out;
+}
+
+static int column (vector<string> &hdr, const char *name)
+{
+  for (size_t i = 0; i < hdr.size (); i++)
+    if (hdr[i] == name)
+      return i;
+  return -1;
+}
+
+static vector<result_t> load (const string &path)
+{
+  int i, c[9];
+  string line;
+  vector<string> hdr, tok;
+  vector<result_t> res;
+  ifstream in (path);
+  static const char *cols[] = {"device", "op", "width", "size", "mode", "depth",
+                               "median_ns", "bytes_per_sec", "samples_ns"};
+
+  if (!in.is_open ())
+    err ("Failed to open: %s", path.c_str ());
+
+  // Locate columns
+  if (!getline (in, line))
+    err ("Empty results: %s", path.c_str ());
+  hdr = split (line, ',');
+  for (i = 0; i < 9; i++) {
+    c[i] = column (hdr, cols[i]);
+    if (c[i] < 0)
+      err ("%s: missing %s (run test-bench --format=csv --samples)",
+           path.c_str (), cols[i]);
+  }
+
+  // Parse rows
+  while (getline (in, line)) {
+    result_t r;
+    if (line.empty ())
+      continue;
+    tok = split (line, ',');
+    if (tok.size () != hdr.size ())
+      err ("%s: malformed row: %s", path.c_str (), line.c_str ());
+    for (i = 0; i < 6; i++)
+      r.key += (i ? "," : "") + tok[c[i]];
+    r.median = strtoull (tok[c[6]].c_str (), NULL, 0);
+    r.bps = strtod (tok[c[7]].c_str (), NULL);
+    for (auto &s : split (tok[c[8]], ' '))
+      if (!s.empty ())
+        r.samples.push_back (strtod (s.c_str (), NULL));
+    if (r.samples.empty ())
+      err ("%s: no samples for %s", path.c_str (), r.key.c_str ());
+    res.push_back (r);
+  }
+  return res;
+}
+
+// Two sided Mann-Whitney U test (normal approximation with tie correction)
+static double mann_whitney (const vector<double> &a, const vector<double> &b)
+{
+  size_t i, j, k;
+  double n1 = a.size (), n2 = b.size (), n = n1 + n2;
+  double r1 = 0, ties = 0, u, mu, sigma, z;
+  vector<pair<double, int>> all;
+
+  for (i = 0; i < a.size (); i++)
+    all.push_back (make_pair (a[i], 0));
+  for (i = 0; i < b.size (); i++)
+    all.push_back (make_pair (b[i], 1));
+  sort (all.begin (), all.end ());
+
+  // Average ranks over ties
+  for (i = 0; i < all.size (); i = j) {
+    for (j = i; (j < all.size ()) && (all[j].first == all[i].first); j++)
+      ;
+    for (k = i; k < j; k++)
+      if (all[k].second == 0)
+        r1 += (i + j + 1) / 2.0;
+    ties += pow (j - i, 3) - (j - i);
+  }
+
+  u = r1 - (n1 * (n1 + 1) / 2);
+  mu = n1 * n2 / 2;
+  sigma = sqrt ((n1 * n2 / 12) * ((n + 1) - ties / (n * (n - 1))));
+  if (sigma == 0)
+    return 1.0;
+
+  // Continuity correction
+  z = (fabs (u - mu) - 0.5) / sigma;
+  if (z < 0)
+    z = 0;
+  return erfc (z / sqrt (2));
+}
+
+static int compare (vector<result_t> &base, vector<result_t> &run)
+{
+  int regress = 0, matched = 0;
+  double p, dlat, dbps;
+  const char *verdict;
+
+  printf ("%-40s %12s %12s %8s %8s %10s  %s\n", "config",
+          "base_med_us", "run_med_us", "lat%", "bps%", "p", "result");
+  for (auto &r : run) {
+    auto b = find_if (base.begin (), base.end (),
+                      [&r](const result_t &x) { return x.key == r.key; });
+    if (b == base.end ()) {
+      printf ("%-40s %12s\n", r.key.c_str (), "(new)");
+      continue;
+    }
+    matched++;
+
+    // Relative change and significance
+    p = mann_whitney (b->samples, r.samples);
+    dlat = b->median ? 100.0 * ((double)r.median - b->median) / b->median : 0;
+    dbps = b->bps ? 100.0 * (r.bps - b->bps) / b->bps : 0;
+    if (p >= args.alpha)
+      verdict = "same";
+    else if (dlat > args.threshold)
+      verdict = "REGRESSION", regress++;
+    else if (dlat < -args.threshold)
+      verdict = "improved";
+    else
+      verdict = "within threshold";
+
+    printf ("%-40s %12.2f %12.2f %+7.1f%% %+7.1f%% %10.2e  %s\n", r.key.c_str (),
+            b->median / 1000.0, r.median / 1000.0, dlat, dbps, p, verdict);
+  }
+
+  printf ("%d compared, %d regressed (threshold=%.1f%% alpha=%g)\n",
+          matched, regress, args.threshold, args.alpha);
+  return regress ? EXIT_REGRESSION : EXIT_OK;
+}
+
+static void save (const char *name, const char *run)
+{
+  string path = string (args.dir) + "/" + name + ".csv";
+  ifstream in (run, ios::binary);
+  ofstream out (path, ios::binary);
+
+  // Validate before storing
+  load (run);
+  if (!out.is_open ())
+    err ("Failed to create: %s", path.c_str ());
+  out << in.rdbuf ();
+  printf ("Saved baseline %s\n", path.c_str ());
+}
+
+static int parse_opts (int key, char *arg, struct argp_state *state)
+{
+  switch (key) {
+    case 'd': args.dir = arg; break;
+    case 's': args.save = arg; break;
+    case 'b': args.baseline = arg; break;
+    case 't': args.threshold = strtod (arg, NULL); break;
+    case 'a': args.alpha = strtod (arg, NULL); break;
+
+    case ARGP_KEY_ARG:
+      if (args.run)
+        argp_usage (state);
+      args.run = arg;
+      break;
+
+    // Check arguments
+    case ARGP_KEY_END:
+      if (!args.run || (!args.save == !args.baseline))
+        argp_usage (state);
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+  }
+  return 0;
+}
+
+static struct argp_option options[] = {
+  {"save",      's', "NAME", 0, "Store run as named baseline"},
+  {"baseline",  'b', "NAME", 0, "Compare run against named baseline"},
+  {"dir",       'd', "DIR",  0, "Baseline directory (default=$FLEXSOC_BASELINES or .)"},
+  {"threshold", 't', "PCT",  0, "Regression threshold in percent (default=5)"},
+  {"alpha",     'a', "P",    0, "Significance level (default=0.01)"},
+  {0}
+};
+
+static struct argp compare_argp = {options, &parse_opts, "RUN.csv", 0};
+
+int main (int argc, char **argv)
+{
+  vector<result_t> base, run;
+
+  // Defaults
+  args.dir = getenv ("FLEXSOC_BASELINES") ? getenv ("FLEXSOC_BASELINES") : ".";
+  args.threshold = 5;
+  args.alpha = 0.01;
+
+  // Parse args
+  argp_parse (&compare_argp, argc, argv, 0, 0, 0);
+
+  // Store baseline
+  if (args.save) {
+    save (args.save, args.run);
+    return EXIT_OK;
+  }
+
+  // Diff against baseline
+  base = load (string (args.dir) + "/" + args.baseline + ".csv");
+  run = load (args.run);
+  return compare (base, run);
+}
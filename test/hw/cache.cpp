@@ -0,0 +1,194 @@
+/**
+ *  Test host page cache. Random mixed width accesses through Target are
+ *  checked against a host model, then the device is checked directly after
+ *  write back and CPU release.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "Target.h"
+#include "flexsoc.h"
+#include "common.h"
+#include "err.h"
+
+#define SEED       0xdeadbeef
+#define ROM        0x00000000
+#define RAM        0x20000000
+#define SPAN       (32 * 1024)
+#define OPS        2000
+
+// Parks released CPU: SP, reset vector, b .
+static const uint32_t park[] = {RAM + SPAN, ROM + 9, 0xe7fe};
+
+static uint8_t model[2][SPAN];
+
+static double now (void)
+{
+  timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void access (Target *target, bool write, int width, uint32_t addr, uint8_t *buf, uint32_t len)
+{
+  switch (width) {
+    case 1:
+      write ? target->WriteB (addr, buf, len) : target->ReadB (addr, buf, len);
+      break;
+    case 2:
+      write ? target->WriteH (addr, (uint16_t *)buf, len / 2) :
+        target->ReadH (addr, (uint16_t *)buf, len / 2);
+      break;
+    case 4:
+      write ? target->WriteW (addr, (uint32_t *)buf, len / 4) :
+        target->ReadW (addr, (uint32_t *)buf, len / 4);
+      break;
+    default:
+      write ? target->MemcpyTo (addr, buf, len) : target->MemcpyFrom (buf, addr, len);
+      break;
+  }
+}
+
+// Compare device against model bypassing cache
+static int check_device (flexsoc_ctx *ctx)
+{
+  static uint8_t dev[SPAN];
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    if (flexsoc_ctx_memcpy_from (ctx, dev, i ? RAM : ROM, SPAN))
+      err ("Transfer failed");
+    if (memcmp (dev, model[i], SPAN)) {
+      printf ("Device mismatch in %s\n", i ? "RAM" : "ROM");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int random_ops (Target *target)
+{
+  uint8_t buf[4096 + 4];
+  uint32_t val = SEED, off, len, base;
+  int i, r, width;
+  bool write;
+
+  for (i = 0; i < OPS; i++) {
+    rand32 (&val);
+    r = val & 1;
+    write = val & 2;
+    width = (val >> 2) & 7;
+    width = (width < 3) ? (1 << width) : 0;
+    rand32 (&val);
+    len = (val % 4092) + 1;
+    rand32 (&val);
+    off = 16 + val % (SPAN - 16 - 4096);
+
+    // Align to width - park stub below 16 stays intact
+    if (width) {
+      off &= ~(width - 1);
+      len = (len + width - 1) & ~(width - 1);
+    }
+
+    base = r ? RAM : ROM;
+
+    if (write) {
+      rand32 (&val);
+      memset (buf, val & 0xff, len);
+      buf[0] = i;
+      access (target, true, width, base + off, buf, len);
+      memcpy (&model[r][off], buf, len);
+    }
+    else {
+      access (target, false, width, base + off, buf, len);
+      if (memcmp (buf, &model[r][off], len)) {
+        printf ("Mismatch: op=%d addr=%08X len=%d width=%d\n", i, base + off, len, width);
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+int main (int argc, char **argv)
+{
+  Target *target;
+  flexsoc_ctx *ctx;
+  uint64_t hits, misses, prev;
+  uint8_t buf[SPAN];
+  double t0, t1, t2;
+
+  if (argc != 2)
+    err ("Must pass interface");
+
+  // Open interface to flexsoc
+  target = Target::Ptr (argv[1]);
+  ctx = target->Ctx ();
+
+  // Seed model from device with CPU held
+  target->CPUReset (true);
+  memcpy (model[0], park, sizeof (park));
+  if (flexsoc_ctx_memcpy_to (ctx, ROM, park, sizeof (park)) ||
+      flexsoc_ctx_memcpy_from (ctx, &model[0][sizeof (park)], ROM + sizeof (park),
+                               SPAN - sizeof (park)) ||
+      flexsoc_ctx_memcpy_from (ctx, model[1], RAM, SPAN))
+    err ("Transfer failed");
+
+  // Cache both
+  if (target->CacheRegion (ROM, SPAN, CACHE_ROM) ||
+      target->CacheRegion (RAM, SPAN, CACHE_RAM))
+    err ("Failed to declare cache regions");
+
+  // Mixed accesses
+  if (random_ops (target))
+    err ("Cached access test failed");
+  target->CacheStats (&hits, &misses);
+  printf ("hits=%llu misses=%llu\n", (unsigned long long)hits, (unsigned long long)misses);
+
+  // Write back
+  target->CacheFlush ();
+  if (check_device (ctx))
+    err ("Write back test failed");
+
+  // Dirty RAM must land before CPU runs
+  memset (buf, 0x5a, 64);
+  target->WriteB (RAM + 0x100, buf, 64);
+  memcpy (&model[1][0x100], buf, 64);
+  target->CPUReset (false);
+  if (check_device (ctx))
+    err ("Release write back test failed");
+
+  // RAM goes to link while running, ROM stays cached
+  target->CacheStats (&hits, &prev);
+  target->ReadB (RAM, buf, SPAN);
+  target->CacheStats (&hits, &misses);
+  if (misses != prev)
+    err ("RAM cached while CPU running");
+
+  // ROM writes land immediately while running
+  memset (buf, 0xa5, 64);
+  target->WriteB (ROM + 0x100, buf, 64);
+  memcpy (&model[0][0x100], buf, 64);
+  if (check_device (ctx))
+    err ("ROM write through test failed");
+  target->CPUReset (true);
+
+  // Repeated inspection
+  target->CacheInvalidate ();
+  t0 = now ();
+  target->MemcpyFrom (buf, ROM, SPAN);
+  t1 = now ();
+  target->MemcpyFrom (buf, ROM, SPAN);
+  t2 = now ();
+  printf ("cold %.1f us, warm %.1f us\n", (t1 - t0) * 1e6, (t2 - t1) * 1e6);
+
+  // Close interface
+  delete target;
+  return 0;
+}
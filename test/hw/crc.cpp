@@ -0,0 +1,102 @@
+/**
+ *  Test target side CRC32 helper. Block checksums of ROM and RAM are
+ *  checked against the host, a changed block must be spotted, and ranges
+ *  over the helper refused.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "Target.h"
+#include "crc.h"
+#include "common.h"
+#include "err.h"
+
+#define SEED       0xdeadbeef
+#define ROM        0x00000000
+#define RAM        0x20000000
+#define SPAN       (16 * 1024)
+#define BLK        1024
+#define BLOCKS     (SPAN / BLK)
+
+static uint8_t img[SPAN];
+
+static double now (void)
+{
+  timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int check (uint32_t addr, uint32_t *bad)
+{
+  uint32_t crc[BLOCKS];
+  int i;
+
+  if (crc_blocks (addr, BLK, BLOCKS, crc))
+    return -1;
+  *bad = 0;
+  for (i = 0; i < BLOCKS; i++)
+    if (crc[i] != crc32 (0, &img[i * BLK], BLK))
+      *bad |= 1 << i;
+  return 0;
+}
+
+int main (int argc, char **argv)
+{
+  Target *target;
+  uint32_t seed = SEED, bad, crc, i;
+  double t0, t1, t2;
+
+  if (argc != 2)
+    err ("Must pass interface");
+
+  // Known CRC32 check value
+  if (crc32 (0, "123456789", 9) != 0xCBF43926)
+    err ("Host CRC32 broken");
+
+  // Open interface to flexsoc
+  target = Target::Ptr (argv[1]);
+  target->CPUReset (true);
+  for (i = 0; i < SPAN / 4; i++)
+    ((uint32_t *)img)[i] = rand32 (&seed);
+  target->MemcpyTo (ROM, img, SPAN);
+  target->MemcpyTo (RAM, img, SPAN);
+
+  if (crc_open ())
+    err ("Failed to start CRC helper");
+
+  // Everything matches, vectors included
+  if (check (ROM, &bad) || bad)
+    err ("ROM CRC mismatch: %08X", bad);
+  if (check (RAM, &bad) || bad)
+    err ("RAM CRC mismatch: %08X", bad);
+
+  // Single changed byte
+  target->WriteB (ROM + 5 * BLK + 17, &img[0], 1);
+  if (check (ROM, &bad) || (bad != (1 << 5)))
+    err ("Changed block not found: %08X", bad);
+
+  // Whole image in one exchange against a full readback
+  t0 = now ();
+  if (crc_blocks (RAM, SPAN, 1, &crc) || (crc != crc32 (0, img, SPAN)))
+    err ("Image CRC mismatch");
+  t1 = now ();
+  target->MemcpyFrom (img, RAM, SPAN);
+  t2 = now ();
+  printf ("verify %d bytes: crc %.1f ms, readback %.1f ms\n", SPAN, (t1 - t0) * 1e3, (t2 - t1) * 1e3);
+
+  // Helper can't check itself
+  if (crc_blocks (RAM + ((target->MemoryID () >> 16) << 10) - BLK, BLK, 1, &crc) != 1)
+    err ("Overlap not refused");
+  crc_close ();
+
+  // Close interface
+  delete target;
+  return 0;
+}
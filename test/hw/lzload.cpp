@@ -0,0 +1,105 @@
+/**
+ *  Test compressed loading through the on-target decompressor. Sparse
+ *  images are loaded to ROM and RAM and read back, incompressible data
+ *  must be refused. Compressed and raw load times are compared.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "Target.h"
+#include "lzload.h"
+#include "common.h"
+#include "err.h"
+
+#define SEED       0xdeadbeef
+#define ROM        0x00000000
+#define RAM        0x20000000
+#define SPAN       (32 * 1024)
+
+static uint8_t img[SPAN], rb[SPAN];
+
+static double now (void)
+{
+  timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Random code-like head, zero fill, constant tail
+static void sparse (uint32_t *seed)
+{
+  int i;
+
+  memset (img, 0, SPAN);
+  for (i = 0; i < SPAN / 8; i++)
+    img[i] = rand32 (seed);
+  for (i = SPAN / 2; i < SPAN; i++)
+    img[i] = 0xa5;
+}
+
+static int load (Target *target, uint32_t addr, uint32_t size, double *secs)
+{
+  double t0 = now ();
+  int rv = lzload (addr, img, size);
+
+  *secs = now () - t0;
+  if (rv)
+    return rv;
+  target->MemcpyFrom (rb, addr, size);
+  return memcmp (rb, img, size) ? -1 : 0;
+}
+
+int main (int argc, char **argv)
+{
+  Target *target;
+  uint32_t seed = SEED, save[2], vec[2];
+  double lz, raw, t0;
+  int i;
+
+  if (argc != 2)
+    err ("Must pass interface");
+
+  // Open interface to flexsoc
+  target = Target::Ptr (argv[1]);
+  target->CPUReset (true);
+
+  // Whole ROM image including vectors
+  sparse (&seed);
+  if (load (target, ROM, SPAN, &lz))
+    err ("ROM load failed");
+  t0 = now ();
+  target->MemcpyTo (ROM, img, SPAN);
+  raw = now () - t0;
+  printf ("ROM %d bytes: lz %.1f ms, raw %.1f ms (%.1fx)\n", SPAN, lz * 1e3, raw * 1e3, raw / lz);
+
+  // Image clear of vectors leaves them untouched
+  target->ReadW (ROM, save, 2);
+  sparse (&seed);
+  if (load (target, ROM + 0x400, SPAN / 2, &lz))
+    err ("ROM offset load failed");
+  target->ReadW (ROM, vec, 2);
+  if (memcmp (save, vec, sizeof (vec)))
+    err ("Vectors not restored");
+
+  // RAM below the decompressor
+  sparse (&seed);
+  if (load (target, RAM, SPAN / 4, &lz))
+    err ("RAM load failed");
+
+  // Incompressible must be refused
+  for (i = 0; i < SPAN; i++)
+    img[i] = rand32 (&seed);
+  if (load (target, ROM, SPAN, &lz) != 1)
+    err ("Random data not refused");
+
+  // Close interface
+  delete target;
+  return 0;
+}
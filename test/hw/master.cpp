@@ -85,6 +85,114 @@ static int read_test (void)
   return 0;
 }
 
+static int memcpy_test (void)
+{
+  int i, j;
+  uint32_t seed = SEED;
+  uint8_t exp[256], dat[256];
+  flexsoc_profile_t prof = *flexsoc_profile_builtin (true);
+  static const int offs[] = {0, 1, 2, 3};
+  static const int lens[] = {1, 3, 15, 16, 17, 37, 250};
+
+  // Generate random data
+  for (i = 0; i < (int)sizeof (exp); i++)
+    exp[i] = rand32 (&seed) & 0xff;
+
+  for (i = 0; i < 4; i++) {
+    for (j = 0; j < (int)(sizeof (lens) / sizeof (lens[0])); j++) {
+
+      // Planned write, byte readback
+      memset (dat, 0, sizeof (dat));
+      if (flexsoc_writeb (ADDR + 0x40, dat, sizeof (dat)) ||
+          flexsoc_memcpy_to (ADDR + 0x40 + offs[i], exp, lens[j]) ||
+          flexsoc_readb (ADDR + 0x40 + offs[i], dat, lens[j]))
+        return -1;
+      if (memcmp (exp, dat, lens[j]))
+        return -1;
+
+      // Byte write, planned readback
+      memset (dat, 0, sizeof (dat));
+      if (flexsoc_writeb (ADDR + 0x40 + offs[i], &exp[j], lens[j]) ||
+          flexsoc_memcpy_from (dat, ADDR + 0x40 + offs[i], lens[j]))
+        return -1;
+      if (memcmp (&exp[j], dat, lens[j]))
+        return -1;
+    }
+  }
+
+  // Strict region rejects unaligned access
+  prof.strict = 4;
+  if (flexsoc_ctx_region (flexsoc_ctx_current (), ADDR + 0x40, 0x100, &prof))
+    return -1;
+  if (!flexsoc_memcpy_to (ADDR + 0x41, exp, 16))
+    return -1;
+  if (flexsoc_memcpy_to (ADDR + 0x40, exp, 16) ||
+      flexsoc_memcpy_from (dat, ADDR + 0x40, 16) ||
+      memcmp (exp, dat, 16))
+    return -1;
+  flexsoc_ctx_region_clear (flexsoc_ctx_current ());
+  return 0;
+}
+
+// Mixed width vector ops match plain accesses
+static int vec_test (void)
+{
+  int i;
+  uint32_t seed = SEED;
+  uint8_t exp[16], dat[16];
+  flexsoc_vec_t vec[12];
+  flexsoc_profile_t prof = *flexsoc_profile_builtin (true);
+
+  // Generate random data
+  for (i = 0; i < (int)sizeof (exp); i++)
+    exp[i] = rand32 (&seed) & 0xff;
+
+  // Scatter write word, two hwrds and four bytes per word
+  for (i = 0; i < 4; i++) {
+    vec[i] = {(uint32_t)(ADDR + 0x180 + i * 4), (uint32_t)(exp[i * 4] | (exp[i * 4 + 1] << 8) |
+                                                       (exp[i * 4 + 2] << 16) | (exp[i * 4 + 3] << 24)), true, 4};
+    vec[4 + i] = {(uint32_t)(ADDR + 0x190 + i * 2), (uint32_t)(exp[i * 2] | (exp[i * 2 + 1] << 8)), true, 2};
+    vec[8 + i] = {(uint32_t)(ADDR + 0x1a0 + i), exp[i], true, 1};
+  }
+  if (flexsoc_ctx_vec (flexsoc_ctx_current (), vec, 12))
+    return -1;
+
+  // Plain readback
+  memset (dat, 0, sizeof (dat));
+  if (flexsoc_readb (ADDR + 0x180, dat, 16) || memcmp (exp, dat, 16))
+    return -1;
+  if (flexsoc_readb (ADDR + 0x190, dat, 8) || memcmp (exp, dat, 8))
+    return -1;
+  if (flexsoc_readb (ADDR + 0x1a0, dat, 4) || memcmp (exp, dat, 4))
+    return -1;
+
+  // Gather read back
+  for (i = 0; i < 12; i++)
+    vec[i].write = false;
+  if (flexsoc_ctx_vec (flexsoc_ctx_current (), vec, 12))
+    return -1;
+  for (i = 0; i < 4; i++)
+    if ((vec[i].data != (uint32_t)(exp[i * 4] | (exp[i * 4 + 1] << 8) |
+                                   (exp[i * 4 + 2] << 16) | (exp[i * 4 + 3] << 24))) ||
+        (vec[4 + i].data != (uint32_t)(exp[i * 2] | (exp[i * 2 + 1] << 8))) ||
+        (vec[8 + i].data != exp[i]))
+      return -1;
+
+  // Ops split at region changes - hwrds in their own strict region
+  prof.strict = 2;
+  if (flexsoc_ctx_region (flexsoc_ctx_current (), ADDR + 0x190, 0x10, &prof))
+    return -1;
+  if (flexsoc_ctx_vec (flexsoc_ctx_current (), vec, 12))
+    return -1;
+
+  // Bytes refused by strict region
+  vec[0] = {ADDR + 0x191, 0, false, 1};
+  if (!flexsoc_ctx_vec (flexsoc_ctx_current (), vec, 1))
+    return -1;
+  flexsoc_ctx_region_clear (flexsoc_ctx_current ());
+  return 0;
+}
+
 int main (int argc, char **argv)
 {
   int rv;
@@ -105,6 +213,14 @@ int main (int argc, char **argv)
   if (read_test ())
     err ("Read test failed");
 
+  // Run memcpy tests
+  if (memcpy_test ())
+    err ("Memcpy test failed");
+
+  // Run vector tests
+  if (vec_test ())
+    err ("Vector test failed");
+
   // Close interface
   flexsoc_close ();
   return 0;
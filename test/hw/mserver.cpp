@@ -0,0 +1,192 @@
+/**
+ *  Test master access server. Two clients share the link through the memfd
+ *  rings: one streams blocks, the other polls single words. Data must round
+ *  trip intact and deficit round robin must keep the poller moving while the
+ *  blocks go through.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Target.h"
+#include "mserver.h"
+#include "mserver_proto.h"
+#include "evloop.h"
+#include "mclient.h"
+#include "common.h"
+#include "err.h"
+
+#define SEED       0xdeadbeef
+#define BULK_ADDR  0x20000000
+#define BULK_SPAN  (32 * 1024)
+#define BULK_PASS  4
+#define POLL_ADDR  0x20008000
+#define CHUNK      (BULK_SPAN / 4)
+
+static char path[64];
+static volatile bool bulk_done;
+static int bulk_rv, poll_rv;
+static double bulk_time, poll_max;
+static int poll_cnt;
+
+static double now (void)
+{
+  timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Staged writes, in place pipelined reads and unaligned staged reads
+static int bulk_run (mclient *cl)
+{
+  static uint8_t src[BULK_SPAN], dst[BULK_SPAN];
+  uint8_t *shared;
+  uint32_t seed = SEED;
+  int i, j, tag[4];
+
+  shared = (uint8_t *)mclient_alloc (cl, BULK_SPAN);
+  if (!shared)
+    return -1;
+
+  for (i = 0; i < BULK_PASS; i++) {
+    for (j = 0; j < BULK_SPAN; j++)
+      src[j] = rand32 (&seed) & 0xff;
+    if (mclient_memcpy_to (cl, BULK_ADDR, src, BULK_SPAN))
+      return -1;
+
+    // Four reads in flight on the ring
+    memset (shared, 0, BULK_SPAN);
+    for (j = 0; j < 4; j++)
+      tag[j] = mclient_submit (cl, MSRV_READ, 4, BULK_ADDR + j * CHUNK,
+                               shared + j * CHUNK, CHUNK);
+    for (j = 0; j < 4; j++)
+      if ((tag[j] < 0) || (mclient_wait (cl, tag[j]) != MSRV_OK))
+        return -1;
+    if (memcmp (src, shared, BULK_SPAN)) {
+      printf ("Shared read mismatch: pass %d\n", i);
+      return -1;
+    }
+
+    memset (dst, 0, BULK_SPAN);
+    if (mclient_memcpy_from (cl, dst, BULK_ADDR + 1, BULK_SPAN - 3) ||
+        memcmp (src + 1, dst, BULK_SPAN - 3)) {
+      printf ("Staged read mismatch: pass %d\n", i);
+      return -1;
+    }
+  }
+  mclient_free (cl, shared);
+  return 0;
+}
+
+static void *bulk_thread (void *arg)
+{
+  mclient *cl = mclient_open (path, BULK_SPAN * 2);
+  double t = now ();
+
+  bulk_rv = cl ? bulk_run (cl) : -1;
+  bulk_time = now () - t;
+  bulk_done = true;
+  if (cl)
+    mclient_close (cl);
+  return NULL;
+}
+
+// Word write/read back and vec round trips until bulk client finishes
+static void *poll_thread (void *arg)
+{
+  mclient *cl = mclient_open (path, 0);
+  mclient_vec_t vec[8];
+  uint32_t val, seed = ~SEED;
+  double t;
+  int i;
+
+  if (!cl) {
+    poll_rv = -1;
+    return NULL;
+  }
+  while (!bulk_done && !poll_rv) {
+    t = now ();
+    val = rand32 (&seed);
+    mclient_reg_write (cl, POLL_ADDR, val);
+    if (mclient_reg_read (cl, POLL_ADDR) != val) {
+      printf ("Poll mismatch: %d\n", poll_cnt);
+      poll_rv = -1;
+    }
+    for (i = 0; i < 8; i++)
+      vec[i] = {POLL_ADDR + 4 + (uint32_t)(i / 2) * 4, val + i / 2, !(i & 1)};
+    if (mclient_vec (cl, vec, 8))
+      poll_rv = -1;
+    for (i = 1; i < 8; i += 2)
+      if (vec[i].data != val + i / 2) {
+        printf ("Vec mismatch: %d\n", poll_cnt);
+        poll_rv = -1;
+      }
+    t = now () - t;
+    if (t > poll_max)
+      poll_max = t;
+    poll_cnt++;
+  }
+  mclient_close (cl);
+  return NULL;
+}
+
+static void *clients (void *arg)
+{
+  pthread_t bulk, poll;
+
+  pthread_create (&poll, NULL, poll_thread, NULL);
+  pthread_create (&bulk, NULL, bulk_thread, NULL);
+  pthread_join (bulk, NULL);
+  pthread_join (poll, NULL);
+  evloop_stop ();
+  return NULL;
+}
+
+int main (int argc, char **argv)
+{
+  Target *target;
+  pthread_t thread;
+
+  if (argc != 2)
+    err ("Must pass interface");
+
+  // Signals stay with the loop - before any threads
+  if (evloop_init ())
+    err ("Failed to setup event loop");
+
+  // Open interface to flexsoc, keep CPU off RAM
+  target = Target::Ptr (argv[1]);
+  target->CPUReset (true);
+
+  snprintf (path, sizeof (path), "/tmp/flexsoc-mserver-%d", getpid ());
+  if (mserver_open (path))
+    err ("Failed to start server: %s", path);
+
+  // Serve clients from main thread until they finish
+  pthread_create (&thread, NULL, clients, NULL);
+  evloop_run ();
+  pthread_join (thread, NULL);
+  mserver_close ();
+  evloop_cleanup ();
+
+  printf ("bulk %.1f ms, polls=%d max %.1f ms\n", bulk_time * 1e3, poll_cnt, poll_max * 1e3);
+  if (bulk_rv)
+    err ("Bulk client failed");
+  if (poll_rv)
+    err ("Poll client failed");
+
+  // Poller must not wait out the block traffic
+  if (!poll_cnt || (poll_max > bulk_time / 2))
+    err ("Poll client starved");
+
+  delete target;
+  return 0;
+}
@@ -0,0 +1,176 @@
+/**
+ *  Test PC sampling profiler. Runs arm-sanity on the local CPU and samples
+ *  DWT_PCSR through the SWD bridge, which must be looped back to the CPU
+ *  debug port. Every PC sampled while running must fall inside the image.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <elf.h>
+
+#include "Target.h"
+#include "evloop.h"
+#include "profile.h"
+#include "remote.h"
+#include "err.h"
+
+#define RUN_MS      200
+#define TEXT_BASE   0x00000000
+
+static uint8_t *read_bin (const char *filename, long *size)
+{
+  FILE *fp;
+  uint8_t *buf;
+
+  fp = fopen (filename, "rb");
+  if (!fp)
+    err ("Failed to open: %s (build ARM tests)", filename);
+  fseek (fp, 0, SEEK_END);
+  *size = ftell (fp);
+  fseek (fp, 0, SEEK_SET);
+  buf = (uint8_t *)calloc (1, *size + 4);
+  if (!buf)
+    err ("Failed to malloc");
+  if (fread (buf, 1, *size, fp) != (size_t)*size)
+    err ("Failed to read: %s", filename);
+  fclose (fp);
+  return buf;
+}
+
+// Symbols for a raw image - one function covering all of it
+static int write_elf (const char *path, uint32_t base, uint32_t size)
+{
+  static const char strtab[] = "\0image";
+  struct {
+    Elf32_Ehdr eh;
+    Elf32_Shdr sh[3];
+    Elf32_Sym  sym[2];
+    char       str[sizeof (strtab)];
+  } elf = {};
+  FILE *fp;
+  int rv;
+
+  memcpy (elf.eh.e_ident, ELFMAG, SELFMAG);
+  elf.eh.e_ident[EI_CLASS] = ELFCLASS32;
+  elf.eh.e_ident[EI_DATA] = ELFDATA2LSB;
+  elf.eh.e_ident[EI_VERSION] = EV_CURRENT;
+  elf.eh.e_type = ET_EXEC;
+  elf.eh.e_machine = EM_ARM;
+  elf.eh.e_version = EV_CURRENT;
+  elf.eh.e_ehsize = sizeof (Elf32_Ehdr);
+  elf.eh.e_shoff = offsetof (decltype (elf), sh);
+  elf.eh.e_shentsize = sizeof (Elf32_Shdr);
+  elf.eh.e_shnum = 3;
+
+  elf.sh[1].sh_type = SHT_SYMTAB;
+  elf.sh[1].sh_offset = offsetof (decltype (elf), sym);
+  elf.sh[1].sh_size = sizeof (elf.sym);
+  elf.sh[1].sh_link = 2;
+  elf.sh[1].sh_entsize = sizeof (Elf32_Sym);
+  elf.sh[2].sh_type = SHT_STRTAB;
+  elf.sh[2].sh_offset = offsetof (decltype (elf), str);
+  elf.sh[2].sh_size = sizeof (strtab);
+
+  elf.sym[1].st_name = 1;
+  elf.sym[1].st_value = base | 1;
+  elf.sym[1].st_size = size;
+  elf.sym[1].st_info = ELF32_ST_INFO (STB_GLOBAL, STT_FUNC);
+  elf.sym[1].st_shndx = SHN_ABS;
+  memcpy (elf.str, strtab, sizeof (strtab));
+
+  fp = fopen (path, "wb");
+  if (!fp)
+    return -1;
+  rv = (fwrite (&elf, sizeof (elf), 1, fp) == 1) ? 0 : -1;
+  fclose (fp);
+  return rv;
+}
+
+static void stop_cb (int fd, void *arg)
+{
+  evloop_stop ();
+}
+
+int main (int argc, char **argv)
+{
+  Target *target;
+  FILE *fp;
+  char prefix[64], path[80], line[256], *p;
+  unsigned long long cnt, inside = 0, outside = 0, halted = 0;
+  uint32_t pc;
+  uint8_t *bin;
+  long size;
+
+  if (argc != 2)
+    err ("Must pass interface");
+
+  // Signals stay with the loop - before any threads
+  if (evloop_init ())
+    err ("Failed to setup event loop");
+
+  // Load firmware and let it run
+  target = Target::Ptr (argv[1]);
+  target->CPUReset (true);
+  bin = read_bin (ARM_BIN_DIR "/arm-sanity.bin", &size);
+  target->MemcpyTo (TEXT_BASE, bin, size);
+  free (bin);
+  target->CPUReset (false);
+
+  // Attach to running CPU through the bridge
+  if (remote_open (0, false))
+    err ("Remote not found - loop bridge back to CPU debug port");
+
+  // Sample for a while
+  snprintf (prefix, sizeof (prefix), "/tmp/flexsoc-profile-%d", getpid ());
+  snprintf (path, sizeof (path), "%s.elf", prefix);
+  if (write_elf (path, TEXT_BASE, size))
+    err ("Failed to write: %s", path);
+  if (profile_open (path, prefix, 0, 0))
+    err ("Failed to start profiler");
+  evloop_timer (RUN_MS, false, stop_cb, NULL);
+  evloop_run ();
+  profile_close ();
+  unlink (path);
+
+  // Histogram - function;address count or [halted] count
+  snprintf (path, sizeof (path), "%s.folded", prefix);
+  fp = fopen (path, "r");
+  if (!fp)
+    err ("No profile written: %s", path);
+  while (fgets (line, sizeof (line), fp)) {
+    if (sscanf (line, "[halted] %llu", &cnt) == 1)
+      halted += cnt;
+    else if ((p = strchr (line, ';')) && (sscanf (p + 1, "0x%x %llu", &pc, &cnt) == 2)) {
+      if ((pc >= TEXT_BASE) && (pc < TEXT_BASE + size))
+        inside += cnt;
+      else {
+        printf ("PC outside image: 0x%08X x%llu\n", pc, cnt);
+        outside += cnt;
+      }
+    }
+  }
+  fclose (fp);
+  unlink (path);
+  snprintf (path, sizeof (path), "%s.flat", prefix);
+  unlink (path);
+  snprintf (path, sizeof (path), "%s.perf", prefix);
+  unlink (path);
+
+  printf ("samples: %llu in image, %llu outside, %llu halted\n", inside, outside, halted);
+  if (!inside || outside)
+    err ("Profile test failed");
+
+  // Cleanup
+  remote_close ();
+  target->CPUReset (true);
+  evloop_cleanup ();
+  delete target;
+  return 0;
+}
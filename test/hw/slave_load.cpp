@@ -0,0 +1,218 @@
+/**
+ *  Slave round trip latency under concurrent master load. Firmware
+ *  (test/arm/src/slave-load.c) times reads of a slave address with the DWT
+ *  cycle counter while the host optionally streams bulk master traffic.
+ *  Comparing the idle and loaded distributions exposes head of line blocking
+ *  between master transfers and slave responses on the link.
+ *
+ *  All rights reserved.
+ *  Tiny Labs Inc
+ *  2020
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "Target.h"
+#include "common.h"
+#include "err.h"
+
+// Must match test/arm/src/slave-load.c
+#define MBOX_ADDR     0x20002000
+#define SAMPLES       1024
+#define CMD_EXIT      0xffffffff
+
+// Mailbox word offsets
+#define MBOX_CMD      (MBOX_ADDR + 0x0)
+#define MBOX_DONE     (MBOX_ADDR + 0x4)
+#define MBOX_CNT      (MBOX_ADDR + 0x8)
+#define MBOX_OVERHEAD (MBOX_ADDR + 0xC)
+#define MBOX_CYCLES   (MBOX_ADDR + 0x10)
+
+// Firmware exit register
+#define EXIT_ADDR     0xf0000000
+#define EXIT_PASS     0x20026
+
+// Background master stream - outside firmware memory
+#define LOAD_ADDR     0x20008000
+#define LOAD_WORDS    (8 * 1024 / 4)
+
+#define PHASE_TIMEOUT_MS  10000
+
+static Target *target;
+static volatile bool stop;
+static volatile int exit_code = -1;
+static uint64_t load_bytes;
+
+static void slave_cb (uint8_t *buf, int len)
+{
+  uint8_t resp[5];
+  uint32_t addr = ntohl (*((uint32_t *)&buf[1]));
+
+  // Write - check for firmware exit
+  if (buf[0] & 0x08) {
+    if ((addr == EXIT_ADDR) && (len == 9))
+      exit_code = ntohl (*((uint32_t *)&buf[5]));
+    resp[0] = 0x00;
+    target->SlaveSend (resp, 1);
+  }
+  // Readw
+  else {
+    resp[0] = 0x30;
+    memcpy (&resp[1], "\x11\x22\x33\x44", 4);
+    target->SlaveSend (resp, 5);
+  }
+}
+
+static void *load_thread (void *arg)
+{
+  uint32_t *buf = (uint32_t *)arg;
+
+  // Stream bulk master traffic until stopped
+  while (!stop) {
+    target->WriteW (LOAD_ADDR, buf, LOAD_WORDS);
+    target->ReadW (LOAD_ADDR, buf, LOAD_WORDS);
+    load_bytes += 2 * LOAD_WORDS * 4;
+  }
+  return NULL;
+}
+
+static uint32_t *read_bin (const char *filename, long *size)
+{
+  FILE *fp;
+  uint32_t *buf;
+
+  fp = fopen (filename, "rb");
+  if (!fp)
+    err ("Failed to open: %s (build ARM tests)", filename);
+  fseek (fp, 0, SEEK_END);
+  *size = ftell (fp);
+  fseek (fp, 0, SEEK_SET);
+  buf = (uint32_t *)calloc (1, *size + 4);
+  if (!buf)
+    err ("Failed to malloc");
+  if (fread (buf, 1, *size, fp) != (size_t)*size)
+    err ("Failed to read: %s", filename);
+  fclose (fp);
+  return buf;
+}
+
+static int cmp_u32 (const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static uint32_t percentile (uint32_t *s, int n, double p)
+{
+  int idx = (int)((p * n) + 0.999999) - 1;
+  return s[(idx < 0) ? 0 : (idx >= n) ? n - 1 : idx];
+}
+
+static int phase (const char *name, bool load)
+{
+  int i, cnt;
+  uint32_t done, overhead, freq, ms = 0;
+  uint32_t cycles[SAMPLES], *buf = NULL;
+  pthread_t tid;
+  double us;
+
+  // Start background master stream
+  if (load) {
+    buf = (uint32_t *)malloc (LOAD_WORDS * 4);
+    if (!buf)
+      err ("Failed to malloc");
+    for (i = 0; i < LOAD_WORDS; i++)
+      buf[i] = i;
+    stop = false;
+    load_bytes = 0;
+    if (pthread_create (&tid, NULL, load_thread, buf))
+      err ("Failed to create load thread");
+  }
+
+  // Kick firmware and wait for phase to complete
+  done = target->ReadReg (MBOX_DONE);
+  target->WriteReg (MBOX_CMD, SAMPLES);
+  do {
+    usleep (1000);
+    if (++ms > PHASE_TIMEOUT_MS)
+      err ("%s: timeout waiting for firmware", name);
+  } while (target->ReadReg (MBOX_DONE) == done);
+
+  // Stop master stream
+  if (load) {
+    stop = true;
+    pthread_join (tid, NULL);
+    free (buf);
+  }
+
+  // Collect samples
+  cnt = target->ReadReg (MBOX_CNT);
+  overhead = target->ReadReg (MBOX_OVERHEAD);
+  if ((cnt <= 0) || (cnt > SAMPLES))
+    err ("%s: invalid sample count %d", name, cnt);
+  target->ReadW (MBOX_CYCLES, cycles, cnt);
+  for (i = 0; i < cnt; i++)
+    cycles[i] -= (cycles[i] > overhead) ? overhead : cycles[i];
+  qsort (cycles, cnt, sizeof (uint32_t), cmp_u32);
+
+  // Report in cycles and time
+  freq = target->CoreFreq ();
+  us = freq ? 1e6 / freq : 0;
+  printf ("%-6s n=%d median=%u (%.2fus) p99=%u (%.2fus) p99.9=%u (%.2fus) max=%u (%.2fus)",
+          name, cnt,
+          percentile (cycles, cnt, 0.5), percentile (cycles, cnt, 0.5) * us,
+          percentile (cycles, cnt, 0.99), percentile (cycles, cnt, 0.99) * us,
+          percentile (cycles, cnt, 0.999), percentile (cycles, cnt, 0.999) * us,
+          cycles[cnt - 1], cycles[cnt - 1] * us);
+  if (load)
+    printf (" master=%lluB", (unsigned long long)load_bytes);
+  printf ("\n");
+  return 0;
+}
+
+int main (int argc, char **argv)
+{
+  int ms = 0;
+  long size;
+  uint32_t *bin, zero[4] = {0};
+
+  if (argc != 2)
+    err ("Must pass interface");
+
+  // Open target
+  target = Target::Ptr (argv[1]);
+
+  // Answer slave requests
+  target->SlaveRegister (&slave_cb);
+  target->SlaveEn (true);
+
+  // Load firmware and clear mailbox
+  target->CPUReset (true);
+  bin = read_bin (ARM_BIN_DIR "/arm-slave-load.bin", &size);
+  target->MemcpyTo (0, bin, size);
+  free (bin);
+  target->WriteW (MBOX_ADDR, zero, 4);
+  target->CPUReset (false);
+
+  // Slave round trips with idle link then under master load
+  phase ("idle", false);
+  phase ("loaded", true);
+
+  // Stop firmware
+  target->WriteReg (MBOX_CMD, CMD_EXIT);
+  while ((exit_code < 0) && (ms++ < PHASE_TIMEOUT_MS))
+    usleep (1000);
+  target->CPUReset (true);
+  if (exit_code != EXIT_PASS)
+    err ("Firmware failed: %d", exit_code);
+
+  // Close target
+  target->SlaveEn (false);
+  delete target;
+  return 0;
+}